@@ -0,0 +1,651 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "camera.h"
+#include "config.h"
+#include "crc32c.h"
+#include "ctl.h"
+#include "download.h"
+#include "event.h"
+#include "image.h"
+#include "lcd.h"
+#include "mock.h"
+#include "prof.h"
+#include "ui.h"
+
+// microbenchmarks of the whole program linked against mock_pigpio.c and
+// mock_gphoto2.c: the event loop runs as in the device, the benchmarks
+// drive it from here. Every result is one json object per line, the log
+// of the program comes in between:
+//   {"bench": name, "unit": "ns"|"us"|"MB/s"|"allocs", "n", "mean", "p50", "p99", "max", ...}
+// It exits with 1 if the capture loop allocates once it's warmed up.
+
+#define BENCH_SOCK "/tmp/timelapse-bench.sock"
+#define BENCH_FILE "/tmp/timelapse-bench.raw"
+#define BENCH_DIR  "/tmp/timelapse-bench.d"
+
+#define LCD_LOOPS   20000
+#define UI_LOOPS    20000
+#define EVENT_LOOPS  2000
+#define CRC_LOOPS     200
+#define FILE_LOOPS     20
+
+// a raw file of a 24 mpix body and the preview jpeg in it
+#define FILE_BYTES    (25LL << 20)
+#define PREVIEW_BYTES (200LL << 10)
+
+// an event the loop was too busy to take is sent again after this long
+#define EVENT_RETRY_NS 10000000LL
+
+// frames of a run that may still fill the pools, and the jpeg the mock
+// camera hands out meanwhile
+#define WARMUP_FRAMES  2
+
+// frames measured after warm-up, fewer and the run proves nothing
+#define STEADY_FRAMES 10
+#define JPEG_W      1200
+#define JPEG_H       800
+
+// the menu left alone, in windows of this many milliseconds
+#define IDLE_WINDOWS     8
+#define IDLE_MS        500
+
+// event.c's main(), renamed for this build
+int event_main(int argc, char *argv[]);
+
+// heap calls of the program, see WRAP_ALLOC in the Makefile; libc and
+// libjpeg allocate on their own, unseen
+static long nr_allocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+char *__real_strdup(const char *s);
+
+//-----------------------------------------------------------------------------
+
+void *__wrap_malloc(size_t size)
+{
+    __atomic_fetch_add(&nr_allocs, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    __atomic_fetch_add(&nr_allocs, 1, __ATOMIC_RELAXED);
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+    __atomic_fetch_add(&nr_allocs, 1, __ATOMIC_RELAXED);
+    return __real_realloc(p, size);
+}
+
+char *__wrap_strdup(const char *s)
+{
+    __atomic_fetch_add(&nr_allocs, 1, __ATOMIC_RELAXED);
+    return __real_strdup(s);
+}
+
+//-----------------------------------------------------------------------------
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+//-----------------------------------------------------------------------------
+// 'extra' holds more fields, ",\"key\":value" each
+static void report(const char *name, const char *unit, double *v, int n, const char *extra)
+{
+    double sum = 0;
+    int i;
+
+    if (n == 0)
+    {
+        printf("{\"bench\":\"%s\",\"unit\":\"%s\",\"n\":0%s}\n", name, unit, extra);
+        return;
+    }
+
+    qsort(v, n, sizeof(double), cmp_double);
+    for (i = 0; i < n; i++)
+        sum += v[i];
+
+    printf("{\"bench\":\"%s\",\"unit\":\"%s\",\"n\":%d,\"mean\":%.1f,\"p50\":%.1f,\"p99\":%.1f,\"max\":%.1f%s}\n",
+           name, unit, n, sum / n, v[n / 2], v[n * 99 / 100], v[n - 1], extra);
+    fflush(stdout);
+}
+
+//-----------------------------------------------------------------------------
+
+static void *event_thread(void *arg)
+{
+    char *argv[] = { "timelapse-bench", NULL };
+
+    event_main(1, argv);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+static int command(int op, long value)
+{
+    struct CtlMsg msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.op = op;
+    msg.value = value;
+    post_commands(&msg, 1);
+    return msg.status;
+}
+
+//-----------------------------------------------------------------------------
+// a full 16x2 redraw on one backend, every other one to blanks so that
+// all of both rows goes out each time
+static void bench_redraw(int backend, int loops)
+{
+    static const char *names[] = { "lcd_redraw_gpio", "lcd_redraw_pcf8574", "lcd_redraw_term" };
+    static double v[LCD_LOOPS];
+    unsigned long writes, i2c;
+    unsigned long long delay, bytes;
+    char extra[160];
+    long long t;
+    int i;
+
+    lcd_destroy();
+    lcd_init(backend, 0x27);
+
+    writes = mock_gpio_writes;
+    delay = mock_gpio_delay_us;
+    i2c = mock_i2c_writes;
+    bytes = mock_i2c_bytes;
+    for (i = 0; i < loops; i++)
+    {
+        t = now_ns();
+        if (i & 1)
+            lcd_screen(NULL, NULL);
+        else
+            lcd_screen("Interval   00:05", "Frames  123/9999");
+        v[i] = now_ns() - t;
+    }
+
+    // the cpu time of the call, and what it keeps the display busy: the
+    // delays on the pins, 9 clocks a byte at 100 kHz on the backpack
+    writes = (mock_gpio_writes - writes) / loops;
+    delay = (mock_gpio_delay_us - delay) / loops;
+    i2c = (mock_i2c_writes - i2c) / loops;
+    bytes = (mock_i2c_bytes - bytes) / loops;
+    if (backend == LCD_PCF8574)
+        snprintf(extra, sizeof(extra), ",\"i2c_writes\":%lu,\"i2c_bytes\":%llu,\"bus_us\":%llu",
+                 i2c, bytes, bytes * 90 + delay);
+    else
+        snprintf(extra, sizeof(extra), ",\"gpio_writes\":%lu,\"bus_us\":%llu", writes, delay);
+    report(names[backend], "ns", v, loops, extra);
+}
+
+//-----------------------------------------------------------------------------
+// what the program costs doing nothing: the menu on screen, the backlight
+// on, no run, per hour
+static void bench_idle(void)
+{
+    static double v[IDLE_WINDOWS];
+    struct ProfStat st[PROF_MAX];
+    long long cpu_us = 0;
+    long wakeups, all = 0;
+    double hours, total_h = 0;
+    char extra[128];
+    int i, j, n;
+
+    for (i = 0; i < IDLE_WINDOWS; i++)
+    {
+        prof_reset();
+        usleep(IDLE_MS * 1000);
+        n = prof_read(st, PROF_MAX, &hours);
+
+        wakeups = 0;
+        for (j = 0; j < n; j++)
+        {
+            wakeups += st[j].wakeups;
+            cpu_us += st[j].cpu_us;
+        }
+        v[i] = wakeups / hours;
+        all += wakeups;
+        total_h += hours;
+    }
+
+    // the threads' cpu is counted at their next wakeup, a window may
+    // miss some but the total doesn't
+    snprintf(extra, sizeof(extra), ",\"cpu_ms_per_h\":%.0f,\"j_per_h\":%.3f",
+             cpu_us / 1e3 / total_h, prof_joules(all, cpu_us, total_h));
+    report("idle_wakeups", "per_h", v, IDLE_WINDOWS, extra);
+}
+
+//-----------------------------------------------------------------------------
+// a row of the display: the cursor command plus 16 characters
+static void bench_lcd(void)
+{
+    static double v[LCD_LOOPS];
+    unsigned long writes;
+    unsigned long long delay;
+    char extra[128];
+    long long t;
+    int i;
+
+    writes = mock_gpio_writes;
+    delay = mock_gpio_delay_us;
+    for (i = 0; i < LCD_LOOPS; i++)
+    {
+        t = now_ns();
+        lcd_puts("0123456789ABCDEF");
+        v[i] = now_ns() - t;
+    }
+
+    // the cpu time of the calls, and what the delays add on real pins
+    snprintf(extra, sizeof(extra), ",\"gpio_writes\":%lu,\"bus_us\":%llu",
+             (mock_gpio_writes - writes) / LCD_LOOPS, (mock_gpio_delay_us - delay) / LCD_LOOPS);
+    report("lcd_puts_16", "ns", v, LCD_LOOPS, extra);
+
+    writes = mock_gpio_writes;
+    delay = mock_gpio_delay_us;
+    for (i = 0; i < LCD_LOOPS; i++)
+    {
+        t = now_ns();
+        lcd_putc('x');
+        v[i] = now_ns() - t;
+    }
+
+    // lcd_putc() is one transaction of two bytes: the position and the
+    // character
+    snprintf(extra, sizeof(extra), ",\"gpio_writes\":%lu,\"bus_us\":%llu,\"bytes\":2",
+             (mock_gpio_writes - writes) / LCD_LOOPS, (mock_gpio_delay_us - delay) / LCD_LOOPS);
+    report("lcd_putc", "ns", v, LCD_LOOPS, extra);
+
+    bench_redraw(LCD_GPIO, LCD_LOOPS);
+    bench_redraw(LCD_PCF8574, LCD_LOOPS);
+    bench_redraw(LCD_TERM, LCD_LOOPS / 1000);
+
+    // the event loop goes on with the display it started with
+    lcd_destroy();
+    lcd_init(LCD_GPIO, 0);
+}
+
+//-----------------------------------------------------------------------------
+// redrawing the timer screen without a change
+static void bench_ui(void)
+{
+    static double v[UI_LOOPS];
+    struct Event ev;
+    unsigned long writes;
+    unsigned long long delay;
+    char extra[128];
+    long value = 3725;
+    long long t;
+    int i;
+
+    ev.type = EV_NONE;
+    ev.value = 0;
+
+    writes = mock_gpio_writes;
+    delay = mock_gpio_delay_us;
+    for (i = 0; i < UI_LOOPS; i++)
+    {
+        t = now_ns();
+        user_timer(&value, ev);
+        v[i] = now_ns() - t;
+    }
+
+    snprintf(extra, sizeof(extra), ",\"gpio_writes\":%lu,\"bus_us\":%llu",
+             (mock_gpio_writes - writes) / UI_LOOPS, (mock_gpio_delay_us - delay) / UI_LOOPS);
+    report("user_timer", "ns", v, UI_LOOPS, extra);
+}
+
+//-----------------------------------------------------------------------------
+// encoder turns: from generate_event() to the first write of the redraw,
+// and a control request through the loop and back
+static void bench_events(void)
+{
+    static double lat[EVENT_LOOPS], ping[EVENT_LOOPS];
+    struct Event ev;
+    unsigned long writes;
+    long long t;
+    char extra[64];
+    int i, n = 0, dropped = 0;
+
+    for (i = 0; i < EVENT_LOOPS; i++)
+    {
+        ev.type = EV_PULSE;
+        ev.value = (i & 1) ? 1 : -1;
+
+        writes = mock_gpio_writes;
+        t = now_ns();
+        generate_event(ev);
+
+        while (mock_gpio_writes == writes)
+        {
+            if (now_ns() - t > EVENT_RETRY_NS)
+            {
+                dropped++;
+                t = now_ns();
+                generate_event(ev);
+            }
+            sched_yield();
+        }
+        lat[n++] = (now_ns() - t) / 1e3;
+
+        // the loop is idle again once the request went through
+        t = now_ns();
+        command(CTL_PING, 0);
+        ping[i] = (now_ns() - t) / 1e3;
+    }
+
+    snprintf(extra, sizeof(extra), ",\"dropped\":%d", dropped);
+    report("event_to_lcd", "us", lat, n, extra);
+    report("command_roundtrip", "us", ping, EVENT_LOOPS, "");
+}
+
+//-----------------------------------------------------------------------------
+// a run at 1 s intervals: how far after the slot each capture started
+static void bench_scheduler(int frames)
+{
+    static double v[MOCK_SHOTS];
+    long first, i, n = 0;
+    double frac;
+
+    first = mock_shots;
+    if (command(CTL_SET_INTERVAL, 1) != CTL_OK || command(CTL_SET_DELAY, 0) != CTL_OK ||
+        command(CTL_SET_FRAMES, frames) != CTL_OK || command(CTL_SET_MODE, MODE_INTERVAL) != CTL_OK ||
+        command(CTL_START, 0) != CTL_OK)
+    {
+        fprintf(stderr, "cannot start a run\n");
+        return;
+    }
+    timelapse_wait();
+
+    // the first frame is taken right away, the others on whole seconds
+    for (i = first + 1; i < mock_shots && i < MOCK_SHOTS; i++)
+    {
+        frac = mock_shot_times[i].tv_nsec / 1e3;
+        v[n++] = (frac > 500000) ? frac - 1e6 : frac;
+    }
+
+    report("capture_jitter", "us", v, n, "");
+}
+
+//-----------------------------------------------------------------------------
+// resident set in KB
+static long rss_kb(void)
+{
+    long size, rss;
+    FILE *f;
+
+    f = fopen("/proc/self/statm", "r");
+    if (f == NULL)
+        return -1;
+    if (fscanf(f, "%ld %ld", &size, &rss) != 2)
+        rss = -1;
+    fclose(f);
+
+    return (rss < 0) ? -1 : rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+//-----------------------------------------------------------------------------
+// waits until the mock camera has fired 'shots' times, 0 if it did
+static int wait_shots(long shots, long long deadline)
+{
+    while (mock_shots < shots)
+    {
+        if (now_ns() > deadline)
+            return -1;
+        usleep(1000);
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// a run that downloads, hashes, thumbnails and folds a jpeg per frame:
+// heap calls per frame once the first frames have sized the pools, each
+// counted from one shot to the next. Returns the calls after warm-up, -1
+// if the run couldn't be set up or measured too few frames
+static long bench_steady(int frames)
+{
+    static unsigned char jpeg[1 << 20];
+    static double v[MOCK_SHOTS];
+    struct Image img;
+    char extra[128];
+    long first, last, allocs = 0, rss = 0;
+    long long deadline;
+    int x, y, k, n = 0;
+    FILE *f;
+
+    if (frames < WARMUP_FRAMES + 1 + STEADY_FRAMES)
+        frames = WARMUP_FRAMES + 1 + STEADY_FRAMES;
+
+    // a gradient stands in for a camera jpeg
+    img.width = JPEG_W;
+    img.height = JPEG_H;
+    img.comps = 3;
+    img.pix = malloc((size_t) JPEG_W * JPEG_H * 3);
+    if (img.pix == NULL)
+        return -1;
+    for (y = 0; y < JPEG_H; y++)
+        for (x = 0; x < JPEG_W; x++)
+        {
+            img.pix[(y * JPEG_W + x) * 3] = x * 255 / JPEG_W;
+            img.pix[(y * JPEG_W + x) * 3 + 1] = y * 255 / JPEG_H;
+            img.pix[(y * JPEG_W + x) * 3 + 2] = (x + y) & 0xff;
+        }
+
+    mkdir(BENCH_DIR, 0755);
+    if (image_save(BENCH_DIR "/source.jpg", &img, 90) < 0)
+    {
+        fprintf(stderr, "cannot write %s\n", BENCH_DIR "/source.jpg");
+        image_free(&img);
+        return -1;
+    }
+    image_free(&img);
+
+    f = fopen(BENCH_DIR "/source.jpg", "rb");
+    if (f == NULL)
+        return -1;
+    mock_file_bytes = fread(jpeg, 1, sizeof(jpeg), f);
+    mock_file_data = jpeg;
+    fclose(f);
+
+    glob_outdir = BENCH_DIR;
+    glob_frameidx = BENCH_DIR "/frames.idx";
+    glob_dedup = DEDUP_FLAG;
+
+    // the last run stays on the screen until it's dismissed
+    first = mock_shots;
+    if (command(CTL_STOP, 0) != CTL_OK ||
+        command(CTL_SET_INTERVAL, 1) != CTL_OK || command(CTL_SET_DELAY, 0) != CTL_OK ||
+        command(CTL_SET_FRAMES, frames) != CTL_OK || command(CTL_SET_MODE, MODE_INTERVAL) != CTL_OK ||
+        command(CTL_START, 0) != CTL_OK)
+    {
+        fprintf(stderr, "cannot start a run\n");
+        n = -1;
+    }
+    else 
+    {
+        // frame k is done when frame k + 1 is shot
+        deadline = now_ns() + (frames + 10) * 1000000000LL;
+        if (wait_shots(first + WARMUP_FRAMES + 1, deadline) == 0)
+        {
+            last = __atomic_load_n(&nr_allocs, __ATOMIC_RELAXED);
+            rss = rss_kb();
+            for (k = WARMUP_FRAMES + 1; k < frames && n < MOCK_SHOTS; k++)
+            {
+                if (wait_shots(first + k + 1, deadline) < 0)
+                    break;
+                v[n] = __atomic_load_n(&nr_allocs, __ATOMIC_RELAXED) - last;
+                last += v[n];
+                allocs += v[n++];
+            }
+            rss = rss_kb() - rss;
+        }
+        timelapse_wait();
+    }
+
+    mock_file_data = NULL;
+    mock_file_bytes = 0;
+    glob_outdir = NULL;
+    glob_frameidx = NULL;
+    glob_dedup = DEDUP_OFF;
+
+    if (n < 0)
+        return -1;
+    if (n < STEADY_FRAMES)
+    {
+        fprintf(stderr, "only %d frames measured after warm-up\n", n);
+        return -1;
+    }
+
+    snprintf(extra, sizeof(extra), ",\"warmup\":%d,\"rss_growth_kb\":%ld", WARMUP_FRAMES, rss);
+    report("steady_allocs", "allocs", v, n, extra);
+
+    return allocs;
+}
+
+//-----------------------------------------------------------------------------
+// the checksum alone, and a download through it to the disk
+static void bench_download(void)
+{
+    static double crc[CRC_LOOPS], dl[FILE_LOOPS], pv[FILE_LOOPS];
+    static unsigned char buf[MOCK_CHUNK];
+    CameraFilePath path;
+    struct Transfer t;
+    GPContext *context;
+    Camera *camera;
+    char extra[128];
+    long long start;
+    uint32_t c = 0;
+    int i;
+
+    for (i = 0; i < MOCK_CHUNK; i++)
+        buf[i] = i;
+
+    for (i = 0; i < CRC_LOOPS; i++)
+    {
+        start = now_ns();
+        c = crc32c(c, buf, sizeof(buf));
+        crc[i] = sizeof(buf) / ((now_ns() - start) / 1e3);
+    }
+
+    snprintf(extra, sizeof(extra), ",\"impl\":\"%s\",\"bytes\":%d", crc32c_impl(), MOCK_CHUNK);
+    report("crc32c", "MB/s", crc, CRC_LOOPS, extra);
+
+    context = gp_context_new();
+    gp_camera_new(&camera);
+    strcpy(path.folder, "/store_00010001/DCIM/100BENCH");
+    strcpy(path.name, "BENCH.RAW");
+    mock_file_bytes = FILE_BYTES;
+
+    for (i = 0; i < FILE_LOOPS; i++)
+    {
+        start = now_ns();
+        if (download_file(camera, context, &path, GP_FILE_TYPE_NORMAL, BENCH_FILE, NULL, &t) < GP_OK)
+            break;
+        dl[i] = t.bytes / ((now_ns() - start) / 1e3);
+    }
+
+    snprintf(extra, sizeof(extra), ",\"bytes\":%lld", FILE_BYTES);
+    report("download", "MB/s", dl, i, extra);
+
+    // the preview-only transfer mode, milliseconds of usb per frame
+    mock_preview_bytes = PREVIEW_BYTES;
+    download_reset();
+    for (i = 0; i < FILE_LOOPS; i++)
+    {
+        start = now_ns();
+        if (download_file(camera, context, &path, GP_FILE_TYPE_PREVIEW, BENCH_FILE, NULL, &t) < GP_OK)
+            break;
+        pv[i] = (now_ns() - start) / 1e3;
+    }
+    download_report();
+
+    mock_file_bytes = mock_preview_bytes = 0;
+    unlink(BENCH_FILE);
+
+    snprintf(extra, sizeof(extra), ",\"bytes\":%lld,\"card_bytes\":%lld", PREVIEW_BYTES, FILE_BYTES);
+    report("download_preview", "us", pv, i, extra);
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    pthread_t thread;
+    int frames, i, ret = 0;
+    long allocs;
+
+    frames = (argc > 1) ? atoi(argv[1]) : 5;
+    if (frames < 2)
+    {
+        fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+        return 2;
+    }
+
+    // nothing written to disk, no state of a real run touched
+    glob_journal = NULL;
+    glob_frameidx = NULL;
+    glob_camcache = NULL;
+    glob_outdir = NULL;
+    glob_offload = NULL;
+    glob_dedup = DEDUP_OFF;
+    glob_ctlsock = BENCH_SOCK;
+    glob_profile = 1;
+
+    unlink(BENCH_SOCK);
+    pthread_create(&thread, NULL, event_thread, NULL);
+    pthread_detach(thread);
+
+    // the socket is the last thing main() sets up before the loop
+    for (i = 0; i < 500 && access(BENCH_SOCK, F_OK) < 0; i++)
+        usleep(10000);
+    if (i == 500)
+    {
+        fprintf(stderr, "event loop didn't come up\n");
+        return 1;
+    }
+
+    bench_idle();
+    bench_lcd();
+    bench_ui();
+    bench_events();
+    bench_scheduler(frames);
+    allocs = bench_steady(frames);
+    if (allocs < 0)
+    {
+        fprintf(stderr, "the steady state wasn't measured\n");
+        ret = 1;
+    }
+    else if (allocs > 0)
+    {
+        fprintf(stderr, "the capture loop allocates after %d frames\n", WARMUP_FRAMES);
+        ret = 1;
+    }
+    bench_download();
+
+    unlink(BENCH_SOCK);
+    return ret;
+}
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <gphoto2/gphoto2-camera.h>
+#include <gphoto2/gphoto2-port-info-list.h>
+
+#include "camcache.h"
+
+#define CACHE_MAGIC   "RLCAM1"
+#define CACHE_VERSION 1
+
+// 'abilities_size' catches a libgphoto2 upgrade changing the struct
+struct CacheFile
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t abilities_size;
+    CameraAbilities abilities;
+    char port_path[128];
+};
+
+//-----------------------------------------------------------------------------
+
+int camcache_port(Camera *camera, const char *port_path)
+{
+    GPPortInfoList *list;
+    GPPortInfo info;
+    int ret, index;
+
+    ret = gp_port_info_list_new(&list);
+    if (ret < GP_OK) return ret;
+
+    ret = gp_port_info_list_load(list);
+    if (ret < GP_OK) goto out;
+
+    // a replugged camera gets a new usb address, the generic usb port
+    // then finds it by vendor and product id
+    index = gp_port_info_list_lookup_path(list, port_path);
+    if (index < GP_OK && strncmp(port_path, "usb:", 4) == 0)
+        index = gp_port_info_list_lookup_path(list, "usb:");
+    if (index < GP_OK) 
+    {
+        ret = index;
+        goto out;
+    }
+
+    ret = gp_port_info_list_get_info(list, index, &info);
+    if (ret < GP_OK) goto out;
+
+    ret = gp_camera_set_port_info(camera, info);
+out:
+    gp_port_info_list_free(list);
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+
+int camcache_apply(Camera *camera, const char *path)
+{
+    struct CacheFile cache;
+    FILE *f;
+    int ret;
+
+    f = fopen(path, "rb");
+    if (f == NULL) return GP_ERROR;
+
+    ret = fread(&cache, sizeof(cache), 1, f);
+    fclose(f);
+
+    if (ret != 1 || memcmp(cache.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || 
+        cache.version != CACHE_VERSION || cache.abilities_size != sizeof(CameraAbilities)) 
+    {
+        fprintf(stderr, "ignoring stale camera cache %s\n", path);
+        return GP_ERROR;
+    }
+    cache.port_path[sizeof(cache.port_path) - 1] = '\0';
+
+    ret = gp_camera_set_abilities(camera, cache.abilities);
+    if (ret < GP_OK) return ret;
+
+    ret = camcache_port(camera, cache.port_path);
+    if (ret < GP_OK) return ret;
+
+    printf("Camera from cache: %s on %s\n", cache.abilities.model, cache.port_path);
+    return GP_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+int camcache_save(Camera *camera, const char *path)
+{
+    struct CacheFile cache;
+    char tmp[PATH_MAX];
+    GPPortInfo info;
+    char *port_path;
+    FILE *f;
+    int ret;
+
+    memset(&cache, 0, sizeof(cache));
+    memcpy(cache.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    cache.version = CACHE_VERSION;
+    cache.abilities_size = sizeof(CameraAbilities);
+
+    ret = gp_camera_get_abilities(camera, &cache.abilities);
+    if (ret < GP_OK) return ret;
+
+    ret = gp_camera_get_port_info(camera, &info);
+    if (ret < GP_OK) return ret;
+
+    ret = gp_port_info_get_path(info, &port_path);
+    if (ret < GP_OK) return ret;
+    snprintf(cache.port_path, sizeof(cache.port_path), "%s", port_path);
+
+    // write and rename, a crash never leaves half a cache
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    f = fopen(tmp, "wb");
+    if (f == NULL) 
+    {
+        perror(tmp);
+        return GP_ERROR;
+    }
+
+    if (fwrite(&cache, sizeof(cache), 1, f) != 1) 
+    {
+        fclose(f);
+        remove(tmp);
+        return GP_ERROR;
+    }
+
+    if (fclose(f) != 0 || rename(tmp, path) < 0) 
+    {
+        perror(path);
+        return GP_ERROR;
+    }
+
+    return GP_OK;
+}
@@ -0,0 +1,16 @@
+#ifndef __CAMCACHE_H__
+#define __CAMCACHE_H__
+
+#include <gphoto2/gphoto2-camera.h>
+
+// sets the model and port saved by camcache_save() on a new camera, so
+// gp_camera_init() skips loading every camlib and probing the ports
+int camcache_apply(Camera *camera, const char *path);
+
+// points a new camera at 'port_path' ("usb:001,005", ...)
+int camcache_port(Camera *camera, const char *port_path);
+
+// remembers the model and port of an initialized camera
+int camcache_save(Camera *camera, const char *path);
+
+#endif
@@ -4,21 +4,111 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <gphoto2/gphoto2-camera.h>
 
+#include "camcache.h"
 #include "camera.h"
+#include "composite.h"
+#include "ctl.h"
+#include "download.h"
+#include "frameidx.h"
+#include "hdr.h"
+#include "image.h"
+#include "journal.h"
 #include "lcd.h"
+#include "motion.h"
+#include "offload.h"
+#include "phash.h"
+#include "prof.h"
+#include "rig.h"
+#include "status.h"
+#include "storage.h"
+#include "sync.h"
+#include "thumb.h"
+#include "tlog.h"
+#include "watchdog.h"
 
 // timelapse settings 
 extern long glob_frames;
 extern long glob_interval;
 extern long glob_delay;
+extern long glob_mode;
+extern long glob_dedup;
+extern long glob_transfer;
+extern long glob_bracket;
+extern const char *glob_outdir;
+extern const char *glob_journal;
+extern const char *glob_frameidx;
+extern const char *glob_camcache;
+extern const char *glob_offload;
+extern long glob_offload_rate;
+extern long glob_storage;
+extern long glob_cameras;
+extern long glob_sync;
+extern const char *glob_sync_group;
+extern const char *glob_sync_if;
+
+// exposures in a bracket are this many stops apart
+#define BRACKET_STEP 2.0
+#define BRACKET_MAX  9
+
+// stops covered when the body doesn't tell its range
+#define BRACKET_SPAN 6.0
+
+// what a failed camera call needs
+#define ERR_RETRY    0  // wait and try again
+#define ERR_REOPEN   1  // close and reopen the camera
+#define ERR_FATAL    2  // give up
+
+// transient errors in a row before reopening, longest wait between
+// reopen attempts in seconds
+#define RETRY_LIMIT        3
+#define RECOVER_MAX_DELAY 30
+
+// seconds a camera call may take before the watchdog cancels it, the
+// capture deadline leaves room for long exposures
+#define TIMEOUT_CAPTURE  60
+#define TIMEOUT_PREVIEW  10
+#define TIMEOUT_CONFIG   15
+#define TIMEOUT_INIT     30
+#define TIMEOUT_EXIT     10
+
+// seconds timelapse_stop() waits for the worker before leaving it behind
+#define STOP_TIMEOUT 5
+
+// seconds a sync follower waits for the leader's schedule
+#define SYNC_WAIT 30
 
 // gphoto2 context
 static GPContext *main_context;
 
+// schedule of the current run: slot of the first frame and number of
+// the next one, both restored from the journal after a crash
+static time_t start_time;
+static long first_frame = 1;
+
+// failed captures, successful recoveries and slots that went by meanwhile
+static long nr_errors, nr_recoveries, nr_lost;
+static int nr_retries;
+
+// capture and download time of the last frame
+static long latency_us;
+
+// reads the exif block of the frames as they come in, the capture thread
+// is the only user
+static struct ExifParser parser;
+
+// what the camera turned down in preview mode, asked once per run
+static int no_preview, no_exif;
+
 // variables to control camera thread 
 static volatile int thread_done = 1;
+static int thread_alive = 0;
 static pthread_mutex_t mutex;
 static pthread_cond_t condm; // master
 static pthread_cond_t condw; // worker
@@ -47,12 +137,12 @@ get_config_value_string(Camera *camera, const char *key, char **str, GPContext *
 
 	ret = gp_camera_get_config (camera, &widget, context);
 	if (ret < GP_OK) {
-		fprintf (stderr, "camera_get_config failed: %d\n", ret);
+		tlog_error ("camera_get_config failed: %d\n", ret);
 		return ret;
 	}
 	ret = _lookup_widget (widget, key, &child);
 	if (ret < GP_OK) {
-		fprintf (stderr, "lookup widget failed: %d\n", ret);
+		tlog_error ("lookup widget failed: %d\n", ret);
 		goto out;
 	}
 
@@ -60,7 +150,7 @@ get_config_value_string(Camera *camera, const char *key, char **str, GPContext *
 	 * has already. If you are not sure, better check. */
 	ret = gp_widget_get_type (child, &type);
 	if (ret < GP_OK) {
-		fprintf (stderr, "widget get type failed: %d\n", ret);
+		tlog_error ("widget get type failed: %d\n", ret);
 		goto out;
 	}
 	switch (type) {
@@ -69,7 +159,7 @@ get_config_value_string(Camera *camera, const char *key, char **str, GPContext *
         case GP_WIDGET_TEXT:
 		break;
 	default:
-		fprintf (stderr, "widget has bad type %d\n", type);
+		tlog_error ("widget has bad type %d\n", type);
 		ret = GP_ERROR_BAD_PARAMETERS;
 		goto out;
 	}
@@ -78,7 +168,7 @@ get_config_value_string(Camera *camera, const char *key, char **str, GPContext *
 	 * a pointer reference to the string, not a copy... */
 	ret = gp_widget_get_value (child, &val);
 	if (ret < GP_OK) {
-		fprintf (stderr, "could not query widget value: %d\n", ret);
+		tlog_error ("could not query widget value: %d\n", ret);
 		goto out;
 	}
 	/* Create a new copy for our caller. */
@@ -99,12 +189,12 @@ set_config_value_string(Camera *camera, const char *key, const char *val, GPCont
 
 	ret = gp_camera_get_config (camera, &widget, context);
 	if (ret < GP_OK) {
-		fprintf (stderr, "camera_get_config failed: %d\n", ret);
+		tlog_error ("camera_get_config failed: %d\n", ret);
 		return ret;
 	}
 	ret = _lookup_widget (widget, key, &child);
 	if (ret < GP_OK) {
-		fprintf (stderr, "lookup widget failed: %d\n", ret);
+		tlog_error ("lookup widget failed: %d\n", ret);
 		goto out;
 	}
 
@@ -112,7 +202,7 @@ set_config_value_string(Camera *camera, const char *key, const char *val, GPCont
 	 * has already. If you are not sure, better check. */
 	ret = gp_widget_get_type (child, &type);
 	if (ret < GP_OK) {
-		fprintf (stderr, "widget get type failed: %d\n", ret);
+		tlog_error ("widget get type failed: %d\n", ret);
 		goto out;
 	}
 	switch (type) {
@@ -124,7 +214,7 @@ set_config_value_string(Camera *camera, const char *key, const char *val, GPCont
 		 */
 		ret = gp_widget_set_value (child, val);
 		if (ret < GP_OK) {
-			fprintf (stderr, "could not set widget value: %d\n", ret);
+			tlog_error ("could not set widget value: %d\n", ret);
 			goto out;
 		}
 		break;
@@ -134,13 +224,13 @@ set_config_value_string(Camera *camera, const char *key, const char *val, GPCont
 		sscanf(val,"%d",&ival);
 		ret = gp_widget_set_value (child, &ival);
 		if (ret < GP_OK) {
-			fprintf (stderr, "could not set widget value: %d\n", ret);
+			tlog_error ("could not set widget value: %d\n", ret);
 			goto out;
 		}
 		break;
 	}
 	default:
-		fprintf (stderr, "widget has bad type %d\n", type);
+		tlog_error ("widget has bad type %d\n", type);
 		ret = GP_ERROR_BAD_PARAMETERS;
 		goto out;
 	}
@@ -148,7 +238,7 @@ set_config_value_string(Camera *camera, const char *key, const char *val, GPCont
 	/* This stores it on the camera again */
 	ret = gp_camera_set_config (camera, widget, context);
 	if (ret < GP_OK) {
-		fprintf (stderr, "camera_set_config failed: %d\n", ret);
+		tlog_error ("camera_set_config failed: %d\n", ret);
 		return ret;
 	}
 out:
@@ -161,22 +251,405 @@ out:
 
 static void ctx_error_fn(GPContext *context, const char *str, void *data)
 {
-    fprintf(stderr, "\n*** Context error ***\n%s\n",str);
-    fflush(stderr);
+    tlog_error("*** Context error ***\n%s\n", str);
 }
 
 //-----------------------------------------------------------------------------
 
 static void ctx_status_fn(GPContext *context, const char *str, void *data)
 {
-    fprintf(stderr, "%s\n", str);
-    fflush(stderr);
+    tlog_error("%s\n", str);
+}
+
+//-----------------------------------------------------------------------------
+// the time base of the schedule, the leader's clock on a sync follower
+static void clock_now(struct timeval *tv)
+{
+    struct timespec ts;
+
+    sync_clock(&ts);
+    tv->tv_sec = ts.tv_sec;
+    tv->tv_usec = ts.tv_nsec / 1000;
+}
+
+//-----------------------------------------------------------------------------
+// an exposure compensation label as a number, the labels differ between
+// bodies ("+1", "1.0", "1,3", ...); -1 if it isn't one
+static int parse_ev(const char *label, double *ev)
+{
+    char *end, num[32];
+
+    snprintf(num, sizeof(num), "%s", label);
+    if (strchr(num, ',') != NULL) 
+        *strchr(num, ',') = '.';
+
+    *ev = strtod(num, &end);
+    return (end == num) ? -1 : 0;
+}
+
+//-----------------------------------------------------------------------------
+// the current exposure compensation, its label to restore it with and
+// the range the body offers; the caller frees 'label'
+static int get_exposure(Camera *camera, char **label, double *ev, double *lo, double *hi)
+{
+    CameraWidget *widget = NULL, *child = NULL;
+    const char *choice, *val = NULL;
+    double v;
+    int i, n, ret;
+
+    *label = NULL;
+    ret = gp_camera_get_config(camera, &widget, main_context);
+    if (ret < GP_OK) 
+        return ret;
+
+    ret = _lookup_widget(widget, "exposurecompensation", &child);
+    if (ret >= GP_OK)
+        ret = gp_widget_get_value(child, &val);
+    if (ret < GP_OK || val == NULL || parse_ev(val, ev) < 0) 
+    {
+        ret = (ret < GP_OK) ? ret : GP_ERROR_NOT_SUPPORTED;
+        goto out;
+    }
+
+    *lo = *hi = *ev;
+    n = gp_widget_count_choices(child);
+    for (i = 0; i < n; i++) 
+    {
+        if (gp_widget_get_choice(child, i, &choice) < GP_OK || parse_ev(choice, &v) < 0) 
+            continue;
+        if (v < *lo) *lo = v;
+        if (v > *hi) *hi = v;
+    }
+
+    *label = strdup(val);
+    if (*label == NULL)
+        ret = GP_ERROR_NO_MEMORY;
+out:
+    gp_widget_free(widget);
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+// picks the exposure compensation choice closest to 'ev'
+static int set_exposure_compensation(Camera *camera, double ev)
+{
+    CameraWidget *widget = NULL, *child = NULL;
+    const char *choice, *best = NULL;
+    double diff, best_diff = 1e9;
+    int i, n, ret;
+
+    ret = gp_camera_get_config(camera, &widget, main_context);
+    if (ret < GP_OK) 
+    {
+        tlog_error("camera_get_config failed: %d\n", ret);
+        return ret;
+    }
+
+    ret = _lookup_widget(widget, "exposurecompensation", &child);
+    if (ret < GP_OK) 
+    {
+        tlog_error("exposure compensation not supported: %d\n", ret);
+        goto out;
+    }
+
+    n = gp_widget_count_choices(child);
+    for (i = 0; i < n; i++) 
+    {
+        if (gp_widget_get_choice(child, i, &choice) < GP_OK) 
+            continue;
+
+        if (parse_ev(choice, &diff) < 0) 
+            continue;
+
+        diff -= ev;
+        if (diff < 0) diff = -diff;
+        if (diff < best_diff) 
+        {
+            best_diff = diff;
+            best = choice;
+        }
+    }
+
+    if (best == NULL) 
+    {
+        ret = GP_ERROR_NOT_SUPPORTED;
+        goto out;
+    }
+
+    ret = gp_widget_set_value(child, best);
+    if (ret == GP_OK)
+        ret = gp_camera_set_config(camera, widget, main_context);
+out:
+    gp_widget_free(widget);
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+// fetches the embedded preview of 'path', and its exif block when the
+// preview doesn't carry one; GP_ERROR_NOT_SUPPORTED if there's no preview
+static int fetch_preview(Camera *camera, const CameraFilePath *path, char *local, size_t len, 
+                            struct Transfer *t)
+{
+    struct Transfer e;
+    int ret;
+
+    if (no_preview)
+        return GP_ERROR_NOT_SUPPORTED;
+
+    if (download_path(local, len, glob_outdir, "", path, GP_FILE_TYPE_PREVIEW) < 0)
+        return GP_ERROR_BAD_PARAMETERS;
+
+    ret = download_file(camera, main_context, path, GP_FILE_TYPE_PREVIEW, local, &parser, t);
+    if (ret == GP_ERROR_NOT_SUPPORTED) 
+    {
+        tlog_error("No previews from this camera, downloading full files\n");
+        no_preview = 1;
+    }
+    if (ret != GP_OK || t->has_exif || no_exif)
+        return ret;
+
+    // a few kb more keep the frame index complete
+    if (download_file(camera, main_context, path, GP_FILE_TYPE_EXIF, NULL, &parser, &e) == GP_ERROR_NOT_SUPPORTED)
+        no_exif = 1;
+    else if (e.has_exif) 
+    {
+        t->has_exif = 1;
+        t->exif = e.exif;
+    }
+
+    return GP_OK;
+}
+
+//-----------------------------------------------------------------------------
+// shoots a frame due at 'due' and downloads it into 'glob_outdir', whole
+// or only its preview, 'full' is 0 for a preview; 'local' is empty if
+// nothing came down; 'crc' is the checksum of the download, for the
+// copies made of it later
+static int shoot(Camera *camera, long frame, const struct timeval *due, 
+                 CameraFilePath *path, char *local, size_t len, uint32_t *crc, int *full)
+{
+    struct Transfer t;
+    struct timeval taken;
+    int ret;
+
+    local[0] = '\0';
+    *crc = 0;
+    *full = 1;
+
+    tlog_info("Capturing\n");
+    clock_now(&taken);
+    watchdog_arm("gp_camera_capture", TIMEOUT_CAPTURE);
+    ret = gp_camera_capture(camera, GP_CAPTURE_IMAGE, path, main_context);
+    watchdog_disarm(ret);
+    if (ret != GP_OK) {
+        tlog_info("gp_camera_capture() failed: %d\n", ret);
+        return ret;
+    }
+
+    tlog_info("Pathname on the camera: %s/%s\n", path->folder, path->name);
+
+    t.card_bytes = -1;
+    if (glob_outdir != NULL && glob_transfer == TRANSFER_PREVIEW) 
+    {
+        ret = fetch_preview(camera, path, local, len, &t);
+        *full = (ret == GP_ERROR_NOT_SUPPORTED);
+        if (ret != GP_OK)
+            local[0] = '\0';
+    }
+
+    if (glob_outdir != NULL && *full) 
+    {
+        if (download_path(local, len, glob_outdir, "", path, GP_FILE_TYPE_NORMAL) < 0 ||
+            download_file(camera, main_context, path, GP_FILE_TYPE_NORMAL, local, &parser, &t) != GP_OK) 
+            local[0] = '\0';
+    }
+
+    storage_frame(path, local, t.card_bytes, *full);
+
+    if (local[0] != '\0') 
+    {
+        *crc = t.crc;
+        frameidx_add(frame, due, &taken, path->folder, path->name, local, 
+                     t.bytes, t.crc, t.has_exif ? &t.exif : NULL);
+    }
+    else 
+    {
+        frameidx_add(frame, due, &taken, path->folder, path->name, "", 0, 0, NULL);
+    }
+
+    return GP_OK;
+}
+
+//-----------------------------------------------------------------------------
+// hands a downloaded frame to the post-processing stages, 'path' is the
+// file on the card or NULL if there's none, 'full' 0 if 'local' is only
+// its preview, 'crc' NULL if it was made here
+static void process_frame(Camera *camera, long frame, CameraFilePath *path, int full, 
+                          const char *local, const uint32_t *crc)
+{
+    int dup, drop;
+
+    // raw files only go to the nas
+    if (!image_is_jpeg(local)) 
+    {
+        offload_submit(frame, local, crc);
+        return;
+    }
+
+    // a preview that matches says too little to delete the original,
+    // the frame is only flagged
+    dup = (glob_dedup != DEDUP_OFF && phash_frame(frame, local, NULL) == 1);
+    drop = (dup && glob_dedup == DEDUP_DROP && full);
+    if (dup)
+        frameidx_flag(frame, drop ? FRAME_DUPLICATE | FRAME_DROPPED : FRAME_DUPLICATE);
+
+    // a static scene: keep the frame or drop both copies
+    if (drop) 
+    {
+        tlog_info("Dropping duplicate %s\n", local);
+        unlink(local);
+        if (path != NULL) 
+        {
+            watchdog_arm("gp_camera_file_delete", TIMEOUT_CONFIG);
+            watchdog_disarm(gp_camera_file_delete(camera, path->folder, path->name, main_context));
+        }
+        return;
+    }
+
+    thumb_submit(frame, local);
+    composite_submit(frame, local);
+    offload_submit(frame, local, crc);
+}
+
+//-----------------------------------------------------------------------------
+
+static int capture_frame(Camera *camera, long frame, const struct timeval *due)
+{
+    CameraFilePath path;
+    char local[PATH_MAX];
+    uint32_t crc;
+    int ret, full;
+
+    ret = shoot(camera, frame, due, &path, local, sizeof(local), &crc, &full);
+    if (ret != GP_OK) 
+        return ret;
+
+    if (local[0] != '\0')
+        process_frame(camera, frame, &path, full, local, &crc);
+
+    return GP_OK;
+}
+
+//-----------------------------------------------------------------------------
+// shoots 'glob_bracket' exposures around the current compensation and
+// fuses them into a single frame; the bracket is narrowed and moved to
+// stay inside what the body offers, so no two exposures come out the same
+static int capture_bracket(Camera *camera, long frame, const struct timeval *due)
+{
+    CameraFilePath path;
+    char locals[BRACKET_MAX][PATH_MAX], fused[PATH_MAX];
+    const char *files[BRACKET_MAX];
+    uint32_t crc;
+    char *orig = NULL;
+    int i, n = 0, count, full, ret = GP_OK;
+    double ev, center = 0, lo, hi, span;
+
+    count = (glob_bracket > BRACKET_MAX) ? BRACKET_MAX : glob_bracket;
+
+    watchdog_arm("get exposurecompensation", TIMEOUT_CONFIG);
+    ret = get_exposure(camera, &orig, &center, &lo, &hi);
+    watchdog_disarm(ret);
+    if (ret < GP_OK) 
+    {
+        // nothing known, a range every body has
+        center = 0;
+        lo = -BRACKET_SPAN / 2;
+        hi = BRACKET_SPAN / 2;
+    }
+
+    span = (count - 1) * BRACKET_STEP;
+    if (span > hi - lo)
+        span = hi - lo;
+    if (center - span / 2 < lo)
+        center = lo + span / 2;
+    if (center + span / 2 > hi)
+        center = hi - span / 2;
+
+    for (i = 0; i < count; i++) 
+    {
+        ev = center + (i - (count - 1) / 2.0) * span / (count - 1);
+        watchdog_arm("set exposurecompensation", TIMEOUT_CONFIG);
+        ret = set_exposure_compensation(camera, ev);
+        watchdog_disarm(ret);
+        if (ret < GP_OK)
+            tlog_error("cannot set exposure compensation %+.1f\n", ev);
+
+        ret = shoot(camera, frame, due, &path, locals[n], PATH_MAX, &crc, &full);
+        if (ret != GP_OK) 
+            break;
+
+        // the exposures are kept next to the fused frame
+        if (locals[n][0] != '\0')
+            offload_submit(frame, locals[n], &crc);
+
+        if (image_is_jpeg(locals[n])) 
+        {
+            files[n] = locals[n];
+            n++;
+        }
+    }
+
+    if (orig != NULL) 
+    {
+        watchdog_arm("set exposurecompensation", TIMEOUT_CONFIG);
+        watchdog_disarm(set_config_value_string(camera, "exposurecompensation", orig, main_context));
+        free(orig);
+    }
+
+    if (n > 1) 
+    {
+        snprintf(fused, sizeof(fused), "%s/hdr_%05ld.jpg", glob_outdir, frame);
+        if (hdr_fuse(files, n, fused) == 0)
+            process_frame(camera, frame, NULL, 1, fused, NULL);
+    }
+
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+// grabs a live view frame and feeds it to the change detector
+static int watch_scene(Camera *camera, CameraFile *preview)
+{
+    struct timeval grabbed;
+    const char *data;
+    unsigned long size;
+    int ret;
+
+    gettimeofday(&grabbed, NULL);
+
+    watchdog_arm("gp_camera_capture_preview", TIMEOUT_PREVIEW);
+    ret = gp_camera_capture_preview(camera, preview, main_context);
+    watchdog_disarm(ret);
+    if (ret < GP_OK) 
+    {
+        tlog_error("gp_camera_capture_preview() failed: %d\n", ret);
+        return ret;
+    }
+
+    ret = gp_file_get_data_and_size(preview, &data, &size);
+    if (ret < GP_OK) 
+        return ret;
+
+    return motion_feed((const uint8_t *) data, size, &grabbed);
 }
 
 //-----------------------------------------------------------------------------
 
 void timelapse_init() 
 {
+    // before anything that logs
+    tlog_init();
+
     // gphoto2
 	main_context = gp_context_new();
     gp_context_set_error_func(main_context, ctx_error_fn, NULL);
@@ -186,48 +659,292 @@ void timelapse_init()
     pthread_mutex_init(&mutex, NULL);
     pthread_cond_init(&condw, NULL);
     pthread_cond_init(&condm, NULL);
+
+    watchdog_init(main_context);
+    thumb_init();
+    composite_init();
+    offload_init();
+    rig_init();
+
+    if (glob_journal != NULL)
+        journal_open(glob_journal);
+
+    if (glob_sync != SYNC_OFF)
+        sync_init(glob_sync, glob_sync_group, glob_sync_if);
+}
+
+
+//-----------------------------------------------------------------------------
+
+static double since(const struct timespec *t) 
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - t->tv_sec) + (now.tv_nsec - t->tv_nsec) / 1e9;
+}
+
+//-----------------------------------------------------------------------------
+
+static void close_camera(Camera *camera)
+{
+    watchdog_arm("gp_camera_exit", TIMEOUT_EXIT);
+    watchdog_disarm(gp_camera_exit(camera, main_context));
+    gp_camera_unref(camera);
 }
 
+//-----------------------------------------------------------------------------
+// opens the camera with the cached model and port, or autodetects it
+// and caches the result for the next start
+static int open_camera(Camera **out)
+{
+    Camera *camera;
+    struct timespec start, boot;
+    int ret, cached = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    gp_camera_new(&camera);
+
+    if (glob_camcache != NULL && camcache_apply(camera, glob_camcache) == GP_OK) 
+    {
+        watchdog_arm("gp_camera_init", TIMEOUT_INIT);
+        ret = gp_camera_init(camera, main_context);
+        watchdog_disarm(ret);
+        if (ret >= GP_OK) 
+        {
+            cached = 1;
+        }
+        else 
+        {
+            tlog_error("cached camera failed: %d, autodetecting\n", ret);
+            gp_camera_unref(camera);
+            gp_camera_new(&camera);
+        }
+    }
+
+    if (!cached) 
+    {
+        tlog_info("Camera init. Takes about 10 seconds.\n");
+        watchdog_arm("gp_camera_init", TIMEOUT_INIT);
+        ret = gp_camera_init(camera, main_context);
+        watchdog_disarm(ret);
+        if (ret < GP_OK) 
+        {
+            tlog_error("gp_camera_init() failed: %d\n", ret);
+            gp_camera_unref(camera);
+            return ret;
+        }
+
+        if (glob_camcache != NULL)
+            camcache_save(camera, glob_camcache);
+    }
+
+    char target[] = "Memory card";
+    watchdog_arm("set capturetarget", TIMEOUT_CONFIG);
+    ret = set_config_value_string(camera, "capturetarget", target, main_context);
+    watchdog_disarm(ret);
+    if (ret < GP_OK)
+    {
+        tlog_error("gp_camera_init() failed: %d\n", ret);
+        close_camera(camera);
+        return ret;
+    }
+
+    clock_gettime(CLOCK_BOOTTIME, &boot);
+    tlog_info("Camera ready in %.2f s (%s), %.1f s after boot\n", 
+           since(&start), cached ? "cached" : "autodetected", 
+           boot.tv_sec + boot.tv_nsec / 1e9);
+
+    *out = camera;
+    return GP_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+static int classify_error(int error)
+{
+    switch (error) 
+    {
+    // the camera is there but didn't take it this time
+    case GP_ERROR:
+    case GP_ERROR_TIMEOUT:
+    case GP_ERROR_CAMERA_BUSY:
+        return ERR_RETRY;
+
+    // the usb link is gone or out of sync
+    case GP_ERROR_IO:
+    case GP_ERROR_IO_INIT:
+    case GP_ERROR_IO_READ:
+    case GP_ERROR_IO_WRITE:
+    case GP_ERROR_IO_UPDATE:
+    case GP_ERROR_IO_USB_CLEAR_HALT:
+    case GP_ERROR_IO_USB_FIND:
+    case GP_ERROR_IO_USB_CLAIM:
+    case GP_ERROR_IO_LOCK:
+    case GP_ERROR_UNKNOWN_PORT:
+    case GP_ERROR_CORRUPTED_DATA:
+    case GP_ERROR_CAMERA_ERROR:
+    case GP_ERROR_MODEL_NOT_FOUND:
+    // only the watchdog cancels, the call hung
+    case GP_ERROR_CANCEL:
+        return ERR_REOPEN;
+
+    // a full card or an unsupported call won't fix itself
+    default:
+        return ERR_FATAL;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// brings the camera back after a failed call, called with 'mutex' held;
+// returns -1 when the error is fatal or the run was stopped meanwhile
+static int recover(Camera **camera, int error)
+{
+    struct timeval now;
+    struct timespec ts;
+    int kind, delay = 1, ret;
+
+    kind = classify_error(error);
+    if (kind == ERR_RETRY && ++nr_retries > RETRY_LIMIT)
+        kind = ERR_REOPEN;
+
+    // a call of this frame the watchdog had to kick may come back with
+    // any error, the session is wedged whatever it says
+    if (watchdog_expired())
+        kind = ERR_REOPEN;
+
+    if (kind == ERR_FATAL) 
+    {
+        tlog_error("camera error %d is fatal, stopping\n", error);
+        return -1;
+    }
+    
+    nr_errors++;
+
+    while (!thread_done) 
+    {
+        // back off without keeping timelapse_stop() waiting
+        gettimeofday(&now, NULL);
+        ts.tv_sec = now.tv_sec + delay;
+        ts.tv_nsec = now.tv_usec * 1000;
+        pthread_cond_timedwait(&condw, &mutex, &ts);
+        prof_wakeup();
+        if (thread_done) break;
+
+        if (kind == ERR_RETRY) 
+        {
+            tlog_info("Retrying after error %d\n", error);
+            return 0;
+        }
+
+        tlog_info("Reopening camera after error %d\n", error);
+
+        // closing and opening take seconds, don't hold the lock meanwhile
+        pthread_mutex_unlock(&mutex);
+        if (*camera != NULL) 
+        {
+            close_camera(*camera);
+            *camera = NULL;
+        }
+        ret = open_camera(camera);
+        pthread_mutex_lock(&mutex);
+
+        if (ret == GP_OK) 
+        {
+            nr_retries = 0;
+            nr_recoveries++;
+            return 0;
+        }
+
+        *camera = NULL;
+        delay = (delay * 2 > RECOVER_MAX_DELAY) ? RECOVER_MAX_DELAY : delay * 2;
+    }
+
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// progress of the run for external monitors
+static void publish(int capturing, long frames, time_t next)
+{
+    struct Status *s;
+    long long backlog, copied, card, disk;
+    long fit;
+    int queued;
+
+    // outside the write, it takes a lock
+    queued = offload_pending(&backlog, &copied);
+    fit = storage_budget(&card, &disk);
+
+    s = status_begin();
+    s->capturing = capturing;
+    s->mode = glob_mode;
+    s->interval = glob_interval;
+    s->started = start_time;
+    s->next = next;
+    s->frames = frames;
+    s->total = glob_frames;
+    s->latency_us = latency_us;
+    s->thumb_queue = thumb_pending();
+    s->composite_queue = composite_pending();
+    s->errors = nr_errors;
+    s->recoveries = nr_recoveries;
+    s->lost = nr_lost;
+    s->offload_queue = queued;
+    s->offload_backlog = backlog;
+    s->offload_bytes = copied;
+    s->card_free = card;
+    s->disk_free = disk;
+    s->frames_fit = fit;
+    status_end();
+}
 
 //-----------------------------------------------------------------------------
 
 static void *timelapse_thread(void *arg) 
 {
     Camera *camera = (Camera *) arg;
-    CameraFilePath path;
-    int ret, sec;
+    CameraFile *preview = NULL;
+    int ret, sec, triggered, watched;
 
-    long nrcaptures = 1;
-    struct timeval next, now;
+    long nrcaptures = first_frame;
+    struct timeval next, now, taken, due;
     struct timespec ts; 
-    static char buf[32]; 
+    time_t slot;
+    static char buf[32], title[32]; 
+
+    prof_thread("capture");
+
+    nr_errors = nr_recoveries = nr_lost = 0;
+    nr_retries = 0;
+    latency_us = 0;
 
-    if (glob_delay != 0) 
+    publish(1, nrcaptures - 1, start_time);
+
+    clock_now(&now);
+    if (now.tv_sec < start_time) 
     {
-        gettimeofday(&next, NULL);
-        now = next;
-        next.tv_sec += glob_delay;
+        next = now;
+        next.tv_sec = start_time;
 
         // lock 'thread_done' 
         pthread_mutex_lock(&mutex); 
 
-        lcd_clear();
-        lcd_puts("Waiting");
-        lcd_set_cursor(1, 0);
-       
         while (!thread_done && now.tv_sec < next.tv_sec) 
         {
             // print remaining time to lcd 
             sec = next.tv_sec - now.tv_sec;            
             sprintf(buf, "%02d:%02d'%02d''", sec/3600, (sec/60)%60, sec%60);
-            lcd_puts(buf);
+            lcd_screen("Waiting", buf);
 
             // wait 100 millis
             ts.tv_sec = now.tv_sec;
             ts.tv_nsec = (now.tv_usec + 100000) * 1000;
+            sync_local(&ts);
             pthread_cond_timedwait(&condw, &mutex, &ts);
+            prof_wakeup();
 
-            gettimeofday(&now, NULL);
+            clock_now(&now);
         }
 
         // notify master
@@ -240,53 +957,211 @@ static void *timelapse_thread(void *arg)
     // lock 'thread_done'
     pthread_mutex_lock(&mutex);
 
-    // clear lcd and print a title
-    lcd_clear();
+    // the title stays, each countdown redraws the whole screen
     if (glob_frames != 0)
-        sprintf(buf, "Capturing  %5ld", glob_frames);
+        sprintf(title, "%-9s  %5ld", (glob_mode == MODE_MOTION) ? "Motion" : "Capturing", glob_frames);
     else 
-        sprintf(buf, "Capturing");
-    lcd_puts(buf);
-    lcd_set_cursor(1, 0); 
+        sprintf(title, (glob_mode == MODE_MOTION) ? "Motion" : "Capturing");
     
-    // start time 
-    gettimeofday(&next, NULL);
+    phash_reset();
+    storage_reset(glob_outdir, glob_storage);
+    download_reset();
+    no_preview = no_exif = 0;
+
+    // in motion mode the interval is the longest wait between frames
+    if (glob_mode == MODE_MOTION) 
+    {
+        motion_reset();
+        if (gp_file_new(&preview) < GP_OK)
+            preview = NULL;
+    }
+
+    // start time, an interrupted run keeps its slots
+    clock_now(&next);
     now = next; 
+    if (glob_mode != MODE_MOTION && nrcaptures > 1) 
+    {
+        next.tv_sec = start_time + (nrcaptures - 1) * glob_interval;
+        if (next.tv_sec < now.tv_sec)
+            next.tv_sec += (now.tv_sec - next.tv_sec) / glob_interval * glob_interval;
+    }
+
+    // the other cameras of a rig and the other controllers keep to the
+    // same slots by themselves
+    if (glob_mode != MODE_MOTION) 
+    {
+        rig_schedule(start_time, glob_interval, glob_frames);
+        sync_announce(start_time, glob_interval, glob_frames);
+    }
 
     while (!thread_done && (glob_frames == 0 || nrcaptures <= glob_frames)) 
     {
         sec = next.tv_sec - now.tv_sec;
         if (sec < 0) sec = 0; 
         sprintf(buf, "%02d:%02d'%02d'' %5ld", sec/3600, (sec/60)%60, sec%60, nrcaptures-1);
-        lcd_puts(buf);
+        lcd_screen(title, buf);
+        publish(1, nrcaptures - 1, next.tv_sec);
+
+        // motion triggers come unannounced, only captures hold off the copies
+        offload_deadline((glob_mode == MODE_MOTION) ? 0 : next.tv_sec);
         
-        if (now.tv_sec >= next.tv_sec) {
-            next.tv_sec += glob_interval; 
-
-            printf("Capturing\n");
-            ret = gp_camera_capture(camera, GP_CAPTURE_IMAGE, &path, main_context);
-            if (ret != GP_OK) {
-                printf("gp_camera_capture() failed: %d\n", ret);
-                break;
+        // watch the live view without holding the lock, so stopping
+        // doesn't wait for the camera
+        triggered = watched = 0;
+        if (preview != NULL && now.tv_sec < next.tv_sec) 
+        {
+            pthread_mutex_unlock(&mutex);
+            ret = watch_scene(camera, preview);
+            pthread_mutex_lock(&mutex);
+
+            triggered = (ret > 0);
+            watched = (ret >= 0);
+
+            clock_now(&now);
+            if (thread_done) break;
+        }
+
+        if (triggered || now.tv_sec >= next.tv_sec) {
+            slot = triggered ? now.tv_sec : next.tv_sec;
+            if (glob_mode == MODE_MOTION)
+                next.tv_sec = now.tv_sec + glob_interval;
+            else
+                next.tv_sec += glob_interval; 
+
+            if (triggered) 
+                motion_captured();
+
+            // camera calls can hang, the watchdog cuts them short but
+            // stopping mustn't wait for it
+            clock_now(&taken);
+            due = taken;
+            if (glob_mode == MODE_MOTION) 
+            {
+                rig_trigger(nrcaptures - 1, &taken);
             }
-        
-            printf("Pathname on the camera: %s/%s\n", path.folder, path.name);
+            else 
+            {
+                due.tv_sec = slot;
+                due.tv_usec = 0;
+            }
+            rig_taken(nrcaptures - 1, &due, &taken);
+            if (glob_mode != MODE_MOTION)
+                sync_fired(nrcaptures - 1, &taken);
+            pthread_mutex_unlock(&mutex);
+            offload_hold(1);
+            watchdog_expired();     // stalls counted from this frame on
+            if (glob_mode == MODE_BRACKET)
+                ret = capture_bracket(camera, nrcaptures - 1, &due);
+            else
+                ret = capture_frame(camera, nrcaptures - 1, &due);
+            offload_hold(0);
+            pthread_mutex_lock(&mutex);
+
+            clock_now(&now);
+            latency_us = (now.tv_sec - taken.tv_sec) * 1000000L + now.tv_usec - taken.tv_usec;
+
+            if (ret != GP_OK) 
+            {
+                if (recover(&camera, ret) < 0)
+                    break;
+
+                // retry the slot while it's current, skip those gone by
+                clock_now(&now);
+                if (glob_mode != MODE_MOTION && now.tv_sec < next.tv_sec) 
+                {
+                    next.tv_sec = slot;
+                }
+                else 
+                {
+                    nr_lost++;
+                    while (glob_mode != MODE_MOTION && next.tv_sec + glob_interval <= now.tv_sec) 
+                    {
+                        next.tv_sec += glob_interval;
+                        nr_lost++;
+                    }
+                }
+                continue;
+            }
+
+            nr_retries = 0;
+            journal_append(nrcaptures - 1, slot, &taken, ret);
+            ctl_frame(nrcaptures - 1);
             nrcaptures++;
         }
 
-        // wait 100 millis
+        // card housekeeping between frames, motion triggers don't wait
+        if (glob_mode != MODE_MOTION && camera != NULL) 
+        {
+            pthread_mutex_unlock(&mutex);
+            storage_idle(camera, main_context, next.tv_sec, 
+                         glob_frames ? glob_frames - nrcaptures + 1 : -1);
+            pthread_mutex_lock(&mutex);
+            if (thread_done) break;
+        }
+
+        // live view paces itself
+        if (watched)
+            continue;
+
+        // wait 100 millis, or to the slot itself so the trigger isn't late
         ts.tv_sec = now.tv_sec;
         ts.tv_nsec = (now.tv_usec + 100000) * 1000;
+        if (glob_mode != MODE_MOTION && ts.tv_sec + ts.tv_nsec / 1000000000 >= next.tv_sec) 
+        {
+            ts.tv_sec = next.tv_sec;
+            ts.tv_nsec = 0;
+        }
+        sync_local(&ts);
         pthread_cond_timedwait(&condw, &mutex, &ts);
-        gettimeofday(&now, NULL);
+        prof_wakeup();
+        clock_now(&now);
     }
 
-    gp_camera_exit(camera, main_context);
+    if (preview != NULL) 
+    {
+        gp_file_free(preview);
+        motion_report();
+    }
+
+    if (camera != NULL) 
+    {
+        pthread_mutex_unlock(&mutex);
+        close_camera(camera);
+        pthread_mutex_lock(&mutex);
+    }
+
+    pthread_mutex_unlock(&mutex);
+    rig_close();
+    pthread_mutex_lock(&mutex);
+
+    if (nr_errors > 0)
+        tlog_info("Camera errors: %ld, recoveries: %ld, lost slots: %ld\n", 
+               nr_errors, nr_recoveries, nr_lost);
+
+    // the run is over, nothing to resume
+    journal_end();
+
+    phash_report();
+    thumb_flush();
+    composite_close();
+    offload_close();
+    storage_report();
+    download_report();
+    frameidx_close();
+
+    // the thread's own share goes in before the report
+    prof_exit();
+    prof_report("run");
+    prof_reset();
+
+    publish(0, nrcaptures - 1, 0);
+    sync_announce(0, 0, 0);
 
     thread_done = 1;
+    thread_alive = 0;
 
-    // notify master
-    pthread_cond_signal(&condm);
+    // notify master, timelapse_wait() may be waiting too
+    pthread_cond_broadcast(&condm);
 
     // unlock 'thread_done'
     pthread_mutex_unlock(&mutex);
@@ -303,31 +1178,96 @@ int timelapse_start()
     Camera *camera;
     pthread_t thread;
     pthread_attr_t attr;
-    int ret;   
+    struct Session session;
+    struct timeval now;
+    time_t lead_start = 0;
+    int resume, busy, following;   
 
-    printf("Camera init. Takes about 10 seconds.\n");
-    gp_camera_new(&camera); 
+    // a worker left behind by timelapse_stop() still owns the camera
+    pthread_mutex_lock(&mutex);
+    busy = thread_alive;
+    pthread_mutex_unlock(&mutex);
+    if (busy) 
+    {
+        tlog_error("previous run still stuck in a camera call\n");
+        return -1;
+    }
 
-    ret = gp_camera_init(camera, main_context);
-    if (ret < GP_OK) 
+    // before the camera is claimed, a failure here leaves nothing open
+    if (glob_outdir != NULL && mkdir(glob_outdir, 0755) < 0 && errno != EEXIST) 
     {
-        fprintf(stderr, "gp_camera_init() failed: %d\n", ret);
+        tlog_error("%s: %s\n", glob_outdir, strerror(errno));
         return -1;
     }
 
-    char target[] = "Memory card";
-    ret = set_config_value_string(camera, "capturetarget", target, main_context);
-    if (ret < GP_OK)
+    if (open_camera(&camera) < GP_OK)
+        return -1;
+
+    // a follower runs on the leader's schedule, motion has none to share
+    following = (glob_sync == SYNC_FOLLOW && glob_mode != MODE_MOTION);
+    if (following && sync_schedule(&lead_start, &glob_interval, &glob_frames, SYNC_WAIT) < 0) 
     {
-        fprintf(stderr, "gp_camera_init() failed: %d\n", ret);
+        tlog_error("no schedule from the sync leader\n");
+        close_camera(camera);
         return -1;
     }
 
+    // continue an interrupted run or journal a new one
+    resume = journal_pending(&session);
+    if (resume) 
+    {
+        start_time = session.start;
+        first_frame = session.captured + 1;
+        tlog_info("Resuming at frame %ld\n", session.captured);
+    }
+    else 
+    {
+        start_time = following ? lead_start : time(NULL) + glob_delay;
+        first_frame = 1;
+
+        session.interval = glob_interval;
+        session.delay = glob_delay;
+        session.frames = glob_frames;
+        session.mode = glob_mode;
+        session.bracket = glob_bracket;
+        session.start = start_time;
+        journal_begin(&session);
+    }
+
+    // joining late: frames are numbered by the leader's slots
+    if (following) 
+    {
+        start_time = lead_start;
+        clock_now(&now);
+        if (now.tv_sec >= start_time && (now.tv_sec - start_time) / glob_interval + 2 > first_frame)
+            first_frame = (now.tv_sec - start_time) / glob_interval + 2;
+    }
+
+    // the composite survives a restart, not a new run
+    if (glob_outdir != NULL)
+        composite_open(glob_outdir, !resume);
+
+    if (glob_frameidx != NULL)
+        frameidx_open(glob_frameidx, !resume, start_time);
+
+    thumb_run(start_time);
+
+    if (glob_outdir != NULL && glob_offload != NULL)
+        offload_open(glob_outdir, glob_offload, glob_offload_rate);
+
+    if (glob_cameras > 1)
+        rig_open(camera, main_context, glob_cameras, glob_outdir, glob_transfer == TRANSFER_PREVIEW);
+
+    // what waiting for this run cost, the run is counted apart
+    prof_report("idle");
+    prof_reset();
+
     // start a new thread to capture images
     pthread_attr_init(&attr);
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
     
     thread_done = 0;
+    thread_alive = 1;
     pthread_create(&thread, &attr, timelapse_thread, (void *) camera);
     pthread_attr_destroy(&attr);
 
@@ -335,10 +1275,34 @@ int timelapse_start()
 }
 
 
+//-----------------------------------------------------------------------------
+// restores the settings of a run the process didn't see to its end,
+// returns 1 if there is one to resume
+int timelapse_recover()
+{
+    struct Session session;
+
+    if (!journal_pending(&session))
+        return 0;
+
+    glob_interval = session.interval;
+    glob_delay = session.delay;
+    glob_frames = session.frames;
+    glob_mode = session.mode;
+    glob_bracket = session.bracket;
+
+    tlog_info("Interrupted run found: %ld frames taken\n", session.captured);
+    return 1;
+}
+
 //-----------------------------------------------------------------------------
 
 void timelapse_stop() 
 {
+    struct timeval now;
+    struct timespec ts;
+    int ret = 0;
+
     // lock 'thread_done'
     pthread_mutex_lock(&mutex);
 
@@ -348,21 +1312,53 @@ void timelapse_stop()
         thread_done = 1;
         pthread_cond_signal(&condw);
 
-        // wait worker signal
-        pthread_cond_wait(&condm, &mutex);
+        // wait worker signal, a worker stuck in a camera call is left to
+        // finish on its own
+        gettimeofday(&now, NULL);
+        ts.tv_sec = now.tv_sec + STOP_TIMEOUT;
+        ts.tv_nsec = now.tv_usec * 1000;
+        while (thread_alive && ret != ETIMEDOUT)
+            ret = pthread_cond_timedwait(&condm, &mutex, &ts);
+
+        if (thread_alive) 
+        {
+            tlog_error("capture thread still busy, not waiting for it\n");
+            watchdog_abandon();
+        }
     }
 
     // unlock 'thread_done'
     pthread_mutex_unlock(&mutex);
 }
 
+//-----------------------------------------------------------------------------
+// blocks until the capture thread is gone, for runs without a user
+void timelapse_wait() 
+{
+    pthread_mutex_lock(&mutex);
+    while (thread_alive)
+        pthread_cond_wait(&condm, &mutex);
+    pthread_mutex_unlock(&mutex);
+}
+
 //-----------------------------------------------------------------------------
 
 void timelapse_destroy( void )
 {
+    sync_destroy();
+    watchdog_destroy();
+
     pthread_mutex_destroy(&mutex);
     pthread_cond_destroy(&condw);
     pthread_cond_destroy(&condm);
+
+    thumb_destroy();
+    composite_destroy();
+    offload_destroy();
+    rig_destroy();
+    journal_close();
+
+    tlog_destroy();
 }
 
 //-----------------------------------------------------------------------------
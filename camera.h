@@ -1,9 +1,23 @@
 #ifndef __CAMERA__H__
 #define __CAMERA__H__
 
+#define MODE_INTERVAL 0  // capture every interval
+#define MODE_MOTION   1  // capture when the scene changes, or every interval
+#define MODE_BRACKET  2  // fuse a bracket of exposures every interval
+
+#define DEDUP_OFF     0  // keep every frame
+#define DEDUP_FLAG    1  // log frames that duplicate a recent one
+#define DEDUP_DROP    2  // delete duplicates from the card and the disk,
+                         // previews are only flagged
+
+#define TRANSFER_FULL    0  // download every file whole
+#define TRANSFER_PREVIEW 1  // only the embedded preview, the file stays on the card
+
 void timelapse_init();
 void timelapse_destroy();
 int  timelapse_start();
+int  timelapse_recover();
 void timelapse_stop();
+void timelapse_wait();
 
 #endif
@@ -0,0 +1,498 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "image.h"
+#include "composite.h"
+#include "prof.h"
+#include "tlog.h"
+
+// 1/2 scale keeps a 24 MP frame at 6 MP, the buffer at ~90 MB
+#define COMP_SCALE     2
+#define COMP_QUALITY  92
+
+// export the composites as jpeg every so many frames
+#define COMP_EXPORT   10
+
+// bytes folded per tile, a tile stays in L1 while both the max and the
+// sum kernels run over it
+#define TILE_BYTES  8192
+
+#define QUEUE_SIZE     4
+
+#define COMP_MAGIC   "RLCOMP1"
+#define COMP_VERSION   1
+
+// on-disk layout: header, max plane (u8), sum plane (u32), all rgb
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t comps;
+    uint64_t frames;
+    uint8_t pad[32];
+};
+
+struct Job
+{
+    long frame;
+    char path[PATH_MAX];
+};
+
+static volatile int thread_done = 1;
+static pthread_t thread;
+static pthread_mutex_t mutex;
+static pthread_cond_t condw; // worker
+static pthread_cond_t condm; // master
+
+static struct Job jobs[QUEUE_SIZE];
+static unsigned head = 0, tail = 0;
+static int busy = 0;
+
+// mapped composite, NULL until the first frame or when closed, 'dir'
+// leaves room for the file names
+static char dir[PATH_MAX - 32];
+static struct Header *header = NULL;
+static size_t map_size = 0;
+static uint8_t *max_plane;
+static uint32_t *sum_plane;
+
+// decoded frame and mean export of the worker, kept for the run
+static struct Image frame_buf;
+static struct Image mean_buf;
+
+// fold timing
+static long nr_folded = 0;
+static double fold_total = 0, fold_max = 0;
+
+//-----------------------------------------------------------------------------
+
+static void max_u8(uint8_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for (; i + 16 <= n; i += 16)
+        vst1q_u8(dst + i, vmaxq_u8(vld1q_u8(dst + i), vld1q_u8(src + i)));
+#elif defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) 
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *) (dst + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (src + i));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_max_epu8(a, b));
+    }
+#endif
+
+    for (; i < n; i++)
+        if (src[i] > dst[i]) dst[i] = src[i];
+}
+
+//-----------------------------------------------------------------------------
+
+static void add_u8_u32(uint32_t *sum, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for (; i + 16 <= n; i += 16) 
+    {
+        uint8x16_t v = vld1q_u8(src + i);
+        uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+        uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+
+        vst1q_u32(sum + i,      vaddw_u16(vld1q_u32(sum + i),      vget_low_u16(lo)));
+        vst1q_u32(sum + i + 4,  vaddw_u16(vld1q_u32(sum + i + 4),  vget_high_u16(lo)));
+        vst1q_u32(sum + i + 8,  vaddw_u16(vld1q_u32(sum + i + 8),  vget_low_u16(hi)));
+        vst1q_u32(sum + i + 12, vaddw_u16(vld1q_u32(sum + i + 12), vget_high_u16(hi)));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) 
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        __m128i *s = (__m128i *) (sum + i);
+
+        _mm_storeu_si128(s,     _mm_add_epi32(_mm_loadu_si128(s),     _mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_si128(s + 1, _mm_add_epi32(_mm_loadu_si128(s + 1), _mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_si128(s + 2, _mm_add_epi32(_mm_loadu_si128(s + 2), _mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_si128(s + 3, _mm_add_epi32(_mm_loadu_si128(s + 3), _mm_unpackhi_epi16(hi, zero)));
+    }
+#endif
+
+    for (; i < n; i++)
+        sum[i] += src[i];
+}
+
+//-----------------------------------------------------------------------------
+
+static int map(size_t size, int fd) 
+{
+    void *p;
+
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) 
+    {
+        perror("composite mmap");
+        return -1;
+    }
+
+    header = (struct Header *) p;
+    map_size = size;
+    max_plane = (uint8_t *) (header + 1);
+    sum_plane = (uint32_t *) (max_plane + ((size_t) header->width * header->height * header->comps + 63) / 64 * 64);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+static size_t buffer_size(uint32_t width, uint32_t height, uint32_t comps) 
+{
+    size_t n = (size_t) width * height * comps;
+
+    return sizeof(struct Header) + (n + 63) / 64 * 64 + n * sizeof(uint32_t);
+}
+
+//-----------------------------------------------------------------------------
+// (re)creates the buffer file for frames of the given size
+static int create(const struct Image *frame) 
+{
+    char path[PATH_MAX];
+    struct Header h;
+    size_t size;
+    int fd, ret;
+
+    if (header != NULL) 
+    {
+        munmap(header, map_size);
+        header = NULL;
+    }
+
+    snprintf(path, sizeof(path), "%s/composite.bin", dir);
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) 
+    {
+        perror(path);
+        return -1;
+    }
+
+    size = buffer_size(frame->width, frame->height, frame->comps);
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, COMP_MAGIC, sizeof(h.magic));
+    h.version = COMP_VERSION;
+    h.width = frame->width;
+    h.height = frame->height;
+    h.comps = frame->comps;
+
+    // a sparse file reads back as zeros: empty max and sum planes
+    if (ftruncate(fd, size) < 0 || pwrite(fd, &h, sizeof(h), 0) != sizeof(h)) 
+    {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+
+    ret = map(size, fd);
+    close(fd);
+
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+// the mean is exported every few frames, its buffer is made at the first
+static int reserve_mean(void) 
+{
+    size_t n = (size_t) header->width * header->height * header->comps;
+
+    if (mean_buf.size >= n)
+        return 0;
+
+    image_free(&mean_buf);
+    mean_buf.pix = malloc(n);
+    if (mean_buf.pix == NULL)
+        return -1;
+
+    mean_buf.size = n;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+static void export(void) 
+{
+    struct Image img;
+    char path[PATH_MAX], tmp[PATH_MAX];
+    size_t i, n;
+    uint64_t frames = header->frames;
+
+    if (frames == 0) return;
+
+    img.width = header->width;
+    img.height = header->height;
+    img.comps = header->comps;
+    img.pix = max_plane;
+
+    // write and rename, so viewers never see a half written file
+    snprintf(path, sizeof(path), "%s/composite_max.jpg", dir);
+    snprintf(tmp, sizeof(tmp), "%s/.composite_max.jpg", dir);
+    if (image_save(tmp, &img, COMP_QUALITY) == 0)
+        rename(tmp, path);
+
+    if (reserve_mean() < 0) return;
+
+    n = (size_t) img.width * img.height * img.comps;
+    mean_buf.width = img.width;
+    mean_buf.height = img.height;
+    mean_buf.comps = img.comps;
+
+    for (i = 0; i < n; i++)
+        mean_buf.pix[i] = (sum_plane[i] + frames / 2) / frames;
+
+    snprintf(path, sizeof(path), "%s/composite_mean.jpg", dir);
+    snprintf(tmp, sizeof(tmp), "%s/.composite_mean.jpg", dir);
+    if (image_save(tmp, &mean_buf, COMP_QUALITY) == 0)
+        rename(tmp, path);
+}
+
+//-----------------------------------------------------------------------------
+
+// a frame is decoded whole before any of it goes into the planes: they
+// are the file, a frame that fails halfway would stay in it
+static void fold(const struct Job *job)
+{
+    struct timeval start, end;
+    size_t i, n, chunk;
+    double secs;
+
+    gettimeofday(&start, NULL);
+
+    if (image_reload(job->path, COMP_SCALE, 3, &frame_buf) < 0) 
+    {
+        fprintf(stderr, "composite: cannot decode %s\n", job->path);
+        return;
+    }
+
+    // the buffer is sized from the first frame
+    if (header == NULL || 
+        header->width != (uint32_t) frame_buf.width || 
+        header->height != (uint32_t) frame_buf.height || 
+        header->comps != (uint32_t) frame_buf.comps) 
+    {
+        if (header != NULL && header->frames > 0)
+            fprintf(stderr, "composite: frame size changed, restarting\n");
+        if (create(&frame_buf) < 0) 
+            return;
+    }
+
+    n = (size_t) frame_buf.width * frame_buf.height * frame_buf.comps;
+    for (i = 0; i < n; i += chunk) 
+    {
+        chunk = (n - i < TILE_BYTES) ? n - i : TILE_BYTES;
+        max_u8(max_plane + i, frame_buf.pix + i, chunk);
+        add_u8_u32(sum_plane + i, frame_buf.pix + i, chunk);
+    }
+
+    header->frames++;
+    msync(header, map_size, MS_ASYNC);
+    reserve_mean();
+
+    if (header->frames % COMP_EXPORT == 0)
+        export();
+
+    gettimeofday(&end, NULL);
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+    nr_folded++;
+    fold_total += secs;
+    if (secs > fold_max) fold_max = secs;
+}
+
+//-----------------------------------------------------------------------------
+
+static void *composite_thread(void *arg) 
+{
+    struct Job job;
+
+    prof_thread("composite");
+    pthread_mutex_lock(&mutex);
+
+    while (1) 
+    {
+        while (!thread_done && head == tail) 
+        {
+            pthread_cond_wait(&condw, &mutex);
+            prof_wakeup();
+        }
+        
+        if (thread_done) break;
+
+        job = jobs[head % QUEUE_SIZE];
+        head++;
+        busy = 1;
+
+        // fold without the lock, the capture thread only queues
+        pthread_mutex_unlock(&mutex);
+        if (header != NULL || dir[0] != '\0')
+            fold(&job);
+        pthread_mutex_lock(&mutex);
+
+        busy = 0;
+        pthread_cond_signal(&condm);
+    }
+
+    pthread_mutex_unlock(&mutex);
+
+    prof_exit();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+void composite_init( void ) 
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&condw, NULL);
+    pthread_cond_init(&condm, NULL);
+
+    thread_done = 0;
+    pthread_create(&thread, NULL, composite_thread, NULL);
+}
+
+//-----------------------------------------------------------------------------
+
+int composite_open(const char *path, int reset) 
+{
+    char file[PATH_MAX];
+    struct Header h;
+    struct stat st;
+    int fd;
+
+    snprintf(dir, sizeof(dir), "%s", path);
+    nr_folded = 0;
+    fold_total = fold_max = 0;
+
+    snprintf(file, sizeof(file), "%s/composite.bin", dir);
+    if (reset) 
+    {
+        unlink(file);
+        return 0;
+    }
+
+    // resume a composite left by a previous run, if it's sane
+    fd = open(file, O_RDWR);
+    if (fd < 0) return 0;
+
+    if (fstat(fd, &st) < 0 || pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+        memcmp(h.magic, COMP_MAGIC, sizeof(h.magic)) != 0 || h.version != COMP_VERSION ||
+        (size_t) st.st_size != buffer_size(h.width, h.height, h.comps)) 
+    {
+        fprintf(stderr, "composite: ignoring invalid %s\n", file);
+        close(fd);
+        return 0;
+    }
+
+    if (map(st.st_size, fd) < 0) 
+    {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    printf("Composite resumed: %ux%u, %llu frames\n", 
+           h.width, h.height, (unsigned long long) h.frames);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int composite_submit(long frame, const char *path) 
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&mutex);
+    if (tail - head < QUEUE_SIZE) 
+    {
+        jobs[tail % QUEUE_SIZE].frame = frame;
+        snprintf(jobs[tail % QUEUE_SIZE].path, PATH_MAX, "%s", path);
+        tail++;
+        pthread_cond_signal(&condw);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&mutex);
+
+    if (ret < 0)
+        tlog_error("composite: falling behind, skipping %s\n", path);
+
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+// read without the lock, for monitoring only
+int composite_pending( void ) 
+{
+    return __atomic_load_n(&tail, __ATOMIC_RELAXED) - __atomic_load_n(&head, __ATOMIC_RELAXED) 
+         + __atomic_load_n(&busy, __ATOMIC_RELAXED);
+}
+
+//-----------------------------------------------------------------------------
+
+void composite_close( void ) 
+{
+    // wait until the queue is drained
+    pthread_mutex_lock(&mutex);
+    while (busy || head != tail)
+        pthread_cond_wait(&condm, &mutex);
+    pthread_mutex_unlock(&mutex);
+
+    if (nr_folded > 0)
+        printf("Composite: %ld frames, %.3f s avg, %.3f s max per frame\n", 
+               nr_folded, fold_total / nr_folded, fold_max);
+
+    if (header != NULL) 
+    {
+        export();
+        msync(header, map_size, MS_SYNC);
+        munmap(header, map_size);
+        header = NULL;
+    }
+    dir[0] = '\0';
+
+    image_free(&frame_buf);
+    image_free(&mean_buf);
+}
+
+//-----------------------------------------------------------------------------
+
+void composite_destroy( void ) 
+{
+    composite_close();
+
+    pthread_mutex_lock(&mutex);
+    thread_done = 1;
+    pthread_cond_signal(&condw);
+    pthread_mutex_unlock(&mutex);
+
+    pthread_join(thread, NULL);
+
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&condw);
+    pthread_cond_destroy(&condm);
+}
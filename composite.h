@@ -0,0 +1,20 @@
+#ifndef __COMPOSITE_H__
+#define __COMPOSITE_H__
+
+void composite_init(void);
+void composite_destroy(void);
+
+// maps '<dir>/composite.bin', an existing buffer of the same size is
+// resumed unless 'reset' is set
+int  composite_open(const char *dir, int reset);
+
+// fold a downloaded jpeg into the composite, returns -1 if the queue is full
+int  composite_submit(long frame, const char *path);
+
+// frames queued or being folded
+int  composite_pending(void);
+
+// wait for queued frames, export the composites and unmap the buffer
+void composite_close(void);
+
+#endif
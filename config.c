@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "camera.h"
+#include "config.h"
+#include "lcd.h"
+#include "rig.h"
+#include "storage.h"
+#include "sync.h"
+
+// timelapse settings
+long glob_interval = 0;
+long glob_delay = 0;
+long glob_frames = 0;
+long glob_mode = MODE_INTERVAL;
+long glob_dedup = DEDUP_FLAG;
+long glob_bracket = 3;
+long glob_storage = STORAGE_WARN;
+
+// what of each frame comes over usb, see camera.h
+long glob_transfer = TRANSFER_FULL;
+
+// cameras fired together, see rig.h
+long glob_cameras = 1;
+
+// frames are downloaded here, NULL leaves them on the card only
+const char *glob_outdir = "frames";
+
+// progress of the run, to resume it after a crash or a power cut
+const char *glob_journal = "timelapse.journal";
+
+// exposure and timing of every frame, see frameidx.h
+const char *glob_frameidx = "frames.idx";
+
+// model and port of the last camera, skips autodetection at start
+const char *glob_camcache = "camera.cache";
+
+// frames are copied here in the background, NULL for no offload; KB/s,
+// 0 for no cap
+const char *glob_offload = NULL;
+long glob_offload_rate = 8192;
+
+// firing together with other controllers, see sync.h; the group is
+// "address:port", the interface NULL for the default one
+long glob_sync = SYNC_OFF;
+const char *glob_sync_group = "239.255.42.99:5399";
+const char *glob_sync_if = NULL;
+
+// the display, see lcd.h; the backpack's i2c address as i2cdetect
+// shows it, hex
+long glob_lcd = LCD_GPIO;
+long glob_lcd_addr = 0x27;
+
+// wakeups and cpu time per thread, logged for each run and each wait
+// between runs, see prof.h
+long glob_profile = 0;
+
+// control socket, see ctl.h; NULL for none. Only this user and root
+// may connect, the directory should be private to it as well
+const char *glob_ctlsock = NULL;
+
+static const char *mode_names[] = { "interval", "motion", "bracket" };
+static const char *dedup_names[] = { "off", "flag", "drop" };
+static const char *transfer_names[] = { "full", "preview" };
+static const char *storage_names[] = { "warn", "quality", "delete" };
+static const char *sync_names[] = { "off", "leader", "follow" };
+static const char *lcd_names[] = { "gpio", "pcf8574", "term" };
+static const char *profile_names[] = { "off", "on" };
+
+//-----------------------------------------------------------------------------
+// a number in 'min'..'max', or the index of one of 'names'
+static int parse_long(const char *value, long min, long max, const char **names, int n, long *out)
+{
+    char *end;
+    long v;
+    int i;
+
+    for (i = 0; i < n; i++) 
+    {
+        if (strcmp(value, names[i]) == 0) 
+        {
+            *out = i;
+            return 0;
+        }
+    }
+
+    v = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || v < min || v > max)
+        return -1;
+
+    *out = v;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// a hex number in 'min'..'max', with or without 0x
+static int parse_hex(const char *value, long min, long max, long *out)
+{
+    char *end;
+    long v;
+
+    v = strtol(value, &end, 16);
+    if (end == value || *end != '\0' || v < min || v > max)
+        return -1;
+
+    *out = v;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+static int parse_path(const char *value, const char **out)
+{
+    if (value[0] == '\0') 
+    {
+        *out = NULL;
+        return 0;
+    }
+
+    *out = strdup(value);
+    return (*out == NULL) ? -1 : 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int config_set(const char *key, const char *value)
+{
+    int ret = -1;
+
+    if (strcmp(key, "interval") == 0)
+        ret = parse_long(value, 1, 359999, NULL, 0, &glob_interval);
+    else if (strcmp(key, "delay") == 0)
+        ret = parse_long(value, 0, 359999, NULL, 0, &glob_delay);
+    else if (strcmp(key, "frames") == 0)
+        ret = parse_long(value, 0, 99999, NULL, 0, &glob_frames);
+    else if (strcmp(key, "mode") == 0)
+        ret = parse_long(value, 0, 2, mode_names, 3, &glob_mode);
+    else if (strcmp(key, "dedup") == 0)
+        ret = parse_long(value, 0, 2, dedup_names, 3, &glob_dedup);
+    else if (strcmp(key, "transfer") == 0)
+        ret = parse_long(value, 0, 1, transfer_names, 2, &glob_transfer);
+    else if (strcmp(key, "storage") == 0)
+        ret = parse_long(value, 0, 2, storage_names, 3, &glob_storage);
+    else if (strcmp(key, "bracket") == 0)
+        ret = parse_long(value, 2, 9, NULL, 0, &glob_bracket);
+    else if (strcmp(key, "cameras") == 0)
+        ret = parse_long(value, 1, RIG_MAX, NULL, 0, &glob_cameras);
+    else if (strcmp(key, "outdir") == 0)
+        ret = parse_path(value, &glob_outdir);
+    else if (strcmp(key, "journal") == 0)
+        ret = parse_path(value, &glob_journal);
+    else if (strcmp(key, "frameidx") == 0)
+        ret = parse_path(value, &glob_frameidx);
+    else if (strcmp(key, "camcache") == 0)
+        ret = parse_path(value, &glob_camcache);
+    else if (strcmp(key, "offload") == 0)
+        ret = parse_path(value, &glob_offload);
+    else if (strcmp(key, "offload_rate") == 0)
+        ret = parse_long(value, 0, 1L << 30, NULL, 0, &glob_offload_rate);
+    else if (strcmp(key, "sync") == 0)
+        ret = parse_long(value, 0, 2, sync_names, 3, &glob_sync);
+    else if (strcmp(key, "sync_group") == 0 && value[0] != '\0')
+        ret = parse_path(value, &glob_sync_group);
+    else if (strcmp(key, "sync_if") == 0)
+        ret = parse_path(value, &glob_sync_if);
+    else if (strcmp(key, "lcd") == 0)
+        ret = parse_long(value, 0, 2, lcd_names, 3, &glob_lcd);
+    else if (strcmp(key, "lcd_addr") == 0)
+        ret = parse_hex(value, 0x03, 0x77, &glob_lcd_addr);
+    else if (strcmp(key, "profile") == 0)
+        ret = parse_long(value, 0, 1, profile_names, 2, &glob_profile);
+    else if (strcmp(key, "socket") == 0)
+        ret = parse_path(value, &glob_ctlsock);
+
+    if (ret < 0)
+        fprintf(stderr, "bad setting: %s = %s\n", key, value);
+
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+
+int config_load(const char *path)
+{
+    char line[512], *key, *value, *p;
+    int nr = 0, ret = 0;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (f == NULL) 
+    {
+        perror(path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL) 
+    {
+        nr++;
+
+        if ((p = strchr(line, '#')) != NULL) 
+            *p = '\0';
+
+        // trim both ends of key and value
+        for (key = line; isspace((unsigned char) *key); key++);
+        if (*key == '\0') 
+            continue;
+
+        value = strchr(key, '=');
+        if (value == NULL) 
+        {
+            fprintf(stderr, "%s:%d: expected 'key = value'\n", path, nr);
+            ret = -1;
+            continue;
+        }
+
+        for (p = value; p > key && isspace((unsigned char) p[-1]); p--);
+        *p = '\0';
+        for (value++; isspace((unsigned char) *value); value++);
+        for (p = value + strlen(value); p > value && isspace((unsigned char) p[-1]); p--);
+        *p = '\0';
+
+        if (config_set(key, value) < 0)
+            ret = -1;
+    }
+
+    fclose(f);
+    return ret;
+}
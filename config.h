@@ -0,0 +1,36 @@
+#ifndef __CONFIG_H__
+#define __CONFIG_H__
+
+// timelapse settings
+extern long glob_interval;
+extern long glob_delay;
+extern long glob_frames;
+extern long glob_mode;
+extern long glob_dedup;
+extern long glob_bracket;
+extern long glob_storage;
+extern long glob_transfer;
+extern long glob_cameras;
+extern long glob_sync;
+
+extern const char *glob_outdir;
+extern const char *glob_journal;
+extern const char *glob_frameidx;
+extern const char *glob_camcache;
+extern const char *glob_ctlsock;
+extern const char *glob_offload;
+extern long glob_offload_rate;
+extern const char *glob_sync_group;
+extern const char *glob_sync_if;
+extern long glob_lcd;
+extern long glob_lcd_addr;
+extern long glob_profile;
+
+// sets one setting by name ("interval", "outdir", ...), an empty path
+// turns the feature off; returns -1 for an unknown key or a bad value
+int config_set(const char *key, const char *value);
+
+// reads 'key = value' lines, '#' starts a comment
+int config_load(const char *path);
+
+#endif
@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "crc32c.h"
+
+// the crc instructions of sse4.2 and armv8 take 8 bytes per cycle or so,
+// cpus without them (the arm11 of a pi zero) use slicing-by-8 tables
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define HAVE_SSE42 1
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#define HAVE_ARMV8 1
+#elif defined(__arm__) && defined(__ARM_FEATURE_CRC32)
+// 32-bit builds get it from -march=armv8-a+crc, for a pi 3 or later
+#include <arm_acle.h>
+#define HAVE_ARMV8 1
+#endif
+
+// reflected castagnoli polynomial
+#define POLY 0x82f63b78u
+
+typedef uint32_t (*crc_fn)(uint32_t crc, const uint8_t *p, size_t len);
+
+static uint32_t table[8][256];
+static crc_fn impl = NULL;
+static const char *impl_name = "table";
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+//-----------------------------------------------------------------------------
+
+static uint32_t crc_table(uint32_t crc, const uint8_t *p, size_t len)
+{
+    uint32_t lo, hi;
+
+    while (len > 0 && ((uintptr_t) p & 7) != 0)
+    {
+        crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+
+    // eight bytes per step, little endian words
+    while (len >= 8)
+    {
+        lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24);
+        hi = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t) p[7] << 24;
+        crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^
+              table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^
+              table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^
+              table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+
+    while (len > 0)
+    {
+        crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+
+    return crc;
+}
+
+//-----------------------------------------------------------------------------
+
+#ifdef HAVE_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t crc_sse42(uint32_t crc, const uint8_t *p, size_t len)
+{
+    uint64_t c = crc, v;
+
+    while (len > 0 && ((uintptr_t) p & 7) != 0)
+    {
+        c = _mm_crc32_u8(c, *p++);
+        len--;
+    }
+
+    while (len >= 8)
+    {
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        len -= 8;
+    }
+
+    while (len > 0)
+    {
+        c = _mm_crc32_u8(c, *p++);
+        len--;
+    }
+
+    return (uint32_t) c;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+
+#ifdef HAVE_ARMV8
+#ifdef __aarch64__
+__attribute__((target("+crc")))
+#endif
+static uint32_t crc_armv8(uint32_t crc, const uint8_t *p, size_t len)
+{
+    uint32_t v;
+
+    while (len > 0 && ((uintptr_t) p & 3) != 0)
+    {
+        crc = __crc32cb(crc, *p++);
+        len--;
+    }
+
+#ifdef __aarch64__
+    {
+        uint64_t d;
+
+        while (len >= 8)
+        {
+            memcpy(&d, p, 8);
+            crc = __crc32cd(crc, d);
+            p += 8;
+            len -= 8;
+        }
+    }
+#endif
+
+    while (len >= 4)
+    {
+        memcpy(&v, p, 4);
+        crc = __crc32cw(crc, v);
+        p += 4;
+        len -= 4;
+    }
+
+    while (len > 0)
+    {
+        crc = __crc32cb(crc, *p++);
+        len--;
+    }
+
+    return crc;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+
+static void init(void)
+{
+    uint32_t c;
+    int i, j;
+
+    for (i = 0; i < 256; i++)
+    {
+        c = i;
+        for (j = 0; j < 8; j++)
+            c = (c & 1) ? (c >> 1) ^ POLY : c >> 1;
+        table[0][i] = c;
+    }
+
+    for (i = 0; i < 256; i++)
+        for (j = 1; j < 8; j++)
+            table[j][i] = table[0][table[j - 1][i] & 0xff] ^ (table[j - 1][i] >> 8);
+
+    impl = crc_table;
+
+#ifdef HAVE_SSE42
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        impl = crc_sse42;
+        impl_name = "sse4.2";
+    }
+#elif defined(HAVE_ARMV8) && defined(__aarch64__)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+    {
+        impl = crc_armv8;
+        impl_name = "armv8";
+    }
+#elif defined(HAVE_ARMV8)
+    impl = crc_armv8;
+    impl_name = "armv8";
+#endif
+}
+
+//-----------------------------------------------------------------------------
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+    pthread_once(&once, init);
+
+    return ~impl(~crc, (const uint8_t *) buf, len);
+}
+
+//-----------------------------------------------------------------------------
+
+const char *crc32c_impl(void)
+{
+    pthread_once(&once, init);
+
+    return impl_name;
+}
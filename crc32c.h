@@ -0,0 +1,14 @@
+#ifndef __CRC32C_H__
+#define __CRC32C_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// crc-32c (castagnoli) as in iscsi and ext4; start with 0 and pass the
+// result of the previous chunk to checksum a stream piece by piece
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+// the implementation picked for this cpu: "sse4.2", "armv8" or "table"
+const char *crc32c_impl(void);
+
+#endif
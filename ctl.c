@@ -0,0 +1,344 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "ctl.h"
+#include "event.h"
+#include "status.h"
+#include "prof.h"
+#include "tlog.h"
+
+#define MAX_CLIENTS 8
+
+struct Client
+{
+    int fd;
+    int subscribed;
+    int have;                             // bytes of a partial request
+    char buf[CTL_BATCH * sizeof(struct CtlMsg)];
+};
+
+static int listen_fd = -1;
+static struct Client clients[MAX_CLIENTS];
+static char sock_path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+
+// a pipe wakes the server to stop it
+static int wake[2] = { -1, -1 };
+static pthread_t thread;
+
+// guards the client fds against ctl_frame()
+static pthread_mutex_t mutex;
+
+//-----------------------------------------------------------------------------
+
+static void drop_client(struct Client *c)
+{
+    pthread_mutex_lock(&mutex);
+    close(c->fd);
+    c->fd = -1;
+    c->subscribed = 0;
+    pthread_mutex_unlock(&mutex);
+}
+
+//-----------------------------------------------------------------------------
+// replies never wait for a slow client, it's dropped instead
+static int send_all(struct Client *c, const void *buf, size_t len)
+{
+    ssize_t n;
+
+    pthread_mutex_lock(&mutex);
+    n = send(c->fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    pthread_mutex_unlock(&mutex);
+
+    return (n == (ssize_t) len) ? 0 : -1;
+}
+
+//-----------------------------------------------------------------------------
+// runs the complete requests in the client's buffer
+static int serve(struct Client *c)
+{
+    static char out[CTL_BATCH * (sizeof(struct CtlMsg) + sizeof(struct Status))];
+    struct CtlMsg *msgs = (struct CtlMsg *) c->buf;
+    struct Status st;
+    int i, n, len = 0, subscribe = 0;
+
+    n = c->have / sizeof(struct CtlMsg);
+    if (n == 0) 
+        return 0;
+
+    // subscribing is the connection's business, the rest goes through
+    // the event loop in one go
+    for (i = 0; i < n; i++) 
+        if (msgs[i].op == CTL_SUBSCRIBE) 
+            subscribe = 1;
+    post_commands(msgs, n);
+
+    for (i = 0; i < n; i++) 
+    {
+        if (msgs[i].op == CTL_STATUS && msgs[i].status == CTL_OK) 
+        {
+            msgs[i].value = sizeof(st);
+            memcpy(out + len, &msgs[i], sizeof(struct CtlMsg));
+            len += sizeof(struct CtlMsg);
+
+            status_get(&st);
+            memcpy(out + len, &st, sizeof(st));
+            len += sizeof(st);
+        }
+        else 
+        {
+            memcpy(out + len, &msgs[i], sizeof(struct CtlMsg));
+            len += sizeof(struct CtlMsg);
+        }
+    }
+
+    // keep the tail of a request split across reads
+    c->have -= n * sizeof(struct CtlMsg);
+    memmove(c->buf, c->buf + n * sizeof(struct CtlMsg), c->have);
+
+    if (send_all(c, out, len) < 0)
+        return -1;
+
+    // frames only after the replies, a client reads those first
+    if (subscribe) 
+    {
+        pthread_mutex_lock(&mutex);
+        c->subscribed = 1;
+        pthread_mutex_unlock(&mutex);
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+static void accept_client(void)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    int i, fd;
+
+    fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) 
+        return;
+
+    // the socket starts and stops runs, for this user and root only
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 ||
+        (cred.uid != 0 && cred.uid != getuid())) 
+    {
+        tlog_error("ctl: refused a client of another user\n");
+        close(fd);
+        return;
+    }
+
+    for (i = 0; i < MAX_CLIENTS; i++) 
+    {
+        if (clients[i].fd < 0) 
+        {
+            clients[i].have = 0;
+            clients[i].subscribed = 0;
+            pthread_mutex_lock(&mutex);
+            clients[i].fd = fd;
+            pthread_mutex_unlock(&mutex);
+            return;
+        }
+    }
+
+    tlog_error("ctl: too many clients\n");
+    close(fd);
+}
+
+//-----------------------------------------------------------------------------
+
+static void *ctl_thread(void *arg) 
+{
+    struct pollfd fds[MAX_CLIENTS + 2];
+    struct Client *owner[MAX_CLIENTS + 2];
+    struct Client *c;
+    int i, n;
+    ssize_t got;
+
+    prof_thread("ctl");
+
+    for (;;) 
+    {
+        fds[0].fd = wake[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = listen_fd;
+        fds[1].events = POLLIN;
+        n = 2;
+
+        for (i = 0; i < MAX_CLIENTS; i++) 
+        {
+            if (clients[i].fd < 0) 
+                continue;
+            fds[n].fd = clients[i].fd;
+            fds[n].events = POLLIN;
+            owner[n++] = &clients[i];
+        }
+
+        if (poll(fds, n, -1) < 0) 
+        {
+            if (errno == EINTR) continue;
+            tlog_error("ctl: poll: %s\n", strerror(errno));
+            break;
+        }
+        prof_wakeup();
+
+        if (fds[0].revents) 
+            break;
+
+        if (fds[1].revents & POLLIN) 
+            accept_client();
+
+        for (i = 2; i < n; i++) 
+        {
+            if (fds[i].revents == 0) 
+                continue;
+
+            c = owner[i];
+            got = recv(c->fd, c->buf + c->have, sizeof(c->buf) - c->have, 0);
+            if (got <= 0) 
+            {
+                drop_client(c);
+                continue;
+            }
+
+            c->have += got;
+            if (serve(c) < 0)
+                drop_client(c);
+        }
+    }
+
+    prof_exit();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+int ctl_init(const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    int i;
+
+    for (i = 0; i < MAX_CLIENTS; i++)
+        clients[i].fd = -1;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) 
+    {
+        tlog_error("ctl: socket path too long: %s\n", path);
+        return -1;
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) 
+    {
+        perror("ctl socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    strcpy(sock_path, path);
+
+    // a socket left by a crashed process, but nothing else
+    if (lstat(path, &st) == 0 && !S_ISSOCK(st.st_mode)) 
+    {
+        tlog_error("ctl: %s exists and is not a socket\n", path);
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    unlink(path);
+
+    // no one else connects before it's private, listen() comes after
+    if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || 
+        chmod(path, 0600) < 0 || listen(listen_fd, 4) < 0) 
+    {
+        perror(path);
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+
+    if (pipe(wake) < 0) 
+    {
+        perror("ctl pipe");
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+
+    pthread_mutex_init(&mutex, NULL);
+    pthread_create(&thread, NULL, ctl_thread, NULL);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+void ctl_destroy( void )
+{
+    int i;
+
+    if (listen_fd < 0)
+        return;
+
+    if (write(wake[1], "", 1) < 0)
+        perror("ctl wake");
+    pthread_join(thread, NULL);
+
+    for (i = 0; i < MAX_CLIENTS; i++)
+        if (clients[i].fd >= 0)
+            drop_client(&clients[i]);
+
+    close(wake[0]);
+    close(wake[1]);
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(sock_path);
+
+    pthread_mutex_destroy(&mutex);
+}
+
+//-----------------------------------------------------------------------------
+
+void ctl_frame(long frame)
+{
+    struct CtlMsg msg;
+    ssize_t n;
+    int i;
+
+    if (listen_fd < 0)
+        return;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.op = CTL_FRAME;
+    msg.value = frame;
+
+    // a subscriber that doesn't keep up misses frames; part of one would
+    // break the framing, the server thread drops it once shut down
+    pthread_mutex_lock(&mutex);
+    for (i = 0; i < MAX_CLIENTS; i++) 
+    {
+        if (clients[i].fd < 0 || !clients[i].subscribed)
+            continue;
+
+        n = send(clients[i].fd, &msg, sizeof(msg), MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n >= 0 && n != (ssize_t) sizeof(msg)) 
+        {
+            shutdown(clients[i].fd, SHUT_RDWR);
+            clients[i].subscribed = 0;
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,42 @@
+#ifndef __CTL_H__
+#define __CTL_H__
+
+#include <stdint.h>
+
+// control socket: clients write batches of fixed 16-byte requests and get
+// one reply per request, in order, in a single write. A CTL_STATUS reply
+// is followed by 'value' bytes of struct Status (status.h)
+struct CtlMsg
+{
+    uint16_t op;
+    int16_t  status;   // replies: CTL_OK or CTL_E*
+    uint32_t tag;      // copied to the reply
+    int64_t  value;
+};
+
+#define CTL_PING          1  // goes through the event loop and back
+#define CTL_SET_INTERVAL  2  // seconds
+#define CTL_SET_DELAY     3  // seconds
+#define CTL_SET_FRAMES    4  // 0 for no limit
+#define CTL_SET_MODE      5  // MODE_* from camera.h
+#define CTL_START         6
+#define CTL_STOP          7
+#define CTL_STATUS        8
+#define CTL_SUBSCRIBE     9  // CTL_FRAME messages follow on this connection
+#define CTL_FRAME        10  // sent to subscribers, 'value' is the frame
+
+#define CTL_OK            0
+#define CTL_EINVAL       -1  // unknown op or value out of range
+#define CTL_EBUSY        -2  // not while a run is going
+#define CTL_EFAIL        -3  // the camera didn't start
+
+// requests handled per read
+#define CTL_BATCH 64
+
+int  ctl_init(const char *path);
+void ctl_destroy(void);
+
+// tells subscribers a frame was taken
+void ctl_frame(long frame);
+
+#endif
@@ -0,0 +1,349 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "crc32c.h"
+#include "download.h"
+#include "tlog.h"
+#include "watchdog.h"
+
+// seconds a camera call may take before the watchdog cancels it
+#define TIMEOUT_DOWNLOAD 60
+#define TIMEOUT_INFO     15
+
+// attempts at a file that arrives short
+#define DOWNLOAD_TRIES 2
+
+// downloads in flight at once, the capture thread and the rig workers
+#define POOL_SIZE 8
+
+// where the handler puts the bytes libgphoto2 hands it
+struct Sink
+{
+    int fd;
+    int parsing;
+    struct ExifParser *parser;
+    struct Transfer *t;
+};
+
+// what went over usb since download_reset(), per kind of file; the rig
+// workers download at the same time, so the counters are atomic
+struct Traffic
+{
+    long files;
+    long long bytes;
+    long long usecs;
+};
+
+// a file object bound to its sink, made at the first download through
+// it and kept, so later frames cost no allocation
+struct Slot
+{
+    CameraFile *file;
+    struct Sink sink;
+    int busy;
+};
+
+static struct Traffic traffic[3];   // full files, previews, exif blocks
+static long long card_bytes = 0;    // the full files of all frames
+
+static struct Slot pool[POOL_SIZE];
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//-----------------------------------------------------------------------------
+
+static int sink_size(void *priv, uint64_t *size)
+{
+    *size = ((struct Sink *) priv)->t->bytes;
+    return GP_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+static int sink_read(void *priv, unsigned char *data, uint64_t *len)
+{
+    return GP_ERROR_NOT_SUPPORTED;
+}
+
+//-----------------------------------------------------------------------------
+// one pass over the data: checksum, exif, disk
+static int sink_write(void *priv, unsigned char *data, uint64_t *len)
+{
+    struct Sink *s = (struct Sink *) priv;
+    uint64_t done = 0;
+    ssize_t n;
+    int ret;
+
+    s->t->crc = crc32c(s->t->crc, data, *len);
+
+    if (s->parsing)
+    {
+        ret = exif_feed(s->parser, data, *len, &s->t->exif);
+        if (ret != 0)
+        {
+            s->parsing = 0;
+            s->t->has_exif = (ret > 0);
+        }
+    }
+
+    while (s->fd >= 0 && done < *len)
+    {
+        n = write(s->fd, data + done, *len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            tlog_error("download: %s\n", n < 0 ? strerror(errno) : "short write");
+            return GP_ERROR_IO_WRITE;
+        }
+        done += n;
+    }
+
+    s->t->bytes += *len;
+    return GP_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+static CameraFileHandler handler = { sink_size, sink_read, sink_write };
+
+static void give(struct Slot *s)
+{
+    pthread_mutex_lock(&pool_mutex);
+    s->busy = 0;
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+//-----------------------------------------------------------------------------
+// a free slot, or NULL when all are taken
+static struct Slot *take(void)
+{
+    struct Slot *s = NULL;
+    int i;
+
+    pthread_mutex_lock(&pool_mutex);
+    for (i = 0; i < POOL_SIZE && s == NULL; i++)
+        if (!pool[i].busy)
+            s = &pool[i];
+    if (s != NULL)
+        s->busy = 1;
+    pthread_mutex_unlock(&pool_mutex);
+
+    if (s != NULL && s->file == NULL && gp_file_new_from_handler(&s->file, &handler, &s->sink) < GP_OK) 
+    {
+        s->file = NULL;
+        give(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+//-----------------------------------------------------------------------------
+// sizes of the full file and of what we'll fetch, -1 where the camera
+// doesn't say
+static void camera_sizes(Camera *camera, GPContext *context, const CameraFilePath *path, CameraFileType type,
+                         long long *full, long long *expect)
+{
+    CameraFileInfo info;
+    int ret;
+
+    *full = *expect = -1;
+
+    watchdog_arm("gp_camera_file_get_info", TIMEOUT_INFO);
+    ret = gp_camera_file_get_info(camera, path->folder, path->name, &info, context);
+    watchdog_disarm(ret);
+    if (ret < GP_OK)
+        return;
+
+    if (info.file.fields & GP_FILE_INFO_SIZE)
+        *full = info.file.size;
+
+    if (type == GP_FILE_TYPE_NORMAL)
+        *expect = *full;
+    else if (type == GP_FILE_TYPE_PREVIEW && (info.preview.fields & GP_FILE_INFO_SIZE))
+        *expect = info.preview.size;
+}
+
+//-----------------------------------------------------------------------------
+
+static int fetch(Camera *camera, GPContext *context, const CameraFilePath *path, CameraFileType type,
+                 const char *local, struct ExifParser *parser, struct Transfer *t)
+{
+    struct Slot *slot, spare;
+    struct Sink *sink;
+    int ret;
+
+    t->bytes = 0;
+    t->crc = 0;
+    t->has_exif = 0;
+    memset(&t->exif, 0, sizeof(t->exif));
+
+    // more downloads than slots get a file object of their own
+    slot = take();
+    if (slot == NULL)
+    {
+        slot = &spare;
+        ret = gp_file_new_from_handler(&spare.file, &handler, &spare.sink);
+        if (ret < GP_OK)
+            return ret;
+    }
+    sink = &slot->sink;
+
+    sink->fd = -1;
+    if (local != NULL)
+    {
+        sink->fd = open(local, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+        if (sink->fd < 0)
+        {
+            tlog_error("%s: %s\n", local, strerror(errno));
+            ret = GP_ERROR_IO_WRITE;
+            goto out;
+        }
+    }
+
+    sink->parser = parser;
+    sink->parsing = (parser != NULL);
+    sink->t = t;
+    if (parser != NULL)
+        exif_begin(parser);
+
+    watchdog_arm("gp_camera_file_get", TIMEOUT_DOWNLOAD);
+    ret = gp_camera_file_get(camera, path->folder, path->name, type, slot->file, context);
+    watchdog_disarm(ret);
+
+    // a small tiff ends before the parser has seen enough to stop
+    if (sink->parsing)
+        t->has_exif = (exif_end(parser, &t->exif) > 0);
+
+    if (sink->fd >= 0 && close(sink->fd) < 0 && ret >= GP_OK)
+    {
+        tlog_error("%s: %s\n", local, strerror(errno));
+        ret = GP_ERROR_IO_WRITE;
+    }
+
+out:
+    if (slot == &spare)
+        gp_file_free(spare.file);
+    else
+        give(slot);
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+
+static void count(CameraFileType type, long long bytes, const struct timeval *start)
+{
+    struct Traffic *tr;
+    struct timeval now;
+
+    if (type == GP_FILE_TYPE_NORMAL)
+        tr = &traffic[0];
+    else if (type == GP_FILE_TYPE_PREVIEW)
+        tr = &traffic[1];
+    else
+        tr = &traffic[2];
+
+    gettimeofday(&now, NULL);
+    __atomic_fetch_add(&tr->files, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&tr->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&tr->usecs, (now.tv_sec - start->tv_sec) * 1000000LL + now.tv_usec - start->tv_usec,
+                       __ATOMIC_RELAXED);
+}
+
+//-----------------------------------------------------------------------------
+
+int download_file(Camera *camera, GPContext *context, const CameraFilePath *path, CameraFileType type,
+                  const char *local, struct ExifParser *parser, struct Transfer *t)
+{
+    struct timeval start;
+    long long expect;
+    int i, ret = GP_OK;
+
+    // libgphoto2 keeps the object info from the capture, no usb traffic
+    camera_sizes(camera, context, path, type, &t->card_bytes, &expect);
+
+    for (i = 0; i < DOWNLOAD_TRIES; i++)
+    {
+        gettimeofday(&start, NULL);
+        ret = fetch(camera, context, path, type, local, parser, t);
+        count(type, t->bytes, &start);
+        if (ret < GP_OK)
+        {
+            if (ret != GP_ERROR_NOT_SUPPORTED)
+                tlog_error("gp_camera_file_get() failed: %d\n", ret);
+            break;
+        }
+
+        if (expect < 0 || t->bytes == expect)
+            break;
+
+        tlog_error("%s/%s: %lld of %lld bytes arrived\n", path->folder, path->name, t->bytes, expect);
+        ret = GP_ERROR_CORRUPTED_DATA;
+    }
+
+    if (ret < GP_OK && local != NULL)
+        unlink(local);
+
+    // a frame's full file is counted once, however much of it we fetch
+    if (ret >= GP_OK && type != GP_FILE_TYPE_EXIF && t->card_bytes > 0)
+        __atomic_fetch_add(&card_bytes, t->card_bytes, __ATOMIC_RELAXED);
+
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+
+int download_path(char *local, size_t len, const char *dir, const char *prefix,
+                  const CameraFilePath *path, CameraFileType type)
+{
+    const char *ext;
+    int n;
+
+    if (type != GP_FILE_TYPE_PREVIEW)
+        return (snprintf(local, len, "%s/%s%s", dir, prefix, path->name) < (int) len) ? 0 : -1;
+
+    // IMG_0001.CR2 -> IMG_0001_preview.jpg
+    ext = strrchr(path->name, '.');
+    n = (ext != NULL) ? (int) (ext - path->name) : (int) strlen(path->name);
+    return (snprintf(local, len, "%s/%s%.*s_preview.jpg", dir, prefix, n, path->name) < (int) len) ? 0 : -1;
+}
+
+//-----------------------------------------------------------------------------
+
+void download_reset(void)
+{
+    memset(traffic, 0, sizeof(traffic));
+    card_bytes = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+void download_report(void)
+{
+    static const char *kinds[] = { "full files", "previews", "exif blocks" };
+    long long total = 0;
+    int i;
+
+    for (i = 0; i < 3; i++)
+    {
+        if (traffic[i].files == 0)
+            continue;
+
+        total += traffic[i].bytes;
+        tlog_info("Transfer: %ld %s, %.1f MB, %.1f KB and %.1f ms each, %.2f MB/s\n",
+                  traffic[i].files, kinds[i], traffic[i].bytes / 1048576.0,
+                  traffic[i].bytes / 1024.0 / traffic[i].files, traffic[i].usecs / 1e3 / traffic[i].files,
+                  traffic[i].usecs > 0 ? traffic[i].bytes / 1048576.0 / (traffic[i].usecs / 1e6) : 0.0);
+    }
+
+    // what the frames would have cost in full
+    if (total > 0 && card_bytes > total)
+        tlog_info("Transfer: %.1f MB over usb for %.1f MB on the card, %.0fx less\n",
+                  total / 1048576.0, card_bytes / 1048576.0, (double) card_bytes / total);
+}
@@ -0,0 +1,36 @@
+#ifndef __DOWNLOAD_H__
+#define __DOWNLOAD_H__
+
+#include <stdint.h>
+#include <gphoto2/gphoto2-camera.h>
+
+#include "exif.h"
+
+// what came over the wire for one file
+struct Transfer
+{
+    long long bytes;
+    long long card_bytes;  // the full file on the card, -1 if unknown
+    uint32_t crc;          // crc32c of the bytes as they arrived
+    int has_exif;
+    struct Exif exif;
+};
+
+// copies 'path' from the camera into 'local', checksumming the bytes on
+// their way to the disk and, given a 'parser', reading the exif block
+// from them too. A file shorter than the camera says is fetched once
+// more, then given up with GP_ERROR_CORRUPTED_DATA. 'type' is the full
+// file, its preview or its exif block; a NULL 'local' only parses
+int  download_file(Camera *camera, GPContext *context, const CameraFilePath *path, CameraFileType type,
+                   const char *local, struct ExifParser *parser, struct Transfer *t);
+
+// where a download of 'type' goes: 'dir'/'prefix'<name>, previews as
+// <name without extension>_preview.jpg; -1 if it doesn't fit in 'len'
+int  download_path(char *local, size_t len, const char *dir, const char *prefix,
+                   const CameraFilePath *path, CameraFileType type);
+
+// usb traffic since the reset, per kind of file
+void download_reset(void);
+void download_report(void);
+
+#endif
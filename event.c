@@ -6,25 +6,31 @@
 #include "event.h"
 #include "lcd.h"
 #include "camera.h"
+#include "config.h"
+#include "ctl.h"
+#include "status.h"
+#include "prof.h"
+#include "tlog.h"
 #include "ui.h"
 
 // program state
 static int prog_state = S_MENU;
 
-// timelapse settings
-long glob_interval = 0;
-long glob_delay = 0;
-long glob_frames = 0;
+static const char *modes[] = { "Interval", "Motion  ", "Bracket " };
+static const int n_modes = sizeof(modes)/sizeof(char *);
 
 static struct Event    event;
 static pthread_mutex_t mutex; 
 static pthread_cond_t  cond;
+
+// requests of an EV_COMMAND, 'done' is signalled when they are handled
+static struct CtlMsg  *commands;
+static pthread_cond_t  done;
  
 //-----------------------------------------------------------------------------
 // changes the program state:  
 void change_state(int state) 
 {
-    lcd_clear();
     prog_state = state;
 
     struct Event ev;
@@ -33,25 +39,30 @@ void change_state(int state)
     switch (state) 
     {
     case S_MENU: 
-        lcd_puts("Timelapse!");
+        user_title("Timelapse!");
         user_menu(ev);
         break;
 
     case S_INTERVAL:
-        lcd_puts("Interval  ");    
+        user_title("Interval  ");    
         user_timer(&glob_interval, ev);
         break;    
 
     case S_DELAY: 
-        lcd_puts("Delay     ");    
+        user_title("Delay     ");    
         user_timer(&glob_delay, ev);
         break;
 
     case S_FRAMES: 
-        lcd_puts("Frames    ");    
+        user_title("Frames    ");    
         user_number(&glob_frames, ev);
         break;
 
+    case S_MODE: 
+        user_title("Mode      ");    
+        user_choice(&glob_mode, modes, n_modes, ev);
+        break;
+
     case S_RUNNING: 
 
         if (glob_interval == 0)
@@ -62,29 +73,124 @@ void change_state(int state)
 
         if (timelapse_start() < 0) 
         {
-            lcd_clear();           
-            lcd_puts("CAMERA ERROR!"); 
+            user_title("CAMERA ERROR!"); 
             prog_state = S_MENU;
             user_menu(ev);     
         }
 
         break;
     } 
+
+    status_begin()->state = prog_state;
+    status_end();
 }
 
 
+//-----------------------------------------------------------------------------
+// settings can change while nothing runs, the screen follows them
+static int set_value(long *target, long value, long maxval)
+{
+    if (prog_state == S_RUNNING) 
+        return CTL_EBUSY;
+
+    if (value < 0 || value > maxval)
+        return CTL_EINVAL;
+
+    *target = value;
+    change_state(prog_state);
+    return CTL_OK;
+}
+
+//-----------------------------------------------------------------------------
+// control requests take the same paths as the encoder
+static void run_command(struct CtlMsg *msg)
+{
+    switch (msg->op) 
+    {
+    case CTL_PING:
+    case CTL_STATUS:
+    case CTL_SUBSCRIBE:
+        msg->status = CTL_OK;
+        break;
+
+    case CTL_SET_INTERVAL:
+        msg->status = (msg->value == 0) ? CTL_EINVAL : set_value(&glob_interval, msg->value, 359999);
+        break;
+
+    case CTL_SET_DELAY:
+        msg->status = set_value(&glob_delay, msg->value, 359999);
+        break;
+
+    case CTL_SET_FRAMES:
+        msg->status = set_value(&glob_frames, msg->value, 99999);
+        break;
+
+    case CTL_SET_MODE:
+        msg->status = set_value(&glob_mode, msg->value, n_modes - 1);
+        break;
+
+    case CTL_START:
+        if (prog_state == S_RUNNING) 
+        {
+            msg->status = CTL_EBUSY;
+            break;
+        }
+        if (glob_interval == 0) 
+        {
+            msg->status = CTL_EINVAL;
+            break;
+        }
+        change_state(S_RUNNING);
+        msg->status = (prog_state == S_RUNNING) ? CTL_OK : CTL_EFAIL;
+        break;
+
+    case CTL_STOP:
+        // as if the button was pressed while running
+        msg->status = CTL_OK;
+        if (prog_state == S_RUNNING) 
+        {
+            lcd_fadeout();
+            lcd_screen("Stopping", NULL);
+            timelapse_stop();
+            change_state(S_MENU);
+        }
+        break;
+
+    default:
+        msg->status = CTL_EINVAL;
+        break;
+    }
+}
+
 //-----------------------------------------------------------------------------
 // centralized event handler:
 void process_events()
 {
+    int i;
+
     while (1)
     {
         // protect glob_encoder_event
         pthread_mutex_lock(&mutex);
 
         // if there isn't event to process then wait
-        while (event.type == EV_NONE)
+        while (event.type == EV_NONE) 
+        {
             pthread_cond_wait(&cond, &mutex);
+            prof_wakeup();
+        }
+
+        if (event.type == EV_COMMAND) 
+        {
+            for (i = 0; i < event.value; i++)
+                run_command(&commands[i]);
+
+            commands = NULL;
+            event.type = EV_NONE;
+            pthread_cond_broadcast(&done);
+            pthread_mutex_unlock(&mutex); 
+            continue;
+        }
 
         lcd_fadeout();
 
@@ -105,12 +211,15 @@ void process_events()
         case S_FRAMES:
             user_number(&glob_frames, event);
             break;
+
+        case S_MODE:
+            user_choice(&glob_mode, modes, n_modes, event);
+            break;
         
         case S_RUNNING:
             if (event.type == EV_BUTTON) 
             {   
-                lcd_clear();
-                lcd_puts("Stopping");
+                lcd_screen("Stopping", NULL);
                 timelapse_stop();
                 change_state(S_MENU);
             }
@@ -119,6 +228,7 @@ void process_events()
         }
 
         event.type = EV_NONE;
+        pthread_cond_broadcast(&done);
 
         // release event flag
         pthread_mutex_unlock(&mutex); 
@@ -134,37 +244,77 @@ void generate_event(struct Event ev)
     ret = pthread_mutex_trylock(&mutex);
     if (ret == 0)
     {
-        event = ev;
+        // a command waiting to be handled isn't replaced
+        if (event.type != EV_COMMAND)
+            event = ev;
         pthread_cond_signal(&cond);   // wake up event handler
         pthread_mutex_unlock(&mutex); // release ev_type
     }
     else if (ret != EBUSY) 
     {
-        printf("pthread_mutex_trylock() failed, retval=%d\n", ret); 
+        tlog_error("pthread_mutex_trylock() failed, retval=%d\n", ret); 
     }
 }
 
+//-----------------------------------------------------------------------------
+void post_commands(struct CtlMsg *msgs, int n) 
+{
+    pthread_mutex_lock(&mutex);
+
+    // unlike encoder events, requests wait for their turn
+    while (event.type != EV_NONE)
+        pthread_cond_wait(&done, &mutex);
+
+    commands = msgs;
+    event.type = EV_COMMAND;
+    event.value = n;
+    pthread_cond_signal(&cond);
+
+    while (commands != NULL)
+        pthread_cond_wait(&done, &mutex);
+
+    pthread_mutex_unlock(&mutex);
+}
+
 //-----------------------------------------------------------------------------
 int main(int argc, char *argv[])
 {
+    // settings from the file given, the built-in ones otherwise
+    if (argc > 1 && config_load(argv[1]) < 0)
+        return 1;
+
+    // before any thread it should count is started
+    prof_enable(glob_profile);
+    prof_thread("event");
+
     if (gpioInitialise()<0) return 1;
 
     // initialize mutex and condition variable object
     pthread_mutex_init(&mutex, NULL);
     pthread_cond_init(&cond, NULL);
+    pthread_cond_init(&done, NULL);
 
     encoder_init();
-    lcd_init();
+    lcd_init(glob_lcd, glob_lcd_addr);
+    status_open();
     timelapse_init();
 
-    change_state(S_MENU);
+    // an interrupted run starts again straight away
+    change_state(timelapse_recover() ? S_RUNNING : S_MENU);
+
+    if (glob_ctlsock != NULL)
+        ctl_init(glob_ctlsock);
 
     process_events();
      
     // clean up and exit
+    prof_report("idle");
+    ctl_destroy();
     gpioTerminate();
+    status_close();
     pthread_mutex_destroy(&mutex);
     pthread_cond_destroy(&cond);
+    pthread_cond_destroy(&done);
 
     return 0; 
 }
@@ -4,12 +4,14 @@
 #define EV_NONE    0  // there is no event to process 
 #define EV_PULSE   1  // encoder knob was rotated 
 #define EV_BUTTON  2  // encoder button was pressed 
+#define EV_COMMAND 3  // requests from the control socket
 
 #define S_MENU     0  // display menu
 #define S_INTERVAL 1  // set up interval
 #define S_RUNNING  2  // capture images 
 #define S_DELAY    3  // set up delay before capturing state
 #define S_FRAMES   4  // set up frames value
+#define S_MODE     5  // set up capture mode
 
 enum progstate
 {
@@ -17,7 +19,8 @@ enum progstate
     INTERVAL,
     RUNNING,
     DELAY,
-    FRAMES
+    FRAMES,
+    MODE
 };
 
 struct Event 
@@ -26,7 +29,13 @@ struct Event
     int value;
 };
 
+struct CtlMsg;
+
 void change_state(int state);
 void generate_event(struct Event ev); 
 
+// runs control requests on the event thread, waits until they're done
+// and leaves the replies in 'msgs'
+void post_commands(struct CtlMsg *msgs, int n);
+
 #endif
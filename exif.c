@@ -0,0 +1,347 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "exif.h"
+
+#define S_START   0  // the first 4 bytes tell jpeg from tiff
+#define S_MARKER  1  // ff, type and length of a jpeg segment
+#define S_SKIP    2  // a segment we don't need
+#define S_APP1    3  // buffering an app1 segment
+#define S_TIFF    4  // buffering the head of a raw file
+#define S_BLOB    5  // buffering a bare exif block
+#define S_DONE    6
+#define S_NONE    7
+
+// tags
+#define TAG_EXIF_IFD    0x8769
+#define TAG_EXPOSURE    0x829a
+#define TAG_FNUMBER     0x829d
+#define TAG_ISO         0x8827
+#define TAG_BRIGHTNESS  0x9203
+
+// types
+#define TYPE_SHORT      3
+#define TYPE_LONG       4
+#define TYPE_RATIONAL   5
+#define TYPE_SRATIONAL 10
+
+// calibration constant of reflected light meters
+#define METER_K 12.5
+
+struct Tiff
+{
+    const uint8_t *p;
+    size_t size;
+    int big;        // motorola byte order
+};
+
+//-----------------------------------------------------------------------------
+
+// offsets come from the file: compared so that none near the top of a
+// 32-bit size_t can wrap past the check
+static int u16(const struct Tiff *t, size_t off, uint32_t *v)
+{
+    if (off > t->size || t->size - off < 2) return -1;
+
+    *v = t->big ? (t->p[off] << 8 | t->p[off + 1]) : (t->p[off + 1] << 8 | t->p[off]);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+static int u32(const struct Tiff *t, size_t off, uint32_t *v)
+{
+    const uint8_t *b;
+
+    if (off > t->size || t->size - off < 4) return -1;
+
+    b = t->p + off;
+    if (t->big)
+        *v = (uint32_t) b[0] << 24 | b[1] << 16 | b[2] << 8 | b[3];
+    else
+        *v = (uint32_t) b[3] << 24 | b[2] << 16 | b[1] << 8 | b[0];
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// a rational stored at 'off', 0 if it's out of the buffer or undefined
+static double rational(const struct Tiff *t, size_t off, int sign)
+{
+    uint32_t num, den;
+
+    // 'off' is in the buffer once the first read succeeds, 'off + 4' can't wrap
+    if (u32(t, off, &num) < 0 || u32(t, off + 4, &den) < 0 || den == 0)
+        return 0;
+
+    if (sign)
+        return (double) (int32_t) num / (int32_t) den;
+    return (double) num / den;
+}
+
+//-----------------------------------------------------------------------------
+// reads the tags we want from the ifd at 'off', follows the exif ifd once
+static void parse_ifd(const struct Tiff *t, uint32_t off, int depth, struct Exif *exif)
+{
+    uint32_t n, i, tag, type, count, value, sub = 0;
+    size_t e;
+
+    if (u16(t, off, &n) < 0)
+        return;
+
+    for (i = 0; i < n; i++)
+    {
+        // u16() above put 'off + 2' inside the buffer
+        if ((size_t) i * 12 > t->size - off - 2)
+            return;
+        e = off + 2 + (size_t) i * 12;
+        if (u16(t, e, &tag) < 0 || u16(t, e + 2, &type) < 0 ||
+            u32(t, e + 4, &count) < 0 || u32(t, e + 8, &value) < 0)
+            return;
+
+        // values of up to 4 bytes are stored in the entry itself
+        if (type == TYPE_SHORT && count >= 1)
+            u16(t, e + 8, &value);
+
+        switch (tag)
+        {
+        case TAG_EXIF_IFD:
+            sub = value;
+            break;
+
+        case TAG_EXPOSURE:
+            if (type == TYPE_RATIONAL)
+                exif->exposure = rational(t, value, 0);
+            break;
+
+        case TAG_FNUMBER:
+            if (type == TYPE_RATIONAL)
+                exif->aperture = rational(t, value, 0);
+            break;
+
+        case TAG_ISO:
+            if (type == TYPE_SHORT || type == TYPE_LONG)
+                exif->iso = value;
+            break;
+
+        case TAG_BRIGHTNESS:
+            if (type == TYPE_SRATIONAL && u32(t, value, &count) == 0 &&
+                u32(t, value + 4, &count) == 0 && count != 0)
+            {
+                exif->brightness = rational(t, value, 1);
+                exif->has_brightness = 1;
+            }
+            break;
+        }
+    }
+
+    if (sub != 0 && sub != off && depth == 0)
+        parse_ifd(t, sub, 1, exif);
+}
+
+//-----------------------------------------------------------------------------
+// 'p' starts with a tiff header, offsets are relative to it
+static int parse_tiff(const uint8_t *p, size_t size, struct Exif *exif)
+{
+    struct Tiff t;
+    uint32_t magic, ifd;
+
+    memset(exif, 0, sizeof(*exif));
+
+    if (size < 8 || p[0] != p[1] || (p[0] != 'I' && p[0] != 'M'))
+        return -1;
+
+    t.p = p;
+    t.size = size;
+    t.big = (p[0] == 'M');
+
+    if (u16(&t, 2, &magic) < 0 || magic != 42 || u32(&t, 4, &ifd) < 0)
+        return -1;
+
+    parse_ifd(&t, ifd, 0, exif);
+    return 1;
+}
+
+//-----------------------------------------------------------------------------
+
+void exif_begin(struct ExifParser *p)
+{
+    p->state = S_START;
+    p->need = 4;
+    p->have = 0;
+}
+
+//-----------------------------------------------------------------------------
+// fills 'head' up to 'need' bytes, returns the bytes taken
+static size_t collect(struct ExifParser *p, const uint8_t *data, size_t len)
+{
+    size_t n = p->need - p->have;
+
+    if (n > len) n = len;
+    memcpy(p->head + p->have, data, n);
+    p->have += n;
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+
+static int finish_app1(struct ExifParser *p, struct Exif *exif)
+{
+    // other app1 segments hold xmp, the exif one may come after them
+    if (p->have < 6 || memcmp(p->buf, "Exif\0\0", 6) != 0)
+    {
+        p->state = S_MARKER;
+        p->need = 4;
+        p->have = 0;
+        return 0;
+    }
+
+    p->state = (parse_tiff(p->buf + 6, p->have - 6, exif) > 0) ? S_DONE : S_NONE;
+    return (p->state == S_DONE) ? 1 : -1;
+}
+
+//-----------------------------------------------------------------------------
+
+int exif_feed(struct ExifParser *p, const uint8_t *data, size_t len, struct Exif *exif)
+{
+    size_t n;
+    uint32_t seg;
+
+    while (len > 0)
+    {
+        switch (p->state)
+        {
+        case S_START:
+            n = collect(p, data, len);
+            data += n; len -= n;
+            if (p->have < 4) break;
+
+            if (p->head[0] == 0xff && p->head[1] == 0xd8)
+            {
+                // the soi marker, the next two bytes start a segment
+                p->head[0] = p->head[2];
+                p->head[1] = p->head[3];
+                p->have = 2;
+                p->state = S_MARKER;
+            }
+            else if (p->head[0] == 0xff)
+            {
+                // a segment without the soi, as some drivers hand out app1
+                p->state = S_MARKER;
+            }
+            else if ((p->head[0] == 'I' && p->head[1] == 'I' && p->head[2] == 42 && p->head[3] == 0) ||
+                     (p->head[0] == 'M' && p->head[1] == 'M' && p->head[2] == 0 && p->head[3] == 42))
+            {
+                memcpy(p->buf, p->head, 4);
+                p->have = 4;
+                p->state = S_TIFF;
+            }
+            else if (memcmp(p->head, "Exif", 4) == 0)
+            {
+                // the payload of an app1 segment, GP_FILE_TYPE_EXIF
+                memcpy(p->buf, p->head, 4);
+                p->have = 4;
+                p->state = S_BLOB;
+            }
+            else
+            {
+                p->state = S_NONE;
+            }
+            break;
+
+        case S_MARKER:
+            n = collect(p, data, len);
+            data += n; len -= n;
+            if (p->have < 4) break;
+
+            seg = p->head[2] << 8 | p->head[3];
+
+            // the image data, or something that isn't a jpeg after all
+            if (p->head[0] != 0xff || p->head[1] == 0xda || p->head[1] == 0xd9 || seg < 2)
+            {
+                p->state = S_NONE;
+                break;
+            }
+
+            p->need = seg - 2;
+            p->have = 0;
+            p->state = (p->head[1] == 0xe1) ? S_APP1 : S_SKIP;
+            if (p->state == S_APP1 && p->need == 0 && finish_app1(p, exif) != 0)
+                return (p->state == S_DONE) ? 1 : -1;
+            break;
+
+        case S_SKIP:
+            n = (len < p->need) ? len : p->need;
+            data += n; len -= n;
+            p->need -= n;
+            if (p->need == 0)
+            {
+                p->state = S_MARKER;
+                p->need = 4;
+                p->have = 0;
+            }
+            break;
+
+        case S_APP1:
+            // a segment length fits in 16 bits, so does 'buf'
+            n = (len < p->need) ? len : p->need;
+            memcpy(p->buf + p->have, data, n);
+            data += n; len -= n;
+            p->have += n;
+            p->need -= n;
+            if (p->need == 0 && finish_app1(p, exif) != 0)
+                return (p->state == S_DONE) ? 1 : -1;
+            break;
+
+        case S_TIFF:
+        case S_BLOB:
+            n = EXIF_MAX - p->have;
+            if (n > len) n = len;
+            memcpy(p->buf + p->have, data, n);
+            data += n; len -= n;
+            p->have += n;
+            if (p->have == EXIF_MAX)
+                return exif_end(p, exif);
+            break;
+
+        case S_DONE:
+            return 1;
+
+        default:
+            return -1;
+        }
+    }
+
+    if (p->state == S_DONE) return 1;
+    if (p->state == S_NONE) return -1;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int exif_end(struct ExifParser *p, struct Exif *exif)
+{
+    if (p->state == S_TIFF)
+        p->state = (parse_tiff(p->buf, p->have, exif) > 0) ? S_DONE : S_NONE;
+    else if (p->state == S_BLOB && finish_app1(p, exif) == 0)
+        p->state = S_NONE;
+    else if (p->state != S_DONE)
+        p->state = S_NONE;
+
+    return (p->state == S_DONE) ? 1 : -1;
+}
+
+//-----------------------------------------------------------------------------
+
+double exif_luminance(const struct Exif *exif)
+{
+    // the exposure equation with apex Sv = log2(iso / 3.125)
+    if (exif->has_brightness)
+        return METER_K / 3.125 * pow(2, exif->brightness);
+
+    if (exif->exposure > 0 && exif->aperture > 0 && exif->iso > 0)
+        return METER_K * exif->aperture * exif->aperture / (exif->exposure * exif->iso);
+
+    return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef __EXIF_H__
+#define __EXIF_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// the exif block is at most one jpeg segment, raw files keep theirs in
+// the first tiff ifds
+#define EXIF_MAX 65536
+
+// exposure settings of a frame, 0 where the file doesn't say
+struct Exif
+{
+    double exposure;    // seconds
+    double aperture;    // f-number
+    long iso;
+    double brightness;  // apex Bv as metered by the camera
+    int has_brightness;
+};
+
+// parses a jpeg or tiff-based raw as its bytes arrive, buffering only the
+// exif segment and skipping everything else
+struct ExifParser
+{
+    int state;
+    size_t need;        // bytes left of the current segment
+    size_t have;        // bytes in 'head' or 'buf'
+    uint8_t head[4];
+    uint8_t buf[EXIF_MAX];
+};
+
+void exif_begin(struct ExifParser *p);
+
+// returns 0 while it wants more bytes, 1 once 'exif' is filled and -1 if
+// there's no exif block before the image data
+int  exif_feed(struct ExifParser *p, const uint8_t *data, size_t len, struct Exif *exif);
+
+// the stream ended, parses what a short tiff file left in the buffer
+int  exif_end(struct ExifParser *p, struct Exif *exif);
+
+// scene luminance in cd/m^2 from the metered brightness, or from the
+// exposure the camera chose for it
+double exif_luminance(const struct Exif *exif);
+
+#endif
@@ -0,0 +1,205 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "exif.h"
+#include "frameidx.h"
+#include "tlog.h"
+
+// records the file grows by
+#define FRAMEIDX_GROW 4096
+
+static int fd = -1;
+static struct FrameIndexHeader *header = NULL;
+static struct FrameRecord *records;
+static size_t map_size = 0;
+
+//-----------------------------------------------------------------------------
+
+static int map(uint64_t capacity)
+{
+    size_t size = sizeof(struct FrameIndexHeader) + capacity * sizeof(struct FrameRecord);
+    void *p;
+
+    if (header != NULL)
+    {
+        munmap(header, map_size);
+        header = NULL;
+    }
+
+    if (ftruncate(fd, size) < 0)
+    {
+        tlog_error("frameidx: %s\n", strerror(errno));
+        return -1;
+    }
+
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        tlog_error("frameidx mmap: %s\n", strerror(errno));
+        return -1;
+    }
+
+    header = (struct FrameIndexHeader *) p;
+    records = (struct FrameRecord *) (header + 1);
+    map_size = size;
+    header->capacity = capacity;
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int frameidx_open(const char *path, int reset, time_t start)
+{
+    struct FrameIndexHeader h;
+    struct stat st;
+    int valid;
+
+    frameidx_close();
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        tlog_error("%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    valid = (fstat(fd, &st) == 0 && pread(fd, &h, sizeof(h), 0) == sizeof(h) &&
+             memcmp(h.magic, FRAMEIDX_MAGIC, sizeof(h.magic)) == 0 &&
+             h.version == FRAMEIDX_VERSION && h.record_size == sizeof(struct FrameRecord) &&
+             h.count <= h.capacity && h.start == start &&
+             (uint64_t) st.st_size == sizeof(h) + h.capacity * sizeof(struct FrameRecord));
+
+    if (!valid || reset)
+    {
+        memset(&h, 0, sizeof(h));
+        h.capacity = FRAMEIDX_GROW;
+    }
+
+    if (map(h.capacity) < 0)
+    {
+        close(fd);
+        fd = -1;
+        return -1;
+    }
+
+    if (!valid || reset)
+    {
+        memset(header, 0, sizeof(*header));
+        memcpy(header->magic, FRAMEIDX_MAGIC, sizeof(header->magic));
+        header->version = FRAMEIDX_VERSION;
+        header->record_size = sizeof(struct FrameRecord);
+        header->capacity = FRAMEIDX_GROW;
+        header->start = start;
+    }
+    else
+    {
+        tlog_info("Frame index: continuing after %llu records\n", (unsigned long long) header->count);
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+void frameidx_close(void)
+{
+    if (header != NULL)
+    {
+        msync(header, map_size, MS_SYNC);
+        munmap(header, map_size);
+        header = NULL;
+    }
+
+    if (fd >= 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+int frameidx_add(long frame, const struct timeval *due, const struct timeval *taken,
+                 const char *folder, const char *name, const char *local, 
+                 long long size, uint32_t crc, const struct Exif *exif)
+{
+    struct FrameRecord *r;
+    uint64_t n;
+
+    if (header == NULL) return -1;
+
+    n = header->count;
+    if (n == header->capacity && map(n + FRAMEIDX_GROW) < 0)
+        return -1;
+
+    r = &records[n];
+    memset(r, 0, sizeof(*r));
+    r->frame = frame;
+    r->scheduled_us = (int64_t) due->tv_sec * 1000000 + due->tv_usec;
+    r->taken_us = (int64_t) taken->tv_sec * 1000000 + taken->tv_usec;
+
+    // longer names are cut, the record stays fixed
+    snprintf(r->camera, sizeof(r->camera), "%s/%s", folder, name);
+
+    snprintf(r->local, sizeof(r->local), "%s", local);
+    r->size = size;
+    r->crc = crc;
+
+    if (exif != NULL)
+    {
+        r->exposure = exif->exposure;
+        r->aperture = exif->aperture;
+        r->iso = exif->iso;
+        r->luminance = exif_luminance(exif);
+    }
+
+    // the record is complete before the count makes it visible
+    __atomic_store_n(&header->count, n + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// a frame's records are the last ones when its post-processing runs
+void frameidx_flag(long frame, uint32_t flags)
+{
+    uint64_t i;
+
+    if (header == NULL) return;
+
+    for (i = header->count; i > 0 && records[i - 1].frame >= frame; i--)
+    {
+        if (records[i - 1].frame == frame)
+            records[i - 1].flags |= flags;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// frame numbers only grow within a run; the record moves when the file
+// grows, so it's good until the next frameidx_add()
+const struct FrameRecord *frameidx_find(long frame)
+{
+    uint64_t lo = 0, hi, mid;
+
+    if (header == NULL) return NULL;
+
+    hi = header->count;
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (records[mid].frame < frame)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return (lo < header->count && records[lo].frame == frame) ? &records[lo] : NULL;
+}
@@ -0,0 +1,62 @@
+#ifndef __FRAMEIDX_H__
+#define __FRAMEIDX_H__
+
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "exif.h"
+
+// one fixed-size record per shot, appended during the run to a file that
+// tools map read-only (see lapseidx.c) instead of opening the images
+#define FRAMEIDX_MAGIC    "RLFIDX1"
+#define FRAMEIDX_VERSION  2
+
+// record flags
+#define FRAME_DUPLICATE   1  // the perceptual hash matched a recent frame
+#define FRAME_DROPPED     2  // deleted as a duplicate
+
+struct FrameIndexHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t count;     // records written, readers take no more
+    uint64_t capacity;  // records the file can hold
+    int64_t start;      // slot of the first frame of the run
+    uint8_t pad[24];
+};
+
+struct FrameRecord
+{
+    int64_t frame;
+    int64_t scheduled_us;  // slot the frame was due in
+    int64_t taken_us;      // trigger, same time base
+    int64_t size;          // bytes of the local copy
+    float exposure;        // seconds, 0 if unknown
+    float aperture;        // f-number
+    float luminance;       // cd/m^2, see exif_luminance()
+    int32_t iso;
+    uint32_t flags;
+    uint32_t crc;          // crc32c of the bytes that came from the camera
+    char camera[72];       // folder/name on the card
+    char local[128];       // downloaded copy, empty if none
+};
+
+// maps 'path', an index of the same run is continued unless 'reset' is
+// set; 'start' is the first slot of the run
+int  frameidx_open(const char *path, int reset, time_t start);
+void frameidx_close(void);
+
+// records a shot; 'local' is empty and 'exif' NULL for a frame that
+// stays on the card
+int  frameidx_add(long frame, const struct timeval *due, const struct timeval *taken,
+                  const char *folder, const char *name, const char *local, 
+                  long long size, uint32_t crc, const struct Exif *exif);
+
+// sets 'flags' on the records of 'frame'
+void frameidx_flag(long frame, uint32_t flags);
+
+// the first record of 'frame', NULL if there's none
+const struct FrameRecord *frameidx_find(long frame);
+
+#endif
@@ -0,0 +1,624 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include "image.h"
+#include "hdr.h"
+#include "tlog.h"
+
+// exposures are fused at 1/2 scale: 6 MP out of a 24 MP body
+#define HDR_SCALE      2
+#define HDR_QUALITY   92
+
+#define MAX_EXPOSURES  9
+#define MAX_LEVELS    10
+#define MAX_THREADS    8
+
+// well-exposedness is a gaussian around mid grey
+#define HDR_SIGMA   0.2f
+
+// one float channel, images are kept planar so every kernel is a
+// straight run over a row
+struct Plane
+{
+    int w, h;
+    float *p;
+};
+
+struct Pyramid
+{
+    int levels;
+    struct Plane lv[MAX_LEVELS];
+};
+
+// a row-parallel operation, 'fn' processes rows [y0, y1)
+struct Job
+{
+    void (*fn)(struct Job *job, int y0, int y1);
+    const struct Plane *src;
+    struct Plane *dst;
+    struct Plane *tmp;
+    const struct Image *img;
+    int channel;
+};
+
+struct Slice
+{
+    struct Job *job;
+    int y0, y1;
+};
+
+static float exposedness[256];
+
+//-----------------------------------------------------------------------------
+
+static double elapsed(const struct timeval *start) 
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+//-----------------------------------------------------------------------------
+// vector kernels
+
+// d += a * b
+static void vec_madd(float *d, const float *a, const float *b, int n)
+{
+    int i = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for (; i + 4 <= n; i += 4)
+        vst1q_f32(d + i, vmlaq_f32(vld1q_f32(d + i), vld1q_f32(a + i), vld1q_f32(b + i)));
+#elif defined(__SSE__)
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(d + i, _mm_add_ps(_mm_loadu_ps(d + i), 
+                      _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i))));
+#endif
+
+    for (; i < n; i++)
+        d[i] += a[i] * b[i];
+}
+
+// d = a + s * b, s is 1 or -1
+static void vec_add(float *d, const float *a, const float *b, float s, int n)
+{
+    int i = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    float32x4_t vs = vdupq_n_f32(s);
+    for (; i + 4 <= n; i += 4)
+        vst1q_f32(d + i, vmlaq_f32(vld1q_f32(a + i), vs, vld1q_f32(b + i)));
+#elif defined(__SSE__)
+    __m128 vs = _mm_set1_ps(s);
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(d + i, _mm_add_ps(_mm_loadu_ps(a + i), _mm_mul_ps(vs, _mm_loadu_ps(b + i))));
+#endif
+
+    for (; i < n; i++)
+        d[i] = a[i] + s * b[i];
+}
+
+// d = (r0 + 4 r1 + 6 r2 + 4 r3 + r4) / 16, the binomial 5 tap filter
+static void vec_filter5(float *d, const float *r0, const float *r1, const float *r2, 
+                        const float *r3, const float *r4, int n)
+{
+    int i = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    const float32x4_t k4 = vdupq_n_f32(4), k6 = vdupq_n_f32(6), k16 = vdupq_n_f32(1.0f / 16);
+    for (; i + 4 <= n; i += 4) 
+    {
+        float32x4_t s = vaddq_f32(vld1q_f32(r0 + i), vld1q_f32(r4 + i));
+        s = vmlaq_f32(s, k4, vaddq_f32(vld1q_f32(r1 + i), vld1q_f32(r3 + i)));
+        s = vmlaq_f32(s, k6, vld1q_f32(r2 + i));
+        vst1q_f32(d + i, vmulq_f32(s, k16));
+    }
+#elif defined(__SSE__)
+    const __m128 k4 = _mm_set1_ps(4), k6 = _mm_set1_ps(6), k16 = _mm_set1_ps(1.0f / 16);
+    for (; i + 4 <= n; i += 4) 
+    {
+        __m128 s = _mm_add_ps(_mm_loadu_ps(r0 + i), _mm_loadu_ps(r4 + i));
+        s = _mm_add_ps(s, _mm_mul_ps(k4, _mm_add_ps(_mm_loadu_ps(r1 + i), _mm_loadu_ps(r3 + i))));
+        s = _mm_add_ps(s, _mm_mul_ps(k6, _mm_loadu_ps(r2 + i)));
+        _mm_storeu_ps(d + i, _mm_mul_ps(s, k16));
+    }
+#endif
+
+    for (; i < n; i++)
+        d[i] = (r0[i] + r4[i] + 4 * (r1[i] + r3[i]) + 6 * r2[i]) * (1.0f / 16);
+}
+
+// d = (r0 + 6 r1 + r2) / 8 or, for odd rows, (r1 + r2) / 2 
+static void vec_expand(float *d, const float *r0, const float *r1, const float *r2, int odd, int n)
+{
+    int i = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    const float32x4_t k6 = vdupq_n_f32(6), k8 = vdupq_n_f32(1.0f / 8), k2 = vdupq_n_f32(0.5f);
+    for (; i + 4 <= n; i += 4) 
+    {
+        if (odd)
+            vst1q_f32(d + i, vmulq_f32(vaddq_f32(vld1q_f32(r1 + i), vld1q_f32(r2 + i)), k2));
+        else
+            vst1q_f32(d + i, vmulq_f32(vmlaq_f32(vaddq_f32(vld1q_f32(r0 + i), vld1q_f32(r2 + i)), 
+                                                  k6, vld1q_f32(r1 + i)), k8));
+    }
+#elif defined(__SSE__)
+    const __m128 k6 = _mm_set1_ps(6), k8 = _mm_set1_ps(1.0f / 8), k2 = _mm_set1_ps(0.5f);
+    for (; i + 4 <= n; i += 4) 
+    {
+        if (odd)
+            _mm_storeu_ps(d + i, _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(r1 + i), _mm_loadu_ps(r2 + i)), k2));
+        else
+            _mm_storeu_ps(d + i, _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_loadu_ps(r0 + i), _mm_loadu_ps(r2 + i)), 
+                                                       _mm_mul_ps(k6, _mm_loadu_ps(r1 + i))), k8));
+    }
+#endif
+
+    for (; i < n; i++)
+        d[i] = odd ? (r1[i] + r2[i]) * 0.5f : (r0[i] + r2[i] + 6 * r1[i]) * (1.0f / 8);
+}
+
+//-----------------------------------------------------------------------------
+// row-parallel execution, one band of rows per core
+
+static void *slice_thread(void *arg) 
+{
+    struct Slice *slice = (struct Slice *) arg;
+
+    slice->job->fn(slice->job, slice->y0, slice->y1);
+    return NULL;
+}
+
+static void run(struct Job *job, int rows)
+{
+    struct Slice slices[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    int i, n, started[MAX_THREADS];
+
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) n = 1;
+    if (n > MAX_THREADS) n = MAX_THREADS;
+    if (n > rows) n = rows;
+
+    for (i = 0; i < n; i++) 
+    {
+        slices[i].job = job;
+        slices[i].y0 = rows * i / n;
+        slices[i].y1 = rows * (i + 1) / n;
+    }
+
+    // the last band runs on the calling thread
+    for (i = 0; i < n - 1; i++)
+        started[i] = (pthread_create(&threads[i], NULL, slice_thread, &slices[i]) == 0);
+    slice_thread(&slices[n - 1]);
+
+    for (i = 0; i < n - 1; i++) 
+    {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        else
+            slice_thread(&slices[i]);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+static int plane_alloc(struct Plane *pl, int w, int h) 
+{
+    pl->w = w;
+    pl->h = h;
+    pl->p = calloc((size_t) w * h, sizeof(float));
+    return (pl->p == NULL) ? -1 : 0;
+}
+
+static void pyramid_free(struct Pyramid *pyr) 
+{
+    int l;
+
+    for (l = 0; l < pyr->levels; l++) 
+    {
+        free(pyr->lv[l].p);
+        pyr->lv[l].p = NULL;
+    }
+}
+
+static int clampi(int v, int lo, int hi) 
+{
+    return (v < lo) ? lo : (v > hi) ? hi : v;
+}
+
+//-----------------------------------------------------------------------------
+// pyramid construction
+
+// tmp = src filtered and decimated horizontally
+static void reduce_h(struct Job *job, int y0, int y1) 
+{
+    const struct Plane *s = job->src;
+    struct Plane *t = job->tmp;
+    int x, y, w = s->w - 1;
+
+    for (y = y0; y < y1; y++) 
+    {
+        const float *r = s->p + (size_t) y * s->w;
+        float *d = t->p + (size_t) y * t->w;
+
+        for (x = 0; x < t->w; x++) 
+        {
+            int c = 2 * x;
+            d[x] = (r[clampi(c - 2, 0, w)] + r[clampi(c + 2, 0, w)] + 
+                    4 * (r[clampi(c - 1, 0, w)] + r[clampi(c + 1, 0, w)]) + 6 * r[clampi(c, 0, w)]) * (1.0f / 16);
+        }
+    }
+}
+
+// dst = tmp filtered and decimated vertically
+static void reduce_v(struct Job *job, int y0, int y1) 
+{
+    const struct Plane *t = job->tmp;
+    struct Plane *d = job->dst;
+    int y, h = t->h - 1;
+
+    for (y = y0; y < y1; y++) 
+    {
+        int c = 2 * y;
+        vec_filter5(d->p + (size_t) y * d->w, 
+                    t->p + (size_t) clampi(c - 2, 0, h) * t->w, 
+                    t->p + (size_t) clampi(c - 1, 0, h) * t->w, 
+                    t->p + (size_t) clampi(c, 0, h) * t->w, 
+                    t->p + (size_t) clampi(c + 1, 0, h) * t->w, 
+                    t->p + (size_t) clampi(c + 2, 0, h) * t->w, d->w);
+    }
+}
+
+// tmp = src upsampled vertically
+static void expand_v(struct Job *job, int y0, int y1) 
+{
+    const struct Plane *s = job->src;
+    struct Plane *t = job->tmp;
+    int y, h = s->h - 1;
+
+    for (y = y0; y < y1; y++) 
+    {
+        int i = y / 2;
+        vec_expand(t->p + (size_t) y * t->w, 
+                   s->p + (size_t) clampi(i - 1, 0, h) * s->w, 
+                   s->p + (size_t) i * s->w, 
+                   s->p + (size_t) clampi(i + 1, 0, h) * s->w, y & 1, s->w);
+    }
+}
+
+// dst = tmp upsampled horizontally
+static void expand_h(struct Job *job, int y0, int y1) 
+{
+    const struct Plane *t = job->tmp;
+    struct Plane *d = job->dst;
+    int x, y, w = t->w - 1;
+
+    for (y = y0; y < y1; y++) 
+    {
+        const float *r = t->p + (size_t) y * t->w;
+        float *o = d->p + (size_t) y * d->w;
+
+        for (x = 0; x < d->w; x++) 
+        {
+            int i = x / 2;
+            if (x & 1)
+                o[x] = (r[i] + r[clampi(i + 1, 0, w)]) * 0.5f;
+            else
+                o[x] = (r[clampi(i - 1, 0, w)] + r[clampi(i + 1, 0, w)] + 6 * r[i]) * (1.0f / 8);
+        }
+    }
+}
+
+static int reduce(const struct Plane *src, struct Plane *dst) 
+{
+    struct Plane tmp;
+    struct Job job = { reduce_h, src, dst, &tmp, NULL, 0 };
+
+    if (plane_alloc(&tmp, (src->w + 1) / 2, src->h) < 0 ||
+        plane_alloc(dst, (src->w + 1) / 2, (src->h + 1) / 2) < 0) 
+    {
+        free(tmp.p);
+        return -1;
+    }
+
+    run(&job, src->h);
+    job.fn = reduce_v;
+    run(&job, dst->h);
+
+    free(tmp.p);
+    return 0;
+}
+
+// dst (already allocated at the finer size) = expanded src
+static int expand(const struct Plane *src, struct Plane *dst) 
+{
+    struct Plane tmp;
+    struct Job job = { expand_v, src, dst, &tmp, NULL, 0 };
+
+    if (plane_alloc(&tmp, src->w, dst->h) < 0)
+        return -1;
+
+    run(&job, dst->h);
+    job.fn = expand_h;
+    run(&job, dst->h);
+
+    free(tmp.p);
+    return 0;
+}
+
+// takes ownership of 'base'
+static int gaussian(struct Plane *base, int levels, struct Pyramid *pyr) 
+{
+    int l;
+
+    pyr->levels = 1;
+    pyr->lv[0] = *base;
+
+    for (l = 1; l < levels; l++) 
+    {
+        if (reduce(&pyr->lv[l - 1], &pyr->lv[l]) < 0)
+            return -1;
+        pyr->levels++;
+    }
+
+    return 0;
+}
+
+// turns a gaussian pyramid into a laplacian one, in place
+static int laplacian(struct Pyramid *pyr) 
+{
+    struct Plane up;
+    int l;
+
+    for (l = 0; l < pyr->levels - 1; l++) 
+    {
+        if (plane_alloc(&up, pyr->lv[l].w, pyr->lv[l].h) < 0 || expand(&pyr->lv[l + 1], &up) < 0) 
+        {
+            free(up.p);
+            return -1;
+        }
+        vec_add(pyr->lv[l].p, pyr->lv[l].p, up.p, -1, up.w * up.h);
+        free(up.p);
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// mertens weights: contrast * saturation * well-exposedness
+
+static float grey(const struct Image *img, int x, int y) 
+{
+    const uint8_t *p;
+
+    x = clampi(x, 0, img->width - 1);
+    y = clampi(y, 0, img->height - 1);
+    p = img->pix + ((size_t) y * img->width + x) * 3;
+
+    return (p[0] + p[1] + p[2]) * (1.0f / 765);
+}
+
+static void weights_rows(struct Job *job, int y0, int y1) 
+{
+    const struct Image *img = job->img;
+    struct Plane *d = job->dst;
+    int x, y;
+
+    for (y = y0; y < y1; y++) 
+    {
+        const uint8_t *p = img->pix + (size_t) y * img->width * 3;
+        float *o = d->p + (size_t) y * d->w;
+
+        for (x = 0; x < img->width; x++, p += 3) 
+        {
+            float r = p[0] * (1.0f / 255), g = p[1] * (1.0f / 255), b = p[2] * (1.0f / 255);
+            float mu = (r + g + b) * (1.0f / 3);
+            float sat = sqrtf(((r - mu) * (r - mu) + (g - mu) * (g - mu) + (b - mu) * (b - mu)) * (1.0f / 3));
+            float con = fabsf(4 * mu - grey(img, x - 1, y) - grey(img, x + 1, y) - 
+                              grey(img, x, y - 1) - grey(img, x, y + 1));
+
+            o[x] = con * sat * exposedness[p[0]] * exposedness[p[1]] * exposedness[p[2]] + 1e-12f;
+        }
+    }
+}
+
+// one channel of an 8-bit image as floats in [0, 1]
+static void channel_rows(struct Job *job, int y0, int y1) 
+{
+    const struct Image *img = job->img;
+    struct Plane *d = job->dst;
+    int x, y;
+
+    for (y = y0; y < y1; y++) 
+    {
+        const uint8_t *p = img->pix + (size_t) y * img->width * 3 + job->channel;
+        float *o = d->p + (size_t) y * d->w;
+
+        for (x = 0; x < img->width; x++, p += 3)
+            o[x] = *p * (1.0f / 255);
+    }
+}
+
+// writes a float channel back into an 8-bit image
+static void store_rows(struct Job *job, int y0, int y1) 
+{
+    const struct Image *img = job->img;
+    const struct Plane *s = job->src;
+    int x, y;
+    float v;
+
+    for (y = y0; y < y1; y++) 
+    {
+        uint8_t *p = img->pix + (size_t) y * img->width * 3 + job->channel;
+        const float *r = s->p + (size_t) y * s->w;
+
+        for (x = 0; x < img->width; x++, p += 3) 
+        {
+            v = r[x] * 255 + 0.5f;
+            *p = (v < 0) ? 0 : (v > 255) ? 255 : (uint8_t) v;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+int hdr_fuse(const char **paths, int n, const char *out)
+{
+    struct Image imgs[MAX_EXPOSURES];
+    struct Plane weights[MAX_EXPOSURES], sum, base;
+    struct Pyramid wpyr, cpyr, result[3];
+    struct Job job;
+    struct timeval start, step;
+    double t_decode, t_weights;
+    int i, c, l, levels, w, h, ret = -1;
+    size_t k, npix;
+
+    if (n < 1 || n > MAX_EXPOSURES) return -1;
+
+    gettimeofday(&start, NULL);
+
+    if (exposedness[128] == 0)
+        for (i = 0; i < 256; i++)
+            exposedness[i] = expf(-(i / 255.0f - 0.5f) * (i / 255.0f - 0.5f) / (2 * HDR_SIGMA * HDR_SIGMA));
+
+    memset(imgs, 0, sizeof(imgs));
+    memset(weights, 0, sizeof(weights));
+    memset(result, 0, sizeof(result));
+    memset(&wpyr, 0, sizeof(wpyr));
+    memset(&cpyr, 0, sizeof(cpyr));
+    sum.p = NULL;
+
+    for (i = 0; i < n; i++) 
+    {
+        if (image_load(paths[i], HDR_SCALE, 3, &imgs[i]) < 0)
+            goto out;
+        if (imgs[i].width != imgs[0].width || imgs[i].height != imgs[0].height) 
+        {
+            tlog_error("hdr: %s differs in size\n", paths[i]);
+            goto out;
+        }
+    }
+    w = imgs[0].width;
+    h = imgs[0].height;
+    npix = (size_t) w * h;
+
+    gettimeofday(&step, NULL);
+    t_decode = elapsed(&start);
+
+    // per exposure weight maps, normalized to sum to one at every pixel
+    if (plane_alloc(&sum, w, h) < 0) goto out;
+    for (i = 0; i < n; i++) 
+    {
+        if (plane_alloc(&weights[i], w, h) < 0) goto out;
+        job.fn = weights_rows;
+        job.img = &imgs[i];
+        job.dst = &weights[i];
+        run(&job, h);
+        vec_add(sum.p, sum.p, weights[i].p, 1, npix);
+    }
+    for (k = 0; k < npix; k++)
+        sum.p[k] = 1.0f / sum.p[k];
+    for (i = 0; i < n; i++)
+        for (k = 0; k < npix; k++)
+            weights[i].p[k] *= sum.p[k];
+    free(sum.p);
+    sum.p = NULL;
+
+    t_weights = elapsed(&step);
+
+    // stop while the coarsest level is still a few pixels wide
+    for (levels = 1; levels < MAX_LEVELS && (w >> levels) >= 8 && (h >> levels) >= 8; levels++)
+        ;
+
+    // result = sum over exposures of gaussian(weight) * laplacian(image)
+    for (i = 0; i < n; i++) 
+    {
+        base = weights[i];
+        weights[i].p = NULL;
+        if (gaussian(&base, levels, &wpyr) < 0) goto out;
+
+        for (c = 0; c < 3; c++) 
+        {
+            if (plane_alloc(&base, w, h) < 0) goto out;
+            job.fn = channel_rows;
+            job.img = &imgs[i];
+            job.dst = &base;
+            job.channel = c;
+            run(&job, h);
+
+            if (gaussian(&base, levels, &cpyr) < 0 || laplacian(&cpyr) < 0) goto out;
+
+            if (result[c].levels == 0) 
+            {
+                result[c].levels = levels;
+                for (l = 0; l < levels; l++)
+                    if (plane_alloc(&result[c].lv[l], cpyr.lv[l].w, cpyr.lv[l].h) < 0) goto out;
+            }
+
+            for (l = 0; l < levels; l++)
+                vec_madd(result[c].lv[l].p, wpyr.lv[l].p, cpyr.lv[l].p, cpyr.lv[l].w * cpyr.lv[l].h);
+
+            pyramid_free(&cpyr);
+        }
+
+        pyramid_free(&wpyr);
+        if (i > 0) 
+            image_free(&imgs[i]);
+    }
+
+    // collapse each channel into the first image
+    for (c = 0; c < 3; c++) 
+    {
+        for (l = levels - 2; l >= 0; l--) 
+        {
+            struct Plane up;
+            if (plane_alloc(&up, result[c].lv[l].w, result[c].lv[l].h) < 0) goto out;
+            if (expand(&result[c].lv[l + 1], &up) < 0) 
+            {
+                free(up.p);
+                goto out;
+            }
+            vec_add(result[c].lv[l].p, result[c].lv[l].p, up.p, 1, up.w * up.h);
+            free(up.p);
+        }
+
+        job.fn = store_rows;
+        job.img = &imgs[0];
+        job.src = &result[c].lv[0];
+        job.channel = c;
+        run(&job, h);
+    }
+
+    ret = image_save(out, &imgs[0], HDR_QUALITY);
+
+    tlog_info("HDR: %d exposures fused in %.2f s (decode %.2f s, weights %.2f s), %dx%d, %d levels\n", 
+           n, elapsed(&start), t_decode, t_weights, w, h, levels);
+
+out:
+    for (i = 0; i < n; i++) 
+    {
+        image_free(&imgs[i]);
+        free(weights[i].p);
+    }
+    for (c = 0; c < 3; c++)
+        pyramid_free(&result[c]);
+    pyramid_free(&wpyr);
+    pyramid_free(&cpyr);
+    free(sum.p);
+
+    return ret;
+}
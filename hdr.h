@@ -0,0 +1,8 @@
+#ifndef __HDR_H__
+#define __HDR_H__
+
+// fuses 'n' differently exposed jpegs of the same scene into 'out' with
+// mertens exposure fusion, returns -1 on errors
+int hdr_fuse(const char **paths, int n, const char *out);
+
+#endif
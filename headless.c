@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "camera.h"
+#include "config.h"
+#include "ctl.h"
+#include "event.h"
+#include "prof.h"
+#include "status.h"
+#include "tlog.h"
+
+// the capture engine without pigpio, lcd and encoder: settings come from
+// the command line or a config file, the process exits when the run ends
+
+static const char *usage = 
+    "usage: timelapse-headless [-c config] [-i interval] [-d delay] [-n frames]\n"
+    "                          [-m interval|motion|bracket] [-b bracket]\n"
+    "                          [-D off|flag|drop] [-o outdir] [-j journal] [-I frameidx]\n"
+    "                          [-s socket] [-O offload_dir] [-R offload_kbps]\n"
+    "                          [-S warn|quality|delete] [-T full|preview] [-C cameras]\n"
+    "                          [-y off|leader|follow] [-g group:port] [-P off|on]\n"
+    "empty paths turn output, journal, index and control socket off\n";
+
+//-----------------------------------------------------------------------------
+// settings are fixed for the run, the socket can only watch and stop it
+void post_commands(struct CtlMsg *msgs, int n) 
+{
+    int i;
+
+    for (i = 0; i < n; i++) 
+    {
+        switch (msgs[i].op) 
+        {
+        case CTL_PING:
+        case CTL_STATUS:
+        case CTL_SUBSCRIBE:
+            msgs[i].status = CTL_OK;
+            break;
+
+        case CTL_STOP:
+            timelapse_stop();
+            msgs[i].status = CTL_OK;
+            break;
+
+        case CTL_START:
+        case CTL_SET_INTERVAL:
+        case CTL_SET_DELAY:
+        case CTL_SET_FRAMES:
+        case CTL_SET_MODE:
+            msgs[i].status = CTL_EBUSY;
+            break;
+
+        default:
+            msgs[i].status = CTL_EINVAL;
+            break;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// SIGINT and SIGTERM end the run cleanly
+static void *signal_thread(void *arg) 
+{
+    sigset_t *set = (sigset_t *) arg;
+    int sig;
+
+    if (sigwait(set, &sig) == 0) 
+    {
+        tlog_info("Signal %d, stopping\n", sig);
+        timelapse_stop();
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+static int parse_args(int argc, char *argv[])
+{
+    static const char *keys[128] = {
+        ['i'] = "interval", ['d'] = "delay", ['n'] = "frames", ['m'] = "mode", 
+        ['b'] = "bracket", ['D'] = "dedup", ['o'] = "outdir", ['j'] = "journal", 
+        ['I'] = "frameidx", ['s'] = "socket", ['O'] = "offload", ['R'] = "offload_rate", 
+        ['S'] = "storage", ['T'] = "transfer", ['C'] = "cameras", ['y'] = "sync", 
+        ['g'] = "sync_group", ['P'] = "profile" };
+    int opt;
+
+    // the config file first, the command line overrides it
+    while ((opt = getopt(argc, argv, "c:i:d:n:m:b:D:o:j:I:s:O:R:S:T:C:y:g:P:h")) != -1) 
+    {
+        if (opt == 'c' && config_load(optarg) < 0)
+            return -1;
+        if (opt == '?' || opt == 'h')
+            return -1;
+    }
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "c:i:d:n:m:b:D:o:j:I:s:O:R:S:T:C:y:g:P:h")) != -1) 
+    {
+        if (opt != 'c' && config_set(keys[opt], optarg) < 0)
+            return -1;
+    }
+
+    if (optind < argc) 
+        return -1;
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    struct timespec start, end;
+    struct Status st;
+    pthread_t thread;
+    sigset_t set;
+    double secs;
+
+    if (parse_args(argc, argv) < 0) 
+    {
+        fputs(usage, stderr);
+        return 2;
+    }
+
+    // before any thread it should count is started
+    prof_enable(glob_profile);
+
+    // every thread inherits the mask, only signal_thread() takes them
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    pthread_create(&thread, NULL, signal_thread, &set);
+    pthread_detach(thread);
+
+    status_open();
+    timelapse_init();
+
+    if (timelapse_recover())
+        tlog_info("Resuming the interrupted run, its settings win\n");
+
+    if (glob_interval == 0) 
+    {
+        fputs(usage, stderr);
+        return 2;
+    }
+
+    if (glob_ctlsock != NULL)
+        ctl_init(glob_ctlsock);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    status_begin()->state = S_RUNNING;
+    status_end();
+
+    if (timelapse_start() < 0) 
+    {
+        ctl_destroy();
+        timelapse_destroy();
+        status_close();
+        return 1;
+    }
+
+    timelapse_wait();
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    status_get(&st);
+    tlog_info("Run: %lld frames in %.1f s, %.2f frames/min, last capture %.0f ms, "
+              "errors %lld, recoveries %lld, lost slots %lld\n", 
+              (long long) st.frames, secs, secs > 0 ? st.frames * 60 / secs : 0.0, 
+              st.latency_us / 1e3, (long long) st.errors, (long long) st.recoveries, 
+              (long long) st.lost);
+
+    ctl_destroy();
+    timelapse_destroy();
+    status_close();
+
+    return 0;
+}
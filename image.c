@@ -0,0 +1,249 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+
+#include "image.h"
+
+// small inputs like camera previews aren't scaled below this width
+#define IMAGE_MIN_WIDTH 128
+
+// libjpeg calls exit() on errors by default, jump back instead
+struct jpeg_err
+{
+    struct jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+//-----------------------------------------------------------------------------
+
+static void jpeg_err_exit(j_common_ptr cinfo)
+{
+    struct jpeg_err *err = (struct jpeg_err *) cinfo->err;
+
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(err->jump, 1);
+}
+
+//-----------------------------------------------------------------------------
+
+static void start(struct jpeg_decompress_struct *cinfo, int denom, int comps, struct Image *img)
+{
+    jpeg_read_header(cinfo, TRUE);
+
+    while (denom > 1 && cinfo->image_width / denom < IMAGE_MIN_WIDTH)
+        denom /= 2;
+
+    // the scaled idct only computes the coefficients needed for the output
+    // size, so a 1/8 decode is mostly entropy decoding
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = denom;
+    cinfo->out_color_space = (comps == 1) ? JCS_GRAYSCALE : JCS_RGB;
+    if (denom > 1) 
+    {
+        cinfo->dct_method = JDCT_IFAST;
+        cinfo->do_fancy_upsampling = FALSE;
+    }
+
+    jpeg_start_decompress(cinfo);
+
+    img->width = cinfo->output_width;
+    img->height = cinfo->output_height;
+    img->comps = cinfo->output_components;
+}
+
+//-----------------------------------------------------------------------------
+
+// makes room for 'n' bytes at 'img->pix', keeping a big enough buffer
+static int reserve(struct Image *img, size_t n)
+{
+    if (img->pix != NULL && img->size >= n)
+        return 0;
+
+    free(img->pix);
+    img->size = 0;
+    img->pix = malloc(n);
+    if (img->pix == NULL)
+        return -1;
+
+    img->size = n;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+static int decode(struct jpeg_decompress_struct *cinfo, int denom, int comps, struct Image *img)
+{
+    JSAMPROW row;
+
+    start(cinfo, denom, comps, img);
+    if (reserve(img, (size_t) img->width * img->height * img->comps) < 0) 
+    {
+        jpeg_abort_decompress(cinfo);
+        return -1;
+    }
+
+    while (cinfo->output_scanline < cinfo->output_height) 
+    {
+        row = img->pix + (size_t) cinfo->output_scanline * img->width * img->comps;
+        jpeg_read_scanlines(cinfo, &row, 1);
+    }
+
+    jpeg_finish_decompress(cinfo);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int image_reload(const char *path, int denom, int comps, struct Image *img)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_err jerr;
+    FILE *f;
+    int ret;
+
+    f = fopen(path, "rb");
+    if (f == NULL) 
+    {
+        perror(path);
+        return -1;
+    }
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpeg_err_exit;
+    if (setjmp(jerr.jump)) 
+    {
+        jpeg_destroy_decompress(&cinfo);
+        fclose(f);
+        return -1;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, f);
+    ret = decode(&cinfo, denom, comps, img);
+    jpeg_destroy_decompress(&cinfo);
+    fclose(f);
+
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+
+int image_reload_mem(const uint8_t *buf, size_t size, int denom, int comps, struct Image *img)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_err jerr;
+    int ret;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpeg_err_exit;
+    if (setjmp(jerr.jump)) 
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return -1;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char *) buf, size);
+    ret = decode(&cinfo, denom, comps, img);
+    jpeg_destroy_decompress(&cinfo);
+
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+
+int image_load(const char *path, int denom, int comps, struct Image *img)
+{
+    img->pix = NULL;
+    img->size = 0;
+    if (image_reload(path, denom, comps, img) < 0) 
+    {
+        image_free(img);
+        return -1;
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int image_load_mem(const uint8_t *buf, size_t size, int denom, int comps, struct Image *img)
+{
+    img->pix = NULL;
+    img->size = 0;
+    if (image_reload_mem(buf, size, denom, comps, img) < 0) 
+    {
+        image_free(img);
+        return -1;
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int image_save(const char *path, const struct Image *img, int quality)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_err jerr;
+    JSAMPROW row;
+    FILE *f;
+
+    f = fopen(path, "wb");
+    if (f == NULL) 
+    {
+        perror(path);
+        return -1;
+    }
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpeg_err_exit;
+    if (setjmp(jerr.jump)) 
+    {
+        jpeg_destroy_compress(&cinfo);
+        fclose(f);
+        return -1;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, f);
+
+    cinfo.image_width = img->width;
+    cinfo.image_height = img->height;
+    cinfo.input_components = img->comps;
+    cinfo.in_color_space = (img->comps == 1) ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) 
+    {
+        row = img->pix + (size_t) cinfo.next_scanline * img->width * img->comps;
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    return fclose(f);
+}
+
+//-----------------------------------------------------------------------------
+
+void image_free(struct Image *img)
+{
+    free(img->pix);
+    img->pix = NULL;
+    img->size = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int image_is_jpeg(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+
+    return ext != NULL && (strcasecmp(ext, ".jpg") == 0 || strcasecmp(ext, ".jpeg") == 0);
+}
@@ -0,0 +1,33 @@
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 8-bit interleaved image, 'comps' is 1 (luma) or 3 (rgb); 'size' is
+// the bytes allocated at 'pix', kept across image_reload()
+struct Image
+{
+    int width;
+    int height;
+    int comps;
+    uint8_t *pix;
+    size_t size;
+};
+
+// decode a jpeg scaled by 1/denom (1, 2, 4 or 8) with libjpeg's scaled idct,
+// less for images that would come out very small
+int  image_load(const char *path, int denom, int comps, struct Image *img);
+int  image_load_mem(const uint8_t *buf, size_t size, int denom, int comps, struct Image *img);
+
+// the same into the buffer of an earlier load, or of a zeroed 'img', which
+// only grows when a frame doesn't fit; it's kept when decoding fails
+int  image_reload(const char *path, int denom, int comps, struct Image *img);
+int  image_reload_mem(const uint8_t *buf, size_t size, int denom, int comps, struct Image *img);
+
+int  image_save(const char *path, const struct Image *img, int quality);
+void image_free(struct Image *img);
+
+int  image_is_jpeg(const char *path);
+
+#endif
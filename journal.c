@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "journal.h"
+
+#define JOURNAL_MAGIC    "RLJRNL1"
+#define JOURNAL_VERSION  1
+
+// records the file grows by
+#define JOURNAL_GROW     4096
+
+// records appended between two msync(MS_SYNC), a crash of the process
+// loses nothing, a power cut at most this many records
+#define JOURNAL_SYNC     8
+
+#define STATE_IDLE       0
+#define STATE_RUNNING    1
+
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t state;
+    int64_t interval;
+    int64_t delay;
+    int64_t frames;
+    int64_t mode;
+    int64_t bracket;
+    int64_t start;
+    uint64_t count;     // records committed
+    uint64_t capacity;  // records the file can hold
+    uint8_t pad[40];
+};
+
+struct Record
+{
+    int64_t frame;
+    int64_t scheduled;  // seconds
+    int64_t taken;      // microseconds
+    int32_t status;
+    uint32_t check;     // detects a torn record after a power cut
+};
+
+static int fd = -1;
+static struct Header *header = NULL;
+static struct Record *records;
+static size_t map_size = 0;
+static int unsynced = 0;
+
+//-----------------------------------------------------------------------------
+
+static uint32_t checksum(const struct Record *r) 
+{
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+
+    h = (h ^ (uint64_t) r->frame) * 0x100000001b3ULL;
+    h = (h ^ (uint64_t) r->scheduled) * 0x100000001b3ULL;
+    h = (h ^ (uint64_t) r->taken) * 0x100000001b3ULL;
+    h = (h ^ (uint32_t) r->status) * 0x100000001b3ULL;
+
+    return (uint32_t) (h ^ (h >> 32));
+}
+
+//-----------------------------------------------------------------------------
+
+static int map(uint64_t capacity) 
+{
+    size_t size = sizeof(struct Header) + capacity * sizeof(struct Record);
+    void *p;
+
+    if (header != NULL) 
+    {
+        munmap(header, map_size);
+        header = NULL;
+    }
+
+    if (ftruncate(fd, size) < 0) 
+    {
+        perror("journal");
+        return -1;
+    }
+
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) 
+    {
+        perror("journal mmap");
+        return -1;
+    }
+
+    header = (struct Header *) p;
+    records = (struct Record *) (header + 1);
+    map_size = size;
+    header->capacity = capacity;
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+static void sync_all(void) 
+{
+    msync(header, map_size, MS_SYNC);
+    unsynced = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int journal_open(const char *path)
+{
+    struct Header h;
+    struct stat st;
+    int valid;
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) 
+    {
+        perror(path);
+        return -1;
+    }
+
+    valid = (fstat(fd, &st) == 0 && pread(fd, &h, sizeof(h), 0) == sizeof(h) &&
+             memcmp(h.magic, JOURNAL_MAGIC, sizeof(h.magic)) == 0 && 
+             h.version == JOURNAL_VERSION && h.count <= h.capacity &&
+             (uint64_t) st.st_size == sizeof(struct Header) + h.capacity * sizeof(struct Record));
+
+    if (!valid) 
+    {
+        memset(&h, 0, sizeof(h));
+        h.capacity = JOURNAL_GROW;
+    }
+
+    if (map(h.capacity) < 0) 
+    {
+        close(fd);
+        fd = -1;
+        return -1;
+    }
+
+    if (!valid) 
+    {
+        memset(header, 0, sizeof(*header));
+        memcpy(header->magic, JOURNAL_MAGIC, sizeof(header->magic));
+        header->version = JOURNAL_VERSION;
+        header->capacity = JOURNAL_GROW;
+        sync_all();
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+void journal_close( void )
+{
+    if (header != NULL) 
+    {
+        sync_all();
+        munmap(header, map_size);
+        header = NULL;
+    }
+
+    if (fd >= 0) 
+    {
+        close(fd);
+        fd = -1;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// only the header and the last intact record are read, so replay costs
+// the same for 10 or 100k frames
+int journal_pending(struct Session *session)
+{
+    uint64_t i;
+
+    if (header == NULL || header->state != STATE_RUNNING)
+        return 0;
+
+    session->interval = header->interval;
+    session->delay = header->delay;
+    session->frames = header->frames;
+    session->mode = header->mode;
+    session->bracket = header->bracket;
+    session->start = header->start;
+    session->captured = 0;
+    session->last = 0;
+
+    for (i = header->count; i > 0; i--) 
+    {
+        const struct Record *r = &records[i - 1];
+        if (r->check == checksum(r)) 
+        {
+            session->captured = r->frame + 1;
+            session->last = r->scheduled;
+            break;
+        }
+    }
+
+    return 1;
+}
+
+//-----------------------------------------------------------------------------
+
+int journal_begin(const struct Session *session)
+{
+    if (header == NULL) return -1;
+
+    header->interval = session->interval;
+    header->delay = session->delay;
+    header->frames = session->frames;
+    header->mode = session->mode;
+    header->bracket = session->bracket;
+    header->start = session->start;
+    header->count = 0;
+    header->state = STATE_RUNNING;
+    sync_all();
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int journal_append(long frame, time_t scheduled, const struct timeval *taken, int status)
+{
+    struct Record *r;
+    uint64_t n;
+
+    if (header == NULL) return -1;
+
+    n = header->count;
+    if (n == header->capacity) 
+    {
+        sync_all();
+        if (map(n + JOURNAL_GROW) < 0)
+            return -1;
+    }
+
+    // the record is complete before the count makes it visible
+    r = &records[n];
+    r->frame = frame;
+    r->scheduled = scheduled;
+    r->taken = (int64_t) taken->tv_sec * 1000000 + taken->tv_usec;
+    r->status = status;
+    r->check = checksum(r);
+
+    __atomic_store_n(&header->count, n + 1, __ATOMIC_RELEASE);
+
+    if (++unsynced >= JOURNAL_SYNC)
+        sync_all();
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+void journal_end( void )
+{
+    if (header == NULL) return;
+
+    header->state = STATE_IDLE;
+    sync_all();
+}
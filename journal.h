@@ -0,0 +1,30 @@
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <time.h>
+#include <sys/time.h>
+
+// settings and progress of a run
+struct Session
+{
+    long interval;
+    long delay;
+    long frames;
+    long mode;
+    long bracket;
+    time_t start;     // slot of the first frame
+    long captured;    // frames recorded so far
+    time_t last;      // slot of the last recorded frame
+};
+
+int  journal_open(const char *path);
+void journal_close(void);
+
+// returns 1 and fills 'session' if the last run was interrupted
+int  journal_pending(struct Session *session);
+
+int  journal_begin(const struct Session *session);
+int  journal_append(long frame, time_t scheduled, const struct timeval *taken, int status);
+void journal_end(void);
+
+#endif
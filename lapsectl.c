@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ctl.h"
+#include "status.h"
+
+// scripts a running timelapse through its control socket, e.g.
+//
+//   lapsectl interval 30 frames 600 start
+//   lapsectl status
+//   lapsectl ping 1000
+//   lapsectl watch
+//
+// all commands on a line go out as one batch
+
+static const char *sock_path = "/tmp/timelapse.sock";
+
+static const struct { const char *name; int op; int arg; } commands[] = {
+    { "ping",     CTL_PING,         0 },
+    { "interval", CTL_SET_INTERVAL, 1 },
+    { "delay",    CTL_SET_DELAY,    1 },
+    { "frames",   CTL_SET_FRAMES,   1 },
+    { "mode",     CTL_SET_MODE,     1 },
+    { "start",    CTL_START,        0 },
+    { "stop",     CTL_STOP,         0 },
+    { "status",   CTL_STATUS,       0 },
+    { "watch",    CTL_SUBSCRIBE,    0 },
+};
+static const int n_commands = sizeof(commands) / sizeof(commands[0]);
+
+static const char *errors[] = { "ok", "invalid", "busy", "failed" };
+
+//-----------------------------------------------------------------------------
+
+static double now_us(void) 
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+//-----------------------------------------------------------------------------
+
+static int read_all(int fd, void *buf, size_t len)
+{
+    ssize_t n;
+    size_t got = 0;
+
+    while (got < len) 
+    {
+        n = read(fd, (char *) buf + got, len - got);
+        if (n <= 0) 
+            return -1;
+        got += n;
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+static int connect_server(void)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) 
+    {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", sock_path);
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) 
+    {
+        perror(sock_path);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+//-----------------------------------------------------------------------------
+
+static void print_status(const struct Status *s)
+{
+    printf("  state %d, mode %d, %s, frame %lld/%lld, next %lld, latency %.0f ms, "
+           "queues %d/%d, errors %lld\n", 
+           s->state, s->mode, s->capturing ? "capturing" : "idle", 
+           (long long) s->frames, (long long) s->total, (long long) s->next, 
+           s->latency_us / 1e3, s->thumb_queue, s->composite_queue, (long long) s->errors);
+}
+
+//-----------------------------------------------------------------------------
+// sends a batch and prints the replies, returns -1 on a broken connection
+static int run_batch(int fd, struct CtlMsg *msgs, int n, int quiet, double *rtt)
+{
+    struct CtlMsg reply;
+    struct Status st;
+    double start;
+    int i, err = 0;
+
+    start = now_us();
+    if (write(fd, msgs, n * sizeof(struct CtlMsg)) != (ssize_t) (n * sizeof(struct CtlMsg))) 
+    {
+        perror("write");
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) 
+    {
+        if (read_all(fd, &reply, sizeof(reply)) < 0) 
+        {
+            fprintf(stderr, "connection closed\n");
+            return -1;
+        }
+        if (reply.op == CTL_STATUS && reply.status == CTL_OK && 
+            (reply.value != sizeof(st) || read_all(fd, &st, sizeof(st)) < 0)) 
+        {
+            fprintf(stderr, "bad status reply\n");
+            return -1;
+        }
+
+        if (reply.status != CTL_OK) 
+            err = 1;
+        if (quiet && reply.status == CTL_OK) 
+            continue;
+
+        printf("%s: %s\n", commands[reply.tag].name, 
+               (reply.status <= 0 && reply.status >= -3) ? errors[-reply.status] : "?");
+        if (reply.op == CTL_STATUS && reply.status == CTL_OK)
+            print_status(&st);
+    }
+    *rtt = now_us() - start;
+
+    return err;
+}
+
+//-----------------------------------------------------------------------------
+// round trips of single pings through the event loop
+static int ping(int fd, long count)
+{
+    struct CtlMsg msg;
+    double rtt, sum = 0, min = 1e12, max = 0;
+    long i;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.op = CTL_PING;
+
+    for (i = 0; i < count; i++) 
+    {
+        msg.value = i;
+        if (run_batch(fd, &msg, 1, 1, &rtt) != 0)
+            return 1;
+        sum += rtt;
+        if (rtt < min) min = rtt;
+        if (rtt > max) max = rtt;
+    }
+
+    printf("%ld pings: %.1f us avg, %.1f us min, %.1f us max\n", count, sum / count, min, max);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    struct CtlMsg msgs[CTL_BATCH], event;
+    int i, j, n = 0, fd, watch = 0, ret;
+    double rtt;
+
+    if (argc > 2 && strcmp(argv[1], "-s") == 0) 
+    {
+        sock_path = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc < 2) 
+    {
+        fprintf(stderr, "usage: lapsectl [-s socket] command [value] ...\n");
+        return 2;
+    }
+
+    fd = connect_server();
+    if (fd < 0) 
+        return 1;
+
+    if (strcmp(argv[1], "ping") == 0 && argc == 3)
+        return ping(fd, atol(argv[2]));
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 1; i < argc && n < CTL_BATCH; i++) 
+    {
+        for (j = 0; j < n_commands; j++)
+            if (strcmp(argv[i], commands[j].name) == 0)
+                break;
+
+        if (j == n_commands || (commands[j].arg && i + 1 >= argc)) 
+        {
+            fprintf(stderr, "bad command: %s\n", argv[i]);
+            return 2;
+        }
+
+        msgs[n].op = commands[j].op;
+        msgs[n].tag = j;
+        if (commands[j].arg)
+            msgs[n].value = atol(argv[++i]);
+        if (commands[j].op == CTL_SUBSCRIBE)
+            watch = 1;
+        n++;
+    }
+
+    ret = run_batch(fd, msgs, n, 0, &rtt);
+    if (ret < 0) 
+        return 1;
+    printf("%d commands in %.1f us\n", n, rtt);
+    fflush(stdout);
+
+    // frames as they come in
+    while (watch && read_all(fd, &event, sizeof(event)) == 0) 
+    {
+        if (event.op == CTL_FRAME) 
+        {
+            printf("frame %lld\n", (long long) event.value);
+            fflush(stdout);
+        }
+    }
+
+    close(fd);
+    return ret;
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "frameidx.h"
+
+// prints the frame index of a run, all of it or the frames 'first' to
+// 'last', e.g.
+//
+//   lapseidx frames.idx
+//   lapseidx frames.idx 100 200
+//
+// one tab separated line per shot, the header names the columns
+
+//-----------------------------------------------------------------------------
+// the first record with a frame number of at least 'frame'
+static uint64_t lower_bound(const struct FrameRecord *r, uint64_t n, long frame)
+{
+    uint64_t lo = 0, hi = n, mid;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (r[mid].frame < frame)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+//-----------------------------------------------------------------------------
+
+static void print_record(const struct FrameRecord *r)
+{
+    char shutter[16];
+
+    // shutter speeds as the camera shows them
+    if (r->exposure <= 0)
+        snprintf(shutter, sizeof(shutter), "-");
+    else if (r->exposure < 0.5)
+        snprintf(shutter, sizeof(shutter), "1/%.0f", 1 / r->exposure);
+    else
+        snprintf(shutter, sizeof(shutter), "%.1f", r->exposure);
+
+    printf("%lld\t%.3f\t%+.1f\t%s\tf/%.1f\t%d\t%.2f\t%lld\t%08x\t%s%s\t%s\t%s\n",
+           (long long) r->frame, r->taken_us / 1e6, (r->taken_us - r->scheduled_us) / 1e3,
+           shutter, r->aperture, r->iso, r->luminance, (long long) r->size, r->crc,
+           (r->flags & FRAME_DUPLICATE) ? "dup" : "-", (r->flags & FRAME_DROPPED) ? ",dropped" : "",
+           r->camera, r->local[0] ? r->local : "-");
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    const struct FrameIndexHeader *h;
+    const struct FrameRecord *r;
+    const char *path = "frames.idx";
+    struct stat st;
+    long first = 0, last = -1;
+    uint64_t i, n;
+    void *p;
+    int fd;
+
+    if (argc > 4)
+    {
+        fprintf(stderr, "usage: lapseidx [index] [first [last]]\n");
+        return 2;
+    }
+
+    if (argc > 1) path = argv[1];
+    if (argc > 2) first = atol(argv[2]);
+    if (argc > 3) last = atol(argv[3]);
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        perror(path);
+        return 1;
+    }
+
+    if (st.st_size < (off_t) sizeof(*h))
+    {
+        fprintf(stderr, "%s: not a frame index\n", path);
+        return 1;
+    }
+
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+
+    h = (const struct FrameIndexHeader *) p;
+    r = (const struct FrameRecord *) (h + 1);
+    if (memcmp(h->magic, FRAMEIDX_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != FRAMEIDX_VERSION || h->record_size != sizeof(struct FrameRecord))
+    {
+        fprintf(stderr, "%s: not a frame index or from another version\n", path);
+        return 1;
+    }
+
+    // a running capture may be appending, only what was there when we mapped
+    n = __atomic_load_n(&h->count, __ATOMIC_ACQUIRE);
+    if (n > (st.st_size - sizeof(*h)) / sizeof(struct FrameRecord))
+        n = (st.st_size - sizeof(*h)) / sizeof(struct FrameRecord);
+
+    printf("frame\ttaken\tlate_ms\tshutter\taperture\tiso\tcd_m2\tbytes\tcrc32c\tflags\tcamera\tlocal\n");
+    for (i = lower_bound(r, n, first); i < n && (last < 0 || r[i].frame <= last); i++)
+        print_record(&r[i]);
+
+    munmap(p, st.st_size);
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "status.h"
+
+// prints the live status of a running timelapse, once or every
+// 'interval' milliseconds given on the command line
+
+static const char *states[] = { "Menu", "Interval", "Running", "Delay", "Frames", "Mode" };
+static const char *modes[] = { "Interval", "Motion", "Bracket" };
+
+//-----------------------------------------------------------------------------
+
+static void print_status(const struct Status *s) 
+{
+    struct timeval now;
+    long next;
+
+    gettimeofday(&now, NULL);
+    next = s->next - now.tv_sec;
+
+    printf("pid %d  %-8s  %-8s  ", s->pid, 
+           (s->state >= 0 && s->state < 6) ? states[s->state] : "?", 
+           (s->mode >= 0 && s->mode < 3) ? modes[s->mode] : "?");
+
+    if (s->capturing) 
+    {
+        if (s->total > 0)
+            printf("frame %lld/%lld  ", (long long) s->frames, (long long) s->total);
+        else
+            printf("frame %lld  ", (long long) s->frames);
+        printf("next in %ld s  ", next > 0 ? next : 0);
+    }
+    else 
+    {
+        printf("idle, %lld frames  ", (long long) s->frames);
+    }
+
+    printf("latency %.0f ms  queues %d/%d  errors %lld (%lld recovered, %lld lost)  ", 
+           s->latency_us / 1e3, s->thumb_queue, s->composite_queue, 
+           (long long) s->errors, (long long) s->recoveries, (long long) s->lost);
+
+    if (s->offload_queue > 0 || s->offload_bytes > 0)
+        printf("offload %d files %.1f MB behind, %.1f MB done  ", s->offload_queue, 
+               s->offload_backlog / 1048576.0, s->offload_bytes / 1048576.0);
+
+    if (s->frames_fit >= 0)
+        printf("room %lld frames (card %.0f MB, disk %.0f MB)  ", (long long) s->frames_fit, 
+               s->card_free / 1048576.0, s->disk_free / 1048576.0);
+
+    printf("age %.1f s\n", (now.tv_sec * 1000000LL + now.tv_usec - s->updated_us) / 1e6);
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    const struct Status *shm;
+    struct Status copy;
+    struct timespec ts;
+    long interval = 0;
+    int fd;
+
+    if (argc > 1)
+        interval = atol(argv[1]);
+
+    fd = shm_open(STATUS_SHM, O_RDONLY, 0);
+    if (fd < 0) 
+    {
+        fprintf(stderr, "no timelapse running\n");
+        return 1;
+    }
+
+    shm = mmap(NULL, sizeof(struct Status), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) 
+    {
+        perror("mmap");
+        return 1;
+    }
+
+    do 
+    {
+        if (status_read(shm, &copy) < 0) 
+        {
+            fprintf(stderr, "status segment busy or from another version\n");
+            return 1;
+        }
+        print_status(&copy);
+        fflush(stdout);
+
+        ts.tv_sec = interval / 1000;
+        ts.tv_nsec = (interval % 1000) * 1000000;
+        nanosleep(&ts, NULL);
+    } while (interval > 0);
+
+    return 0;
+}
@@ -1,18 +1,12 @@
-#include <pigpio.h>
 #include <pthread.h>
 #include <sys/time.h>
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 
 #include "lcd.h"
-
-#define	LCD_RS 25
-#define	LCD_EN 24
-#define	LCD_D4 23
-#define	LCD_D5 22
-#define	LCD_D6 27
-#define	LCD_D7 17
-#define LCD_BL 12 
+#include "lcd_backend.h"
+#include "prof.h"
 
 // sec to wait before enter in pwm loop
 #define WAIT_MAX 60 
@@ -20,7 +14,17 @@
 // usec to wait before decrement pwm value
 #define WAIT_NEXT 10000 
 
+// bytes of one transaction, a full screen is 2 * (1 + LCD_COLS)
+#define BURST 64
+
 static uint8_t cursor_pos;
+static const struct LcdBackend *be = NULL;
+
+// what lcd_screen() last left on the glass, so the next one only sends
+// the cells that differ; lcd_puts() and lcd_putc() make it unknown
+static char shown[LCD_ROWS][LCD_COLS];
+static int shown_valid = 0;
+static pthread_mutex_t screen = PTHREAD_MUTEX_INITIALIZER;
 static volatile int thread_done = 1;
 
 static pthread_mutex_t mutex; 
@@ -35,11 +39,13 @@ static void* fadeout_thread(void *arg)
     struct timespec ts;
     struct timeval now;
 
+    prof_thread("fadeout");
+
     // lock mutex
     pthread_mutex_lock(&mutex);
 
-    // set gpio pwm to 100%
-    gpioPWM(LCD_BL, pwm);        
+    // backlight to 100%
+    be->backlight(pwm);
 
     // convert 'now' in timespec and add 'wait_seconds'
     gettimeofday(&now, NULL);
@@ -48,6 +54,7 @@ static void* fadeout_thread(void *arg)
 
     // wait 'wait_seconds' or master signal
     pthread_cond_timedwait(&condw, &mutex, &ts);
+    prof_wakeup();
 
     while (!thread_done && pwm > 0) 
     {   
@@ -57,11 +64,12 @@ static void* fadeout_thread(void *arg)
         ts.tv_sec = now.tv_sec;
         ts.tv_nsec = (now.tv_usec + WAIT_NEXT) * 1000;
 
-        // set gpio pwm
-        gpioPWM(LCD_BL, --pwm);        
+        // dim the backlight
+        be->backlight(--pwm);
 
         // wait for 10 millis
         pthread_cond_timedwait(&condw, &mutex, &ts);
+        prof_wakeup();
     }
     
     thread_done = 1;    
@@ -72,6 +80,7 @@ static void* fadeout_thread(void *arg)
     // unlock mutex
     pthread_mutex_unlock(&mutex);
 
+    prof_exit();
     return NULL;
 }
 
@@ -118,51 +127,30 @@ static void fadeout_stop( void )
 
 void lcd_fadeout( void ) 
 {
+    if (be == NULL)
+        return;
+
     fadeout_stop();
     fadeout_start(); 
 }
 
 // ---------------------------------------------------------
+// every call below is one transaction: on the backpack a single i2c
+// write carries the cursor command and all the characters
 
-static void lcd_write_byte( const uint8_t b )
+int lcd_putc( const char c )
 {
-    int rs = gpioRead(LCD_RS);
-    
-    // 1st nibble
-    gpioWrite(LCD_D7, (b >> 7) & 1);    
-    gpioWrite(LCD_D6, (b >> 6) & 1);
-    gpioWrite(LCD_D5, (b >> 5) & 1);
-    gpioWrite(LCD_D4, (b >> 4) & 1);
-
-    // enable
-    gpioWrite(LCD_EN, 1);
-    gpioDelay(1);
-    gpioWrite(LCD_EN, 0);
-    (rs == 1) ? gpioDelay(200) : gpioDelay(5500); 
-
-    // 2nd nibble
-    gpioWrite(LCD_D7, (b >> 3) & 1);    
-    gpioWrite(LCD_D6, (b >> 2) & 1);
-    gpioWrite(LCD_D5, (b >> 1) & 1);
-    gpioWrite(LCD_D4, (b >> 0) & 1);
-
-    // enable
-    gpioWrite(LCD_EN, 1);
-    gpioDelay(1);
-    gpioWrite(LCD_EN, 0);
-    (rs == 1) ? gpioDelay(200) : gpioDelay(5500); 
-}
+    uint16_t b[2];
 
-// ---------------------------------------------------------
+    if (be == NULL)
+        return 0;
 
-int lcd_putc( const char c )
-{
-    // remember last position command
-    lcd_write_byte(cursor_pos);
+    shown_valid = 0;
 
-	gpioWrite(LCD_RS, 1);
-	lcd_write_byte(c);
-	gpioWrite(LCD_RS, 0);
+    // remember last position command
+    b[0] = cursor_pos;
+    b[1] = LCD_DATA | (uint8_t) c;
+    be->send(b, 2);
     return (int)c;
 }
 
@@ -170,145 +158,144 @@ int lcd_putc( const char c )
 
 void lcd_set_cursor( const int row, const int column )
 {
-    uint8_t command = 0x80;
-	gpioWrite(LCD_RS, 0);
-	switch(row) {
-		case 0:
-			command += column;
-			break;
-		case 1:
-			command += 0x40 + (column);
-			break;
-	}
+    uint16_t command = 0x80;
+
+    switch(row) {
+        case 0:
+            command += column;
+            break;
+        case 1:
+            command += 0x40 + (column);
+            break;
+    }
 
     cursor_pos = command;
-	lcd_write_byte(command);
+    if (be != NULL)
+        be->send(&command, 1);
 }
 
 // --------------------------------------------------------
 
 int lcd_puts( const char *s )
 {
+    uint16_t b[BURST];
+    int n;
+
+    if (be == NULL || s == NULL)
+        return 0;
+
+    shown_valid = 0;
+
     // remember last position command
-    gpioWrite(LCD_RS, 0);
-    lcd_write_byte(cursor_pos);
-
-    if(s != NULL) {
-		gpioWrite(LCD_RS, 1);
-		while(*s != '\0') {
-			lcd_write_byte(*(s++));
-		}
-		gpioWrite(LCD_RS, 0);
-		return 1;
-	}
-	else {
-		return 0;
-	}
+    b[0] = cursor_pos;
+    n = 1;
+
+    while (*s != '\0')
+    {
+        b[n++] = LCD_DATA | (uint8_t) *(s++);
+        if (n == BURST)
+        {
+            be->send(b, n);
+            n = 0;
+        }
+    }
+
+    be->send(b, n);
+    return 1;
+}
+
+// --------------------------------------------------------
+
+void lcd_screen( const char *row0, const char *row1 )
+{
+    const char *rows[LCD_ROWS] = { row0, row1 };
+    uint16_t b[LCD_ROWS * (1 + LCD_COLS)];
+    char want[LCD_COLS];
+    int r, col, first, last, n = 0;
+
+    if (be == NULL)
+        return;
+
+    pthread_mutex_lock(&screen);
+
+    // overwriting with blanks instead of a clear spares its 1.5 ms, and
+    // of a row only the span that changed goes out
+    for (r = 0; r < LCD_ROWS; r++)
+    {
+        for (col = 0; col < LCD_COLS && rows[r] != NULL && rows[r][col] != '\0'; col++)
+            want[col] = rows[r][col];
+        for (; col < LCD_COLS; col++)
+            want[col] = ' ';
+
+        first = 0;
+        last = LCD_COLS - 1;
+        if (shown_valid)
+        {
+            while (first < LCD_COLS && want[first] == shown[r][first])
+                first++;
+            while (last > first && want[last] == shown[r][last])
+                last--;
+        }
+        if (first == LCD_COLS)
+            continue;
+
+        b[n++] = 0x80 + 0x40 * r + first;
+        for (col = first; col <= last; col++)
+            b[n++] = LCD_DATA | (uint8_t) want[col];
+        memcpy(shown[r], want, LCD_COLS);
+    }
+    shown_valid = 1;
+
+    if (n > 0)
+        be->send(b, n);
+    cursor_pos = 0x80;
+
+    pthread_mutex_unlock(&screen);
 }
 
 // --------------------------------------------------------
 
 void lcd_clear( void ) 
 {
-    gpioWrite(LCD_RS, 0);
-	lcd_write_byte(0x01);
-    
+    uint16_t command = 0x01;
+
+    if (be == NULL)
+        return;
+
+    pthread_mutex_lock(&screen);
+    be->send(&command, 1);
+    memset(shown, ' ', sizeof(shown));
+    shown_valid = 1;
+    pthread_mutex_unlock(&screen);
+
     // first row and first column
     cursor_pos = 0x80;
 }
 
 //---------------------------------------------------------
 
-void lcd_init( void )
+void lcd_init( int backend, int i2c_addr )
 {
-    // set pin mode
-    gpioSetMode(LCD_RS, PI_OUTPUT);
-    gpioSetMode(LCD_EN, PI_OUTPUT);
-    gpioSetMode(LCD_D7, PI_OUTPUT);
-    gpioSetMode(LCD_D6, PI_OUTPUT);
-    gpioSetMode(LCD_D5, PI_OUTPUT);
-    gpioSetMode(LCD_D4, PI_OUTPUT);
-
-    // -- power on -- 
-    // wait for more than 15 ms
-    // after Vcc rises to 4.5V
-    gpioDelay(15000);
-
-    gpioWrite(LCD_RS, 0);
-    gpioWrite(LCD_EN, 0);
-
-    // -- function set --
-    // RS RW D7 D6 D5 D4
-    // 0  0  0  0  1  1
-    gpioWrite(LCD_D7, 0);
-    gpioWrite(LCD_D6, 0);
-    gpioWrite(LCD_D5, 1);
-    gpioWrite(LCD_D4, 1);
-
-    gpioWrite(LCD_EN, 1);
-    gpioDelay(1);
-    gpioWrite(LCD_EN, 0);
-
-    // wait for more than 4.1 ms 
-    gpioDelay(5000);
-
-    // -- function set --
-    gpioWrite(LCD_EN, 1);
-    gpioDelay(1);
-    gpioWrite(LCD_EN, 0);
-
-    // wait for more than 100 us
-    gpioDelay(200);
-
-    // -- function set --
-    gpioWrite(LCD_EN, 1);
-    gpioDelay(1);
-    gpioWrite(LCD_EN, 0);
-    gpioDelay(200);
-
-    // -- 4-bit mode --
-    // RS RW D7 D6 D5 D4
-    // 0  0  0  0  1  0
-    gpioWrite(LCD_D7, 0);
-    gpioWrite(LCD_D6, 0);
-    gpioWrite(LCD_D5, 1);
-    gpioWrite(LCD_D4, 0);
-
-	gpioWrite(LCD_EN, 1);
-	gpioDelay(1);
-	gpioWrite(LCD_EN, 0);
-    gpioDelay(5000);
-       
-    // -- interface length --
-    // RS RW D7 D6 D5 D4
-    // 0  0  0  0  1  0
-    // 0  0  N  F  -  -
-    lcd_write_byte(0x28);
-
-    // -- display off --
-    // RS RW D7 D6 D5 D4
-    // 0  0  0  0  0  0
-    // 0  0  1  0  0  0
-    lcd_write_byte(0x08);
- 
- 
-    // -- clear screen --
-    // RS RW D7 D6 D5 D4
-    // 0  0  0  0  0  0
-    // 0  0  0  0  0  1
-    lcd_write_byte(0x01);
-
-    // -- set entry mode --
-    // RS RW D7 D6 D5 D4
-    // 0  0  0  0  0  0
-    // 0  0  0  1  D  S
-    lcd_write_byte(0x06);
-
-    // -- set entry mode --
-    // RS RW D7 D6 D5 D4
-    // 0  0  0  0  0  0
-    // 0  0  1  D  C  B
-    lcd_write_byte(0x0C);
+    static const struct LcdBackend *backends[] = { &lcd_gpio, &lcd_pcf8574, &lcd_term };
+
+    // -- interface length, display off, clear screen, --
+    // -- entry mode, display on --
+    static const uint16_t setup[] = { 0x28, 0x08, 0x01, 0x06, 0x0C };
+
+    if (backend < 0 || backend > LCD_TERM)
+        backend = LCD_GPIO;
+
+    // the power on sequence up to 4-bit mode is the backend's
+    if (backends[backend]->open(i2c_addr) < 0)
+    {
+        fprintf(stderr, "lcd: %s display not available\n", backends[backend]->name);
+        return;
+    }
+
+    be = backends[backend];
+    be->send(setup, 5);
+    memset(shown, ' ', sizeof(shown));
+    shown_valid = 1;
 
     // first row and first column
     cursor_pos = 0x80;
@@ -325,9 +312,14 @@ void lcd_init( void )
 
 void lcd_destroy( void )
 {
+    if (be == NULL)
+        return;
+
     fadeout_stop();
     pthread_mutex_destroy(&mutex);
     pthread_cond_destroy(&condw);
     pthread_cond_destroy(&condm);
-}
 
+    be->close();
+    be = NULL;
+}
@@ -4,7 +4,13 @@
 #define LCD_COLS 16
 #define LCD_ROWS  2
 
-void lcd_init(void);
+// where the display hangs: six gpio pins, a pcf8574 i2c backpack or,
+// for testing, the terminal
+#define LCD_GPIO    0
+#define LCD_PCF8574 1
+#define LCD_TERM    2
+
+void lcd_init(int backend, int i2c_addr);
 void lcd_destroy(void);
 
 void lcd_clear(void);
@@ -12,6 +18,10 @@ int  lcd_putc(const char c);
 int  lcd_puts(const char *s);
 void lcd_set_cursor(const int row, const int col); 
 
+// both rows at once, padded with blanks, in one transaction of only
+// the cells that changed since the last one
+void lcd_screen(const char *row0, const char *row1);
+
 void lcd_fadeout();
 
 #endif
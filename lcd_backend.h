@@ -0,0 +1,36 @@
+#ifndef __LCD_BACKEND_H__
+#define __LCD_BACKEND_H__
+
+#include <stdint.h>
+
+// what lcd.c drives: an hd44780 in 4-bit mode on six gpio pins
+// (lcd_gpio.c), behind a pcf8574 i2c backpack (lcd_pcf8574.c) or a
+// picture of one on the terminal (lcd_term.c)
+
+// a byte for the data register, the others go to the command register
+#define LCD_DATA 0x100
+
+// clear and home keep the controller busy this long, the rest 37 us
+#define LCD_SLOW_US 1600
+
+struct LcdBackend
+{
+    const char *name;
+
+    // wakes the controller into 4-bit mode, 'addr' is the i2c address
+    // where there's one; -1 if the display can't be reached
+    int  (*open)(int addr);
+    void (*close)(void);
+
+    // 'n' bytes as one transaction, a burst where the bus allows it
+    void (*send)(const uint16_t *bytes, int n);
+
+    // 0 is off, 255 full
+    void (*backlight)(int level);
+};
+
+extern const struct LcdBackend lcd_gpio;
+extern const struct LcdBackend lcd_pcf8574;
+extern const struct LcdBackend lcd_term;
+
+#endif
@@ -0,0 +1,114 @@
+#include <pigpio.h>
+#include <stdint.h>
+
+#include "lcd_backend.h"
+
+#define	LCD_RS 25
+#define	LCD_EN 24
+#define	LCD_D4 23
+#define	LCD_D5 22
+#define	LCD_D6 27
+#define	LCD_D7 17
+#define LCD_BL 12
+
+// level of the rs pin, only written when it changes
+static int rs_level = 0;
+
+// ---------------------------------------------------------
+
+static void write_nibble( const uint8_t n )
+{
+    gpioWrite(LCD_D7, (n >> 3) & 1);
+    gpioWrite(LCD_D6, (n >> 2) & 1);
+    gpioWrite(LCD_D5, (n >> 1) & 1);
+    gpioWrite(LCD_D4, (n >> 0) & 1);
+
+    // enable
+    gpioWrite(LCD_EN, 1);
+    gpioDelay(1);
+    gpioWrite(LCD_EN, 0);
+}
+
+// ---------------------------------------------------------
+
+static void gpio_send( const uint16_t *bytes, int n )
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (((bytes[i] & LCD_DATA) != 0) != rs_level)
+        {
+            rs_level = !rs_level;
+            gpioWrite(LCD_RS, rs_level);
+        }
+
+        write_nibble(bytes[i] >> 4);
+        rs_level ? gpioDelay(200) : gpioDelay(5500);
+        write_nibble(bytes[i]);
+        rs_level ? gpioDelay(200) : gpioDelay(5500);
+    }
+}
+
+// ---------------------------------------------------------
+
+static void gpio_backlight( int level )
+{
+    gpioPWM(LCD_BL, level);
+}
+
+// ---------------------------------------------------------
+
+static int gpio_open( int addr )
+{
+    // set pin mode
+    gpioSetMode(LCD_RS, PI_OUTPUT);
+    gpioSetMode(LCD_EN, PI_OUTPUT);
+    gpioSetMode(LCD_D7, PI_OUTPUT);
+    gpioSetMode(LCD_D6, PI_OUTPUT);
+    gpioSetMode(LCD_D5, PI_OUTPUT);
+    gpioSetMode(LCD_D4, PI_OUTPUT);
+
+    // -- power on --
+    // wait for more than 15 ms
+    // after Vcc rises to 4.5V
+    gpioDelay(15000);
+
+    gpioWrite(LCD_RS, 0);
+    gpioWrite(LCD_EN, 0);
+    rs_level = 0;
+
+    // -- function set --
+    // RS RW D7 D6 D5 D4
+    // 0  0  0  0  1  1
+    write_nibble(0x3);
+
+    // wait for more than 4.1 ms
+    gpioDelay(5000);
+
+    // -- function set --
+    write_nibble(0x3);
+
+    // wait for more than 100 us
+    gpioDelay(200);
+
+    // -- function set --
+    write_nibble(0x3);
+    gpioDelay(200);
+
+    // -- 4-bit mode --
+    // RS RW D7 D6 D5 D4
+    // 0  0  0  0  1  0
+    write_nibble(0x2);
+    gpioDelay(5000);
+
+    return 0;
+}
+
+// ---------------------------------------------------------
+
+static void gpio_close( void )
+{
+}
+
+const struct LcdBackend lcd_gpio = { "gpio", gpio_open, gpio_close, gpio_send, gpio_backlight };
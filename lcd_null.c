@@ -0,0 +1,37 @@
+#include "lcd.h"
+
+// display that isn't there, for hosts without the lcd
+
+void lcd_init( int backend, int i2c_addr ) 
+{
+}
+
+void lcd_destroy( void ) 
+{
+}
+
+void lcd_clear( void ) 
+{
+}
+
+int lcd_putc( const char c ) 
+{
+    return 0;
+}
+
+int lcd_puts( const char *s ) 
+{
+    return 0;
+}
+
+void lcd_set_cursor( const int row, const int column ) 
+{
+}
+
+void lcd_screen( const char *row0, const char *row1 ) 
+{
+}
+
+void lcd_fadeout( void ) 
+{
+}
@@ -0,0 +1,139 @@
+#include <pigpio.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "lcd_backend.h"
+
+// the common backpack wiring: P0 rs, P1 rw, P2 en, P3 backlight,
+// P4-P7 d4-d7
+#define PCF_RS 0x01
+#define PCF_EN 0x04
+#define PCF_BL 0x08
+
+#define I2C_BUS 1
+
+// every nibble is two bus bytes, en high and en low. At 100 kHz a bus
+// byte takes 90 us, so each edge is far wider than the 450 ns the
+// controller needs and each byte done before the next comes: a whole
+// update goes out in one i2cWriteDevice() with no delays in between
+#define BURST_MAX (4 * 64)
+
+static int handle = -1;
+static uint8_t light = PCF_BL;
+
+// the fade thread switches the light while others write
+static pthread_mutex_t bus = PTHREAD_MUTEX_INITIALIZER;
+
+// ---------------------------------------------------------
+// the four bus bytes of one controller byte
+static int encode( uint8_t *out, uint8_t b, uint8_t flags )
+{
+    out[0] = (b & 0xf0) | flags | PCF_EN;
+    out[1] = (b & 0xf0) | flags;
+    out[2] = (uint8_t) (b << 4) | flags | PCF_EN;
+    out[3] = (uint8_t) (b << 4) | flags;
+    return 4;
+}
+
+// ---------------------------------------------------------
+
+static void flush( uint8_t *buf, int *len )
+{
+    if (*len > 0 && i2cWriteDevice(handle, (char *) buf, *len) < 0)
+        fprintf(stderr, "lcd: i2c write failed\n");
+    *len = 0;
+}
+
+// ---------------------------------------------------------
+
+static void pcf_send( const uint16_t *bytes, int n )
+{
+    uint8_t buf[BURST_MAX];
+    int i, len = 0;
+    uint8_t b;
+
+    pthread_mutex_lock(&bus);
+    if (handle < 0)
+    {
+        pthread_mutex_unlock(&bus);
+        return;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        if (len + 4 > BURST_MAX)
+            flush(buf, &len);
+
+        b = bytes[i] & 0xff;
+        len += encode(buf + len, b, light | ((bytes[i] & LCD_DATA) ? PCF_RS : 0));
+
+        // clear and home: the controller is busy, the rest waits for it
+        if (!(bytes[i] & LCD_DATA) && b != 0 && (b & 0xfc) == 0)
+        {
+            flush(buf, &len);
+            gpioDelay(LCD_SLOW_US);
+        }
+    }
+
+    flush(buf, &len);
+    pthread_mutex_unlock(&bus);
+}
+
+// ---------------------------------------------------------
+// the expander only switches the light, any level but 0 is on
+static void pcf_backlight( int level )
+{
+    uint8_t on = (level > 0) ? PCF_BL : 0;
+
+    pthread_mutex_lock(&bus);
+    if (handle >= 0 && on != light)
+    {
+        light = on;
+        i2cWriteByte(handle, light);
+    }
+    pthread_mutex_unlock(&bus);
+}
+
+// ---------------------------------------------------------
+// the power on sequence of the gpio backend, nibble by nibble
+static int pcf_open( int addr )
+{
+    static const uint32_t waits[] = { 5000, 200, 200, 5000 };
+    static const uint8_t nibbles[] = { 0x3, 0x3, 0x3, 0x2 };
+    char b[2];
+    int i;
+
+    handle = i2cOpen(I2C_BUS, addr, 0);
+    if (handle < 0)
+    {
+        fprintf(stderr, "lcd: no pcf8574 at 0x%02x on i2c-%d\n", addr, I2C_BUS);
+        return -1;
+    }
+
+    light = PCF_BL;
+    gpioDelay(15000);
+
+    for (i = 0; i < 4; i++)
+    {
+        b[0] = (nibbles[i] << 4) | light | PCF_EN;
+        b[1] = (nibbles[i] << 4) | light;
+        i2cWriteDevice(handle, b, 2);
+        gpioDelay(waits[i]);
+    }
+
+    return 0;
+}
+
+// ---------------------------------------------------------
+
+static void pcf_close( void )
+{
+    pthread_mutex_lock(&bus);
+    if (handle >= 0)
+        i2cClose(handle);
+    handle = -1;
+    pthread_mutex_unlock(&bus);
+}
+
+const struct LcdBackend lcd_pcf8574 = { "pcf8574", pcf_open, pcf_close, pcf_send, pcf_backlight };
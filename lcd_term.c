@@ -0,0 +1,114 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lcd_backend.h"
+#include "lcd.h"
+
+// the controller keeps 40 cells a row whatever the glass shows
+#define DDRAM_COLS 40
+
+// a display for hosts without one: the controller's ram kept here and
+// drawn on stderr after every transaction, a box in the top left corner
+// on a terminal, one line per update otherwise
+
+static char ddram[LCD_ROWS][DDRAM_COLS];
+static int addr = 0;        // address counter, row * 0x40 + col
+static int light = 255;
+static int tty = 0;
+
+// ---------------------------------------------------------
+
+static void render( void )
+{
+    char out[256];
+    int n;
+
+    if (tty)
+        n = snprintf(out, sizeof(out),
+                     "\0337\033[1;1H%s+----------------+\033[2;1H|%.16s|\033[3;1H|%.16s|"
+                     "\033[4;1H+----------------+\033[0m\0338",
+                     light > 0 ? "\033[7m" : "\033[2m", ddram[0], ddram[1]);
+    else
+        n = snprintf(out, sizeof(out), "lcd |%.16s|%.16s|%s\n",
+                     ddram[0], ddram[1], light > 0 ? "" : " (dark)");
+
+    if (write(STDERR_FILENO, out, n) < 0)
+        return;
+}
+
+// ---------------------------------------------------------
+
+static void term_command( uint8_t b )
+{
+    if (b == 0x01)
+    {
+        memset(ddram, ' ', sizeof(ddram));
+        addr = 0;
+    }
+    else if ((b & 0xfe) == 0x02)
+        addr = 0;
+    else if (b & 0x80)
+        addr = b & 0x7f;
+}
+
+// ---------------------------------------------------------
+
+static void term_send( const uint16_t *bytes, int n )
+{
+    int i, row, col;
+
+    for (i = 0; i < n; i++)
+    {
+        if (!(bytes[i] & LCD_DATA))
+        {
+            term_command(bytes[i]);
+            continue;
+        }
+
+        row = (addr >= 0x40);
+        col = addr & 0x3f;
+        if (col < DDRAM_COLS)
+            ddram[row][col] = bytes[i] & 0xff;
+
+        // the counter runs from the end of one row into the other
+        addr = (col + 1 < DDRAM_COLS) ? addr + 1 : (row ? 0x00 : 0x40);
+    }
+
+    render();
+}
+
+// ---------------------------------------------------------
+
+static void term_backlight( int level )
+{
+    // only the edges are worth a redraw, not every step of a fade
+    if ((level > 0) == (light > 0))
+    {
+        light = level;
+        return;
+    }
+
+    light = level;
+    render();
+}
+
+// ---------------------------------------------------------
+
+static int term_open( int unused )
+{
+    memset(ddram, ' ', sizeof(ddram));
+    addr = 0;
+    light = 255;
+    tty = isatty(STDERR_FILENO);
+    return 0;
+}
+
+// ---------------------------------------------------------
+
+static void term_close( void )
+{
+}
+
+const struct LcdBackend lcd_term = { "term", term_open, term_close, term_send, term_backlight };
@@ -0,0 +1,36 @@
+#ifndef __MOCK_H__
+#define __MOCK_H__
+
+#include <stdint.h>
+#include <time.h>
+
+// link-time stand-ins for pigpio and libgphoto2 (mock_pigpio.c,
+// mock_gphoto2.c), so the benchmarks run on any linux box. They do no
+// i/o and keep count of what the code asked for
+
+// gpio writes so far and microseconds of gpioDelay() asked for
+extern volatile unsigned long mock_gpio_writes;
+extern unsigned long long mock_gpio_delay_us;
+
+// i2c transactions so far and the bytes they carried
+extern volatile unsigned long mock_i2c_writes;
+extern volatile unsigned long long mock_i2c_bytes;
+
+// a capture takes this long, its start times are kept
+#define MOCK_SHOTS 4096
+
+extern long mock_capture_us;
+extern volatile long mock_shots;
+extern struct timespec mock_shot_times[MOCK_SHOTS];
+
+// bytes of a downloaded file, handed over in chunks of MOCK_CHUNK like
+// the ptp driver does; its contents, a fixed pattern if NULL
+#define MOCK_CHUNK (64 * 1024)
+
+extern long long mock_file_bytes;
+extern const unsigned char *mock_file_data;
+
+// bytes of the embedded preview, 0 for a camera without previews
+extern long long mock_preview_bytes;
+
+#endif
@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <gphoto2/gphoto2.h>
+
+#include "mock.h"
+
+// one camera with a card, a text widget for every setting and no live view
+
+struct _GPContext { int unused; };
+struct _CameraWidget { int unused; };
+struct _CameraList { int unused; };
+struct _CameraAbilitiesList { int unused; };
+struct _GPPortInfoList { int unused; };
+struct _GPPortInfo { int unused; };
+
+struct _CameraFile
+{
+    int fd;
+    CameraFileHandler *handler;
+    void *priv;
+};
+
+long mock_capture_us = 0;
+volatile long mock_shots = 0;
+struct timespec mock_shot_times[MOCK_SHOTS];
+long long mock_file_bytes = 0;
+long long mock_preview_bytes = 0;
+const unsigned char *mock_file_data = NULL;
+
+static struct _GPContext context;
+// struct _Camera is public in libgphoto2, it's never looked into
+static long camera[64];
+static struct _CameraWidget widget;
+static struct _GPPortInfo port;
+static char widget_value[] = "Memory card";
+
+//-----------------------------------------------------------------------------
+
+GPContext *gp_context_new(void) { return &context; }
+void gp_context_set_error_func(GPContext *c, GPContextErrorFunc f, void *data) {}
+void gp_context_set_status_func(GPContext *c, GPContextStatusFunc f, void *data) {}
+void gp_context_set_cancel_func(GPContext *c, GPContextCancelFunc f, void *data) {}
+
+//-----------------------------------------------------------------------------
+
+int gp_camera_new(Camera **c) { *c = (Camera *) camera; return GP_OK; }
+int gp_camera_init(Camera *c, GPContext *ctx) { return GP_OK; }
+int gp_camera_exit(Camera *c, GPContext *ctx) { return GP_OK; }
+int gp_camera_unref(Camera *c) { return GP_OK; }
+int gp_camera_set_abilities(Camera *c, CameraAbilities a) { return GP_OK; }
+int gp_camera_set_port_info(Camera *c, GPPortInfo info) { return GP_OK; }
+
+//-----------------------------------------------------------------------------
+
+int gp_camera_get_abilities(Camera *c, CameraAbilities *a)
+{
+    memset(a, 0, sizeof(*a));
+    strcpy(a->model, "Mock Camera");
+    return GP_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+int gp_camera_get_port_info(Camera *c, GPPortInfo *info)
+{
+    *info = &port;
+    return GP_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+int gp_port_info_get_path(GPPortInfo info, char **path)
+{
+    *path = "usb:001,001";
+    return GP_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+int gp_camera_capture(Camera *c, CameraCaptureType type, CameraFilePath *path, GPContext *ctx)
+{
+    long n = mock_shots;
+
+    if (n < MOCK_SHOTS)
+        clock_gettime(CLOCK_REALTIME, &mock_shot_times[n]);
+    mock_shots = n + 1;
+
+    if (mock_capture_us > 0)
+        usleep(mock_capture_us);
+
+    strcpy(path->folder, "/store_00010001/DCIM/100MOCK");
+    snprintf(path->name, sizeof(path->name), "IMG_%04ld.JPG", n % 10000);
+    return GP_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+int gp_camera_capture_preview(Camera *c, CameraFile *file, GPContext *ctx)
+{
+    return GP_ERROR_NOT_SUPPORTED;
+}
+
+//-----------------------------------------------------------------------------
+// 'mock_file_bytes' of 'mock_file_data' or of a fixed pattern, or
+// 'mock_preview_bytes' of the pattern
+int gp_camera_file_get(Camera *c, const char *folder, const char *name, CameraFileType type, 
+                       CameraFile *file, GPContext *ctx)
+{
+    static unsigned char chunk[MOCK_CHUNK];
+    unsigned char *src;
+    long long done, size = mock_file_bytes;
+    uint64_t len;
+    int i, ret;
+
+    if (type == GP_FILE_TYPE_PREVIEW)
+        size = mock_preview_bytes;
+    else if (type != GP_FILE_TYPE_NORMAL)
+        return GP_ERROR_NOT_SUPPORTED;
+    if (size == 0)
+        return GP_ERROR_NOT_SUPPORTED;
+
+    if (chunk[1] == 0)
+        for (i = 0; i < MOCK_CHUNK; i++)
+            chunk[i] = i * 31 + 7;
+
+    for (done = 0; done < size; done += len) 
+    {
+        len = (size - done > MOCK_CHUNK) ? MOCK_CHUNK : size - done;
+        src = (mock_file_data != NULL && type == GP_FILE_TYPE_NORMAL) ? 
+            (unsigned char *) mock_file_data + done : chunk;
+        if (file->handler != NULL)
+            ret = file->handler->write(file->priv, src, &len);
+        else
+            ret = (write(file->fd, src, len) == (ssize_t) len) ? GP_OK : GP_ERROR_IO_WRITE;
+        if (ret < GP_OK)
+            return ret;
+    }
+
+    return GP_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+int gp_camera_file_get_info(Camera *c, const char *folder, const char *name, 
+                            CameraFileInfo *info, GPContext *ctx)
+{
+    memset(info, 0, sizeof(*info));
+    info->file.fields = GP_FILE_INFO_SIZE;
+    info->file.size = mock_file_bytes;
+    if (mock_preview_bytes > 0) 
+    {
+        info->preview.fields = GP_FILE_INFO_SIZE;
+        info->preview.size = mock_preview_bytes;
+    }
+    return GP_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+int gp_camera_file_delete(Camera *c, const char *folder, const char *name, GPContext *ctx)
+{
+    return GP_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+int gp_camera_get_storageinfo(Camera *c, CameraStorageInformation **sifs, int *n, GPContext *ctx)
+{
+    // the caller frees it
+    *sifs = calloc(1, sizeof(CameraStorageInformation));
+    if (*sifs == NULL)
+        return GP_ERROR_NO_MEMORY;
+
+    (*sifs)->fields = GP_STORAGEINFO_FREESPACEKBYTES;
+    (*sifs)->freekbytes = 32 * 1024 * 1024;
+    *n = 1;
+    return GP_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+int gp_camera_get_config(Camera *c, CameraWidget **w, GPContext *ctx) { *w = &widget; return GP_OK; }
+int gp_camera_set_config(Camera *c, CameraWidget *w, GPContext *ctx) { return GP_OK; }
+int gp_widget_get_child_by_name(CameraWidget *w, const char *name, CameraWidget **child) { *child = &widget; return GP_OK; }
+int gp_widget_get_child_by_label(CameraWidget *w, const char *label, CameraWidget **child) { *child = &widget; return GP_OK; }
+int gp_widget_get_type(CameraWidget *w, CameraWidgetType *type) { *type = GP_WIDGET_TEXT; return GP_OK; }
+int gp_widget_get_value(CameraWidget *w, void *value) { *(char **) value = widget_value; return GP_OK; }
+int gp_widget_set_value(CameraWidget *w, const void *value) { return GP_OK; }
+int gp_widget_free(CameraWidget *w) { return GP_OK; }
+int gp_widget_count_choices(CameraWidget *w) { return 0; }
+int gp_widget_get_choice(CameraWidget *w, int i, const char **choice) { return GP_ERROR_BAD_PARAMETERS; }
+
+//-----------------------------------------------------------------------------
+
+int gp_file_new(CameraFile **file)
+{
+    *file = calloc(1, sizeof(CameraFile));
+    if (*file == NULL)
+        return GP_ERROR_NO_MEMORY;
+    (*file)->fd = -1;
+    return GP_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+int gp_file_new_from_fd(CameraFile **file, int fd)
+{
+    int ret;
+
+    ret = gp_file_new(file);
+    if (ret == GP_OK)
+        (*file)->fd = fd;
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+
+int gp_file_new_from_handler(CameraFile **file, CameraFileHandler *handler, void *priv)
+{
+    int ret;
+
+    ret = gp_file_new(file);
+    if (ret == GP_OK) 
+    {
+        (*file)->handler = handler;
+        (*file)->priv = priv;
+    }
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+
+int gp_file_free(CameraFile *file)
+{
+    if (file->fd >= 0)
+        close(file->fd);
+    free(file);
+    return GP_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+int gp_file_get_data_and_size(CameraFile *file, const char **data, unsigned long *size)
+{
+    *data = NULL;
+    *size = 0;
+    return GP_OK;
+}
+
+//-----------------------------------------------------------------------------
+// a single camera, the rig finds no others
+
+int gp_camera_autodetect(CameraList *list, GPContext *ctx) { return GP_OK; }
+int gp_list_new(CameraList **list) { static struct _CameraList l; *list = &l; return GP_OK; }
+int gp_list_free(CameraList *list) { return GP_OK; }
+int gp_list_count(CameraList *list) { return 0; }
+int gp_list_get_name(CameraList *list, int i, const char **name) { return GP_ERROR_BAD_PARAMETERS; }
+int gp_list_get_value(CameraList *list, int i, const char **value) { return GP_ERROR_BAD_PARAMETERS; }
+
+int gp_abilities_list_new(CameraAbilitiesList **list) { static struct _CameraAbilitiesList l; *list = &l; return GP_OK; }
+int gp_abilities_list_free(CameraAbilitiesList *list) { return GP_OK; }
+int gp_abilities_list_load(CameraAbilitiesList *list, GPContext *ctx) { return GP_OK; }
+int gp_abilities_list_lookup_model(CameraAbilitiesList *list, const char *model) { return GP_ERROR_MODEL_NOT_FOUND; }
+int gp_abilities_list_get_abilities(CameraAbilitiesList *list, int i, CameraAbilities *a) { return GP_ERROR_BAD_PARAMETERS; }
+
+int gp_port_info_list_new(GPPortInfoList **list) { static struct _GPPortInfoList l; *list = &l; return GP_OK; }
+int gp_port_info_list_free(GPPortInfoList *list) { return GP_OK; }
+int gp_port_info_list_load(GPPortInfoList *list) { return GP_OK; }
+int gp_port_info_list_lookup_path(GPPortInfoList *list, const char *path) { return 0; }
+int gp_port_info_list_get_info(GPPortInfoList *list, int i, GPPortInfo *info) { *info = &port; return GP_OK; }
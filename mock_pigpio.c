@@ -0,0 +1,111 @@
+#include <pigpio.h>
+
+#include "mock.h"
+
+#define NR_GPIO 54
+
+volatile unsigned long mock_gpio_writes = 0;
+unsigned long long mock_gpio_delay_us = 0;
+volatile unsigned long mock_i2c_writes = 0;
+volatile unsigned long long mock_i2c_bytes = 0;
+
+static unsigned levels[NR_GPIO];
+
+//-----------------------------------------------------------------------------
+
+int gpioInitialise(void)
+{
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+void gpioTerminate(void)
+{
+}
+
+//-----------------------------------------------------------------------------
+
+int gpioSetMode(unsigned gpio, unsigned mode)
+{
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int gpioSetPullUpDown(unsigned gpio, unsigned pud)
+{
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// the encoder never turns, events come from the benchmark
+int gpioSetAlertFunc(unsigned gpio, gpioAlertFunc_t f)
+{
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int gpioRead(unsigned gpio)
+{
+    return (gpio < NR_GPIO) ? (int) levels[gpio] : 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int gpioWrite(unsigned gpio, unsigned level)
+{
+    if (gpio < NR_GPIO)
+        levels[gpio] = level;
+
+    mock_gpio_writes++;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int gpioPWM(unsigned gpio, unsigned duty)
+{
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// only counted, the display timing is worked out from the total
+uint32_t gpioDelay(uint32_t micros)
+{
+    mock_gpio_delay_us += micros;
+    return micros;
+}
+
+//-----------------------------------------------------------------------------
+// a bus with a device at every address
+int i2cOpen(unsigned bus, unsigned addr, unsigned flags)
+{
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int i2cClose(unsigned handle)
+{
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// one transaction, its bytes counted
+int i2cWriteDevice(unsigned handle, char *buf, unsigned count)
+{
+    mock_i2c_writes++;
+    mock_i2c_bytes += count;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int i2cWriteByte(unsigned handle, unsigned byte)
+{
+    mock_i2c_writes++;
+    mock_i2c_bytes++;
+    return 0;
+}
@@ -0,0 +1,210 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "image.h"
+#include "motion.h"
+
+// a 640x424 live view decoded at 1/4 is a 160x106 luma plane, compared
+// in 8x8 blocks
+#define MOTION_SCALE      4
+#define MOTION_BLOCK      8
+
+// a block changed when its mean absolute difference exceeds this
+#define MOTION_LEVEL     12
+
+// the scene changed when at least this per mille of the blocks did
+#define MOTION_AREA      15
+
+// previews used to build the background before triggering
+#define MOTION_WARMUP     4
+
+static struct Image bg = { 0, 0, 1, NULL, 0 };
+static struct Image cur;    // the preview being looked at, reused
+static uint32_t *sums = NULL;
+static int warmup = 0;
+
+// instrumentation
+static long nr_previews = 0;
+static long nr_triggers = 0;
+static double preview_time = 0;
+static double latency_total = 0, latency_max = 0;
+static struct timeval trigger_grab;
+
+//-----------------------------------------------------------------------------
+
+static double elapsed(const struct timeval *start) 
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+//-----------------------------------------------------------------------------
+// adds the absolute differences of one row to the per block sums, two
+// 8 pixel blocks at a time
+static void row_sad(uint32_t *sum, const uint8_t *a, const uint8_t *b, int nblocks)
+{
+    int i = 0, x;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for (; i + 2 <= nblocks; i += 2) 
+    {
+        uint8x16_t d = vabdq_u8(vld1q_u8(a + i * 8), vld1q_u8(b + i * 8));
+        uint64x2_t s = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(d)));
+
+        sum[i]     += vgetq_lane_u64(s, 0);
+        sum[i + 1] += vgetq_lane_u64(s, 1);
+    }
+#elif defined(__SSE2__)
+    for (; i + 2 <= nblocks; i += 2) 
+    {
+        __m128i s = _mm_sad_epu8(_mm_loadu_si128((const __m128i *) (a + i * 8)),
+                                 _mm_loadu_si128((const __m128i *) (b + i * 8)));
+
+        sum[i]     += _mm_cvtsi128_si32(s);
+        sum[i + 1] += _mm_cvtsi128_si32(_mm_srli_si128(s, 8));
+    }
+#endif
+
+    for (; i < nblocks; i++)
+        for (x = i * 8; x < i * 8 + 8; x++)
+            sum[i] += (a[x] > b[x]) ? a[x] - b[x] : b[x] - a[x];
+}
+
+//-----------------------------------------------------------------------------
+// moves the background a quarter of the way towards the current frame
+static void blend(uint8_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for (; i + 16 <= n; i += 16) 
+    {
+        uint8x16_t b = vld1q_u8(dst + i);
+        vst1q_u8(dst + i, vrhaddq_u8(b, vrhaddq_u8(b, vld1q_u8(src + i))));
+    }
+#elif defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) 
+    {
+        __m128i b = _mm_loadu_si128((const __m128i *) (dst + i));
+        __m128i c = _mm_loadu_si128((const __m128i *) (src + i));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_avg_epu8(b, _mm_avg_epu8(b, c)));
+    }
+#endif
+
+    for (; i < n; i++)
+        dst[i] = (dst[i] * 3 + src[i] + 2) >> 2;
+}
+
+//-----------------------------------------------------------------------------
+
+void motion_reset( void ) 
+{
+    image_free(&bg);
+    image_free(&cur);
+    free(sums);
+    sums = NULL;
+    warmup = MOTION_WARMUP;
+
+    nr_previews = 0;
+    nr_triggers = 0;
+    preview_time = 0;
+    latency_total = latency_max = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int motion_feed(const uint8_t *jpeg, size_t size, const struct timeval *grabbed)
+{
+    int bw, bh, bx, by, y, changed = 0;
+    size_t n;
+
+    if (image_reload_mem(jpeg, size, MOTION_SCALE, 1, &cur) < 0)
+        return -1;
+
+    n = (size_t) cur.width * cur.height;
+    bw = cur.width / MOTION_BLOCK;
+    bh = cur.height / MOTION_BLOCK;
+
+    // (re)start from this frame when the live view size changes, its
+    // buffer becomes the background and the next preview gets a new one
+    if (bg.pix == NULL || bg.width != cur.width || bg.height != cur.height) 
+    {
+        image_free(&bg);
+        free(sums);
+
+        // without it no background either, the next preview tries again
+        sums = malloc(bw * sizeof(uint32_t));
+        if (sums == NULL && bw > 0) 
+            return -1;
+
+        bg = cur;
+        memset(&cur, 0, sizeof(cur));
+        warmup = MOTION_WARMUP;
+        nr_previews++;
+        preview_time += elapsed(grabbed);
+        return 0;
+    }
+
+    for (by = 0; by < bh; by++) 
+    {
+        memset(sums, 0, bw * sizeof(uint32_t));
+        for (y = by * MOTION_BLOCK; y < (by + 1) * MOTION_BLOCK; y++)
+            row_sad(sums, cur.pix + (size_t) y * cur.width, bg.pix + (size_t) y * bg.width, bw);
+
+        for (bx = 0; bx < bw; bx++)
+            if (sums[bx] > MOTION_LEVEL * MOTION_BLOCK * MOTION_BLOCK)
+                changed++;
+    }
+
+    nr_previews++;
+
+    if (warmup == 0 && changed * 1000 >= bw * bh * MOTION_AREA) 
+    {
+        // the new scene is the background, a lasting change fires once
+        memcpy(bg.pix, cur.pix, n);
+        trigger_grab = *grabbed;
+        nr_triggers++;
+        preview_time += elapsed(grabbed);
+        return 1;
+    }
+
+    if (warmup > 0) warmup--;
+    blend(bg.pix, cur.pix, n);
+    preview_time += elapsed(grabbed);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+void motion_captured( void ) 
+{
+    double latency = elapsed(&trigger_grab);
+
+    latency_total += latency;
+    if (latency > latency_max) latency_max = latency;
+}
+
+//-----------------------------------------------------------------------------
+
+void motion_report( void ) 
+{
+    if (nr_previews == 0) return;
+
+    printf("Motion: %ld previews, %.1f previews/s, %ld triggers\n", 
+           nr_previews, preview_time > 0 ? nr_previews / preview_time : 0.0, nr_triggers);
+
+    if (nr_triggers > 0)
+        printf("Motion: detection latency %.3f s avg, %.3f s max\n", 
+               latency_total / nr_triggers, latency_max);
+}
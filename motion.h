@@ -0,0 +1,20 @@
+#ifndef __MOTION_H__
+#define __MOTION_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+// forget the background and the statistics of the last run
+void motion_reset(void);
+
+// compares a live view jpeg grabbed at 'grabbed' with the background,
+// returns 1 when the scene changed, 0 if not, -1 if it can't be decoded
+int  motion_feed(const uint8_t *jpeg, size_t size, const struct timeval *grabbed);
+
+// call right before the triggered capture to record detection latency
+void motion_captured(void);
+
+void motion_report(void);
+
+#endif
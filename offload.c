@@ -0,0 +1,644 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/time.h>
+
+#include "crc32c.h"
+#include "offload.h"
+#include "prof.h"
+#include "tlog.h"
+
+// bytes per copy call, large enough for sequential i/o on the card and
+// the mount, small enough to stop quickly before a capture
+#define CHUNK_BYTES (1 << 20)
+
+// seconds before a scheduled frame when copying stops
+#define OFFLOAD_GUARD 2
+
+// the catch-up scan leaves half of the queue for new frames
+#define QUEUE_SIZE 1024
+
+struct Job
+{
+    long frame;
+    long long size;
+    uint32_t crc;
+    int has_crc;
+    char path[PATH_MAX];
+};
+
+static volatile int thread_done = 1;
+static pthread_t thread;
+static pthread_mutex_t mutex;
+static pthread_cond_t condw; // worker
+
+static struct Job jobs[QUEUE_SIZE];
+static unsigned head = 0, tail = 0;
+static long long backlog = 0;
+
+static char src_dir[PATH_MAX];
+static char dst_dir[PATH_MAX - 32];
+static int scan_pending = 0;
+
+// the catch-up walk, a batch at a time, on when the queue has drained.
+// Frames newer than 'scan_before' are this run's
+#define SCAN_BATCH (QUEUE_SIZE / 2)
+
+struct Found
+{
+    long long size;
+    char name[NAME_MAX + 1];
+};
+
+static DIR *walk = NULL;
+static struct Found found[SCAN_BATCH];
+static int nr_found = 0, next_found = 0;
+static int scan_more = 0;
+static time_t scan_before = 0;
+static long scan_total = 0;
+
+// token bucket in bytes, refilled at 'rate' bytes/s up to one second
+// worth, or a chunk if that's more
+static double rate = 0, tokens = 0;
+static struct timeval refilled;
+
+// what the capture thread is up to
+static time_t deadline = 0;
+static int hold = 0;
+
+// read buffer of the checks, only the offload thread uses it
+static uint8_t buf[CHUNK_BYTES];
+
+// throughput, and copies that didn't match their checksum
+static long nr_files = 0, nr_failed = 0, nr_backoffs = 0, nr_corrupt = 0;
+static long long nr_bytes = 0;
+static double copy_secs = 0, wait_secs = 0;
+
+//-----------------------------------------------------------------------------
+
+static double elapsed(const struct timeval *t) 
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - t->tv_sec) + (now.tv_usec - t->tv_usec) / 1e6;
+}
+
+//-----------------------------------------------------------------------------
+// waits until 'n' bytes may go out: not while a capture is near or
+// running, and no faster than 'rate'. Called with 'mutex' held, returns
+// -1 when stopping
+static int throttle(size_t n)
+{
+    struct timeval now, start;
+    struct timespec ts;
+    double wait, burst;
+    int quiet, backed_off = 0;
+
+    gettimeofday(&start, NULL);
+
+    while (!thread_done) 
+    {
+        gettimeofday(&now, NULL);
+        quiet = hold || (deadline != 0 && now.tv_sec >= deadline - OFFLOAD_GUARD);
+
+        if (quiet) 
+        {
+            // until the capture thread moves on, it signals
+            if (!backed_off) nr_backoffs++;
+            backed_off = 1;
+            wait = 1.0;
+        }
+        else if (rate <= 0) 
+        {
+            break;
+        }
+        else 
+        {
+            burst = (rate > CHUNK_BYTES) ? rate : CHUNK_BYTES;
+            tokens += rate * elapsed(&refilled);
+            if (tokens > burst) tokens = burst;
+            refilled = now;
+
+            if (tokens >= n) 
+            {
+                tokens -= n;
+                break;
+            }
+            wait = (n - tokens) / rate;
+        }
+
+        ts.tv_sec = now.tv_sec + (long) wait;
+        ts.tv_nsec = now.tv_usec * 1000 + (long) ((wait - (long) wait) * 1e9);
+        if (ts.tv_nsec >= 1000000000) 
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&condw, &mutex, &ts);
+        prof_wakeup();
+    }
+
+    wait_secs += elapsed(&start);
+    return thread_done ? -1 : 0;
+}
+
+//-----------------------------------------------------------------------------
+// checksums 'size' bytes of 'fd', paced like the copy; -1 when stopping
+// or if the file can't be read
+static int checksum(int fd, off_t size, uint32_t *crc)
+{
+    off_t off = 0;
+    ssize_t n;
+    size_t len;
+
+    *crc = 0;
+    while (off < size) 
+    {
+        len = (size - off > CHUNK_BYTES) ? CHUNK_BYTES : size - off;
+
+        pthread_mutex_lock(&mutex);
+        n = throttle(len);
+        pthread_mutex_unlock(&mutex);
+        if (n < 0) 
+            return -1;
+
+        n = pread(fd, buf, len, off);
+        if (n <= 0) 
+            return -1;
+
+        *crc = crc32c(*crc, buf, n);
+        off += n;
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// reads the copy back from the target and compares it with the download,
+// or with the local file if there's no checksum of the download
+static int verify(const struct Job *job, int in, off_t size, const char *tmp)
+{
+    uint32_t want, got, local;
+    int fd, ret;
+
+    if (job->has_crc) 
+        want = job->crc;
+    else if (checksum(in, size, &want) < 0)
+        return -1;
+
+    fd = open(tmp, O_RDONLY);
+    if (fd < 0) 
+        return -1;
+
+    // the pages are clean after fdatasync(), dropping them makes the
+    // read go to the target
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ret = checksum(fd, size, &got);
+    close(fd);
+
+    if (ret < 0 || got == want)
+        return ret;
+
+    // tell a bad copy from a local file that changed since the download
+    if (job->has_crc && checksum(in, size, &local) == 0 && local == got)
+        tlog_error("offload: %s: local copy is corrupt, crc %08x instead of %08x\n", job->path, local, want);
+    else
+        tlog_error("offload: %s: copy on the target is corrupt, crc %08x instead of %08x\n", job->path, got, want);
+
+    pthread_mutex_lock(&mutex);
+    nr_corrupt++;
+    pthread_mutex_unlock(&mutex);
+
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// copies a file into 'dst_dir' under a temporary name, renamed once it's
+// on the target and checked; a file of the same size already there
+// counts as synced
+static int copy_file(const struct Job *job)
+{
+    const char *path = job->path;
+    char dst[PATH_MAX], tmp[PATH_MAX];
+    const char *name;
+    struct timeval start;
+    struct stat st, dt;
+    off_t off = 0;
+    ssize_t n;
+    size_t len;
+    int in, out, ret = -1, use_cfr = 1;
+
+    name = strrchr(path, '/');
+    name = (name != NULL) ? name + 1 : path;
+
+    if (snprintf(dst, sizeof(dst), "%s/%s", dst_dir, name) >= (int) sizeof(dst) ||
+        snprintf(tmp, sizeof(tmp), "%s/.%s.part", dst_dir, name) >= (int) sizeof(tmp))
+        return -1;
+
+    in = open(path, O_RDONLY);
+    if (in < 0) 
+    {
+        // dropped as a duplicate meanwhile
+        return (errno == ENOENT) ? 0 : -1;
+    }
+
+    if (fstat(in, &st) < 0) 
+    {
+        close(in);
+        return -1;
+    }
+
+    if (stat(dst, &dt) == 0 && dt.st_size == st.st_size) 
+    {
+        close(in);
+        return 0;
+    }
+
+    out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) 
+    {
+        tlog_error("offload: %s: %s\n", tmp, strerror(errno));
+        close(in);
+        return -1;
+    }
+
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+    gettimeofday(&start, NULL);
+
+    while (off < st.st_size) 
+    {
+        len = (st.st_size - off > CHUNK_BYTES) ? CHUNK_BYTES : st.st_size - off;
+
+        pthread_mutex_lock(&mutex);
+        n = throttle(len);
+        pthread_mutex_unlock(&mutex);
+        if (n < 0) 
+            goto out;
+
+        // in-kernel copy, sendfile where the filesystems don't allow it
+        if (use_cfr) 
+        {
+            n = copy_file_range(in, &off, out, NULL, len, 0);
+            if (n < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) 
+            {
+                use_cfr = 0;
+                continue;
+            }
+        }
+        else 
+        {
+            n = sendfile(out, in, &off, len);
+        }
+
+        if (n <= 0) 
+        {
+            tlog_error("offload: copying %s: %s\n", path, n < 0 ? strerror(errno) : "short file");
+            goto out;
+        }
+
+        pthread_mutex_lock(&mutex);
+        nr_bytes += n;
+        pthread_mutex_unlock(&mutex);
+    }
+
+    if (fdatasync(out) < 0) 
+    {
+        tlog_error("offload: %s: %s\n", tmp, strerror(errno));
+        goto out;
+    }
+
+    if (verify(job, in, st.st_size, tmp) < 0)
+        goto out;
+
+    if (rename(tmp, dst) < 0) 
+    {
+        tlog_error("offload: %s: %s\n", dst, strerror(errno));
+        goto out;
+    }
+
+    // the frame won't be read again soon
+    posix_fadvise(in, 0, 0, POSIX_FADV_DONTNEED);
+    ret = 0;
+out:
+    pthread_mutex_lock(&mutex);
+    copy_secs += elapsed(&start);
+    pthread_mutex_unlock(&mutex);
+    close(out);
+    close(in);
+    if (ret < 0) 
+        unlink(tmp);
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+
+static int push(long frame, const char *path, const uint32_t *crc, long long size, unsigned limit)
+{
+    if (tail - head >= limit)
+        return -1;
+
+    jobs[tail % QUEUE_SIZE].frame = frame;
+    jobs[tail % QUEUE_SIZE].crc = (crc != NULL) ? *crc : 0;
+    jobs[tail % QUEUE_SIZE].has_crc = (crc != NULL);
+    jobs[tail % QUEUE_SIZE].size = size;
+    snprintf(jobs[tail % QUEUE_SIZE].path, PATH_MAX, "%s", path);
+    backlog += size;
+    tail++;
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// reads on in the walk for up to SCAN_BATCH frames of earlier runs that
+// aren't on the target yet. Only the offload thread walks, without the
+// lock: the stat()s may be on a slow mount
+static void walk_on(const char *from, const char *to, time_t before)
+{
+    char path[PATH_MAX], dst[PATH_MAX];
+    struct stat st, dt;
+    struct dirent *de;
+
+    nr_found = next_found = 0;
+
+    while (nr_found < SCAN_BATCH && (de = readdir(walk)) != NULL) 
+    {
+        // composites and contact sheets are rewritten, not frames
+        if (de->d_name[0] == '.' || strncmp(de->d_name, "composite", 9) == 0)
+            continue;
+
+        if (snprintf(path, sizeof(path), "%s/%s", from, de->d_name) >= (int) sizeof(path) ||
+            snprintf(dst, sizeof(dst), "%s/%s", to, de->d_name) >= (int) sizeof(dst))
+            continue;
+
+        // frames of this run come from offload_submit()
+        if (stat(path, &st) < 0 || !S_ISREG(st.st_mode) || st.st_mtime >= before)
+            continue;
+        if (stat(dst, &dt) == 0 && dt.st_size == st.st_size)
+            continue;
+
+        snprintf(found[nr_found].name, sizeof(found[nr_found].name), "%s", de->d_name);
+        found[nr_found].size = st.st_size;
+        nr_found++;
+    }
+
+    if (de == NULL) 
+    {
+        closedir(walk);
+        walk = NULL;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// queues the next batch of the catch-up, a new walk on 'restart'; called
+// with 'mutex' held, dropped while the directory is read. Leaves
+// 'scan_more' set until the walk is done and all of it queued
+static void scan(int restart)
+{
+    char from[PATH_MAX], to[PATH_MAX], path[PATH_MAX];
+    time_t before = scan_before;
+
+    snprintf(from, sizeof(from), "%s", src_dir);
+    snprintf(to, sizeof(to), "%s", dst_dir);
+
+    if (restart) 
+    {
+        if (walk != NULL)
+            closedir(walk);
+        walk = opendir(from);
+        nr_found = next_found = 0;
+        scan_total = 0;
+    }
+
+    if (next_found == nr_found && walk != NULL) 
+    {
+        pthread_mutex_unlock(&mutex);
+        walk_on(from, to, before);
+        pthread_mutex_lock(&mutex);
+    }
+
+    // what doesn't fit waits for the queue to drain
+    for (; next_found < nr_found; next_found++) 
+    {
+        if (snprintf(path, sizeof(path), "%s/%s", from, found[next_found].name) >= (int) sizeof(path))
+            continue;
+        if (push(-1, path, NULL, found[next_found].size, QUEUE_SIZE / 2) < 0)
+            break;
+        scan_total++;
+    }
+
+    scan_more = (walk != NULL || next_found < nr_found);
+
+    if (!scan_more && scan_total > 0)
+        tlog_info("Offload: %ld earlier frames to catch up\n", scan_total);
+}
+
+//-----------------------------------------------------------------------------
+
+static void *offload_thread(void *arg) 
+{
+    struct Job job;
+    int ret, restart;
+
+    prof_thread("offload");
+    pthread_mutex_lock(&mutex);
+
+    while (1) 
+    {
+        while (!thread_done && head == tail && !scan_pending && !scan_more) 
+        {
+            pthread_cond_wait(&condw, &mutex);
+            prof_wakeup();
+        }
+        
+        if (thread_done) break;
+
+        if (scan_pending || (scan_more && head == tail)) 
+        {
+            restart = scan_pending;
+            scan_pending = scan_more = 0;
+            scan(restart);
+            continue;
+        }
+
+        job = jobs[head % QUEUE_SIZE];
+
+        // copy without the lock, the capture thread only queues
+        pthread_mutex_unlock(&mutex);
+        ret = copy_file(&job);
+        pthread_mutex_lock(&mutex);
+
+        if (ret == 0)
+            nr_files++;
+        else if (!thread_done)
+            nr_failed++;
+        head++;
+        backlog -= job.size;
+    }
+
+    pthread_mutex_unlock(&mutex);
+
+    if (walk != NULL)
+        closedir(walk);
+    walk = NULL;
+    prof_exit();
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+void offload_init( void ) 
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&condw, NULL);
+
+    thread_done = 0;
+    pthread_create(&thread, NULL, offload_thread, NULL);
+}
+
+//-----------------------------------------------------------------------------
+
+int offload_open(const char *dir, const char *target, long kbps) 
+{
+    if (mkdir(target, 0755) < 0 && errno != EEXIST) 
+    {
+        tlog_error("offload: %s: %s\n", target, strerror(errno));
+        return -1;
+    }
+
+    pthread_mutex_lock(&mutex);
+    snprintf(src_dir, sizeof(src_dir), "%s", dir);
+    snprintf(dst_dir, sizeof(dst_dir), "%s", target);
+    rate = kbps * 1024.0;
+    tokens = 0;
+    gettimeofday(&refilled, NULL);
+    nr_files = nr_failed = nr_backoffs = nr_corrupt = 0;
+    nr_bytes = 0;
+    copy_secs = wait_secs = 0;
+    scan_before = time(NULL);
+    scan_pending = 1;
+    pthread_cond_signal(&condw);
+    pthread_mutex_unlock(&mutex);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int offload_submit(long frame, const char *path, const uint32_t *crc) 
+{
+    struct stat st;
+    long long size;
+    int ret = -1;
+
+    size = (stat(path, &st) == 0) ? st.st_size : 0;
+
+    pthread_mutex_lock(&mutex);
+    if (dst_dir[0] != '\0') 
+    {
+        ret = push(frame, path, crc, size, QUEUE_SIZE);
+        if (ret == 0)
+            pthread_cond_signal(&condw);
+    }
+    pthread_mutex_unlock(&mutex);
+
+    // it stays local, the next run's scan picks it up
+    if (ret < 0 && dst_dir[0] != '\0')
+        tlog_error("offload: queue full, leaving %s\n", path);
+
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+
+void offload_deadline(time_t next) 
+{
+    pthread_mutex_lock(&mutex);
+    if (deadline != next) 
+    {
+        deadline = next;
+        pthread_cond_signal(&condw);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+//-----------------------------------------------------------------------------
+
+void offload_hold(int on) 
+{
+    pthread_mutex_lock(&mutex);
+    hold = on;
+    pthread_cond_signal(&condw);
+    pthread_mutex_unlock(&mutex);
+}
+
+//-----------------------------------------------------------------------------
+
+int offload_pending(long long *bytes, long long *copied) 
+{
+    int n;
+
+    pthread_mutex_lock(&mutex);
+    n = tail - head;
+    if (bytes != NULL)
+        *bytes = backlog;
+    if (copied != NULL)
+        *copied = nr_bytes;
+    pthread_mutex_unlock(&mutex);
+
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+
+void offload_close( void ) 
+{
+    long long bytes;
+    int n;
+
+    offload_deadline(0);
+
+    n = offload_pending(&bytes, NULL);
+
+    // speed of the copies themselves, and the time they were held back
+    pthread_mutex_lock(&mutex);
+    if (nr_files > 0 || nr_failed > 0)
+        tlog_info("Offload: %ld files, %.1f MB, %.2f MB/s, %ld failed (%ld corrupt), "
+                  "%ld backoffs, %.1f s waiting, %d files (%.1f MB) pending\n", 
+                  nr_files, nr_bytes / 1048576.0, 
+                  copy_secs > wait_secs ? nr_bytes / 1048576.0 / (copy_secs - wait_secs) : 0.0, 
+                  nr_failed, nr_corrupt, nr_backoffs, wait_secs, n, bytes / 1048576.0);
+    pthread_mutex_unlock(&mutex);
+}
+
+//-----------------------------------------------------------------------------
+
+void offload_destroy( void ) 
+{
+    long long bytes;
+    int n;
+
+    pthread_mutex_lock(&mutex);
+    thread_done = 1;
+    pthread_cond_signal(&condw);
+    pthread_mutex_unlock(&mutex);
+
+    pthread_join(thread, NULL);
+
+    n = offload_pending(&bytes, NULL);
+    if (n > 0)
+        tlog_info("Offload: %d files (%.1f MB) left for the next run\n", n, bytes / 1048576.0);
+
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&condw);
+}
@@ -0,0 +1,30 @@
+#ifndef __OFFLOAD_H__
+#define __OFFLOAD_H__
+
+#include <stdint.h>
+#include <time.h>
+
+void offload_init(void);
+void offload_destroy(void);
+
+// syncs frames from 'dir' to 'target', starting with those a previous
+// run left behind; 'rate' caps the copy in KB/s, 0 for no cap
+int  offload_open(const char *dir, const char *target, long rate);
+
+// queue a finished file, returns -1 if the queue is full; 'crc' is its
+// checksum from the download, the copy on the target is checked against
+// it. NULL for files made here, their local copy is the reference
+int  offload_submit(long frame, const char *path, const uint32_t *crc);
+
+// copying pauses shortly before 'next', 0 when there's no schedule,
+// and while 'hold' is set around a capture
+void offload_deadline(time_t next);
+void offload_hold(int hold);
+
+// files and bytes waiting and bytes copied, for monitoring
+int  offload_pending(long long *bytes, long long *copied);
+
+// print throughput, the queue is left to finish in the background
+void offload_close(void);
+
+#endif
@@ -0,0 +1,234 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include "image.h"
+#include "phash.h"
+#include "tlog.h"
+
+// luma is decoded at 1/8, shrunk to 32x32 and the lowest 8x8 dct
+// frequencies give the 64 bits of the hash
+#define PHASH_SCALE     8
+#define PHASH_SIZE     32
+#define PHASH_LOW       8
+
+// frames within this many bits of a keeper are duplicates
+#define PHASH_DISTANCE  6
+
+// keepers remembered, a slow drift still adds a keeper now and then
+#define PHASH_KEEPERS  16
+
+// rows of the dct-ii basis, only the low frequencies are needed
+static float basis[PHASH_LOW][PHASH_SIZE];
+static int basis_ready = 0;
+
+static uint64_t keepers[PHASH_KEEPERS];
+static long keeper_frames[PHASH_KEEPERS];
+static int nr_keepers = 0, next_keeper = 0;
+
+// decoded frames, reused from one to the next; the capture thread is
+// the only caller
+static struct Image decoded;
+
+static long nr_hashed = 0, nr_duplicates = 0;
+static double decode_time = 0, hash_time = 0;
+
+//-----------------------------------------------------------------------------
+
+static double elapsed(const struct timeval *start) 
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+//-----------------------------------------------------------------------------
+// y += a * x over a row of PHASH_SIZE floats
+static void axpy(float *y, float a, const float *x)
+{
+    int i = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    float32x4_t va = vdupq_n_f32(a);
+    for (; i < PHASH_SIZE; i += 4)
+        vst1q_f32(y + i, vmlaq_f32(vld1q_f32(y + i), va, vld1q_f32(x + i)));
+#elif defined(__SSE__)
+    __m128 va = _mm_set1_ps(a);
+    for (; i < PHASH_SIZE; i += 4)
+        _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+#endif
+
+    for (; i < PHASH_SIZE; i++)
+        y[i] += a * x[i];
+}
+
+//-----------------------------------------------------------------------------
+
+static float dot(const float *a, const float *b)
+{
+    float s = 0;
+    int i = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    float32x4_t acc = vdupq_n_f32(0);
+    float t[4];
+    for (; i < PHASH_SIZE; i += 4)
+        acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+    vst1q_f32(t, acc);
+    s = t[0] + t[1] + t[2] + t[3];
+#elif defined(__SSE__)
+    __m128 acc = _mm_setzero_ps();
+    float t[4];
+    for (; i < PHASH_SIZE; i += 4)
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    _mm_storeu_ps(t, acc);
+    s = t[0] + t[1] + t[2] + t[3];
+#endif
+
+    for (; i < PHASH_SIZE; i++)
+        s += a[i] * b[i];
+
+    return s;
+}
+
+//-----------------------------------------------------------------------------
+
+static int cmp_float(const void *a, const void *b)
+{
+    float x = *(const float *) a, y = *(const float *) b;
+
+    return (x > y) - (x < y);
+}
+
+//-----------------------------------------------------------------------------
+
+static uint64_t hash(const struct Image *img)
+{
+    float cells[PHASH_SIZE][PHASH_SIZE];
+    float rows[PHASH_LOW][PHASH_SIZE];
+    float coef[PHASH_LOW * PHASH_LOW], sorted[PHASH_LOW * PHASH_LOW];
+    uint32_t sums[PHASH_SIZE];
+    float median;
+    uint64_t h = 0;
+    int x, y, cy, i, j, y0, y1;
+
+    if (!basis_ready) 
+    {
+        for (i = 0; i < PHASH_LOW; i++)
+            for (j = 0; j < PHASH_SIZE; j++)
+                basis[i][j] = cos(M_PI * i * (2 * j + 1) / (2.0 * PHASH_SIZE));
+        basis_ready = 1;
+    }
+
+    // box filter the luma plane down to 32x32 cells
+    for (cy = 0; cy < PHASH_SIZE; cy++) 
+    {
+        y0 = cy * img->height / PHASH_SIZE;
+        y1 = (cy + 1) * img->height / PHASH_SIZE;
+        memset(sums, 0, sizeof(sums));
+
+        for (y = y0; y < y1; y++) 
+        {
+            const uint8_t *row = img->pix + (size_t) y * img->width;
+            for (x = 0; x < img->width; x++)
+                sums[x * PHASH_SIZE / img->width] += row[x];
+        }
+
+        for (x = 0; x < PHASH_SIZE; x++)
+            cells[cy][x] = (float) sums[x];
+    }
+
+    // separable dct: rows = basis * cells, coef = rows * basis'
+    memset(rows, 0, sizeof(rows));
+    for (i = 0; i < PHASH_LOW; i++)
+        for (y = 0; y < PHASH_SIZE; y++)
+            axpy(rows[i], basis[i][y], cells[y]);
+
+    for (i = 0; i < PHASH_LOW; i++)
+        for (j = 0; j < PHASH_LOW; j++)
+            coef[i * PHASH_LOW + j] = dot(rows[i], basis[j]);
+
+    // one bit per coefficient above the median of the ac terms
+    memcpy(sorted, coef + 1, sizeof(float) * (PHASH_LOW * PHASH_LOW - 1));
+    qsort(sorted, PHASH_LOW * PHASH_LOW - 1, sizeof(float), cmp_float);
+    median = sorted[(PHASH_LOW * PHASH_LOW - 1) / 2];
+
+    for (i = 0; i < PHASH_LOW * PHASH_LOW; i++)
+        if (coef[i] > median)
+            h |= (uint64_t) 1 << i;
+
+    return h;
+}
+
+//-----------------------------------------------------------------------------
+
+void phash_reset( void ) 
+{
+    nr_keepers = next_keeper = 0;
+    nr_hashed = nr_duplicates = 0;
+    decode_time = hash_time = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int phash_frame(long frame, const char *path, uint64_t *out)
+{
+    struct timeval start;
+    uint64_t h;
+    int i, d, best = 64, match = -1;
+
+    gettimeofday(&start, NULL);
+    if (image_reload(path, PHASH_SCALE, 1, &decoded) < 0)
+        return -1;
+    decode_time += elapsed(&start);
+
+    gettimeofday(&start, NULL);
+    h = hash(&decoded);
+
+    for (i = 0; i < nr_keepers; i++) 
+    {
+        d = __builtin_popcountll(h ^ keepers[i]);
+        if (d < best) 
+        {
+            best = d;
+            match = i;
+        }
+    }
+    hash_time += elapsed(&start);
+    nr_hashed++;
+
+    if (out != NULL) *out = h;
+
+    if (match >= 0 && best <= PHASH_DISTANCE) 
+    {
+        tlog_info("Frame %ld matches frame %ld (distance %d)\n", frame, keeper_frames[match], best);
+        nr_duplicates++;
+        return 1;
+    }
+
+    keepers[next_keeper] = h;
+    keeper_frames[next_keeper] = frame;
+    next_keeper = (next_keeper + 1) % PHASH_KEEPERS;
+    if (nr_keepers < PHASH_KEEPERS) nr_keepers++;
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+void phash_report( void ) 
+{
+    if (nr_hashed == 0) return;
+
+    printf("Duplicates: %ld of %ld frames, decode %.1f ms, hash %.2f ms per frame\n", 
+           nr_duplicates, nr_hashed, 1000 * decode_time / nr_hashed, 1000 * hash_time / nr_hashed);
+}
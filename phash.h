@@ -0,0 +1,15 @@
+#ifndef __PHASH_H__
+#define __PHASH_H__
+
+#include <stdint.h>
+
+// forget the keepers and the statistics of the last run
+void phash_reset(void);
+
+// hashes a jpeg, returns 1 when it's within the hamming distance of a
+// recent keeper, 0 when it becomes a keeper itself, -1 on errors
+int  phash_frame(long frame, const char *path, uint64_t *hash);
+
+void phash_report(void);
+
+#endif
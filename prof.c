@@ -0,0 +1,208 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "prof.h"
+#include "tlog.h"
+
+// the energy proxy: a core kept busy costs about this above idle on a
+// Pi Zero 2 / 3 class board, and each wakeup about this much for
+// leaving and re-entering the idle state. Rough, but the same numbers
+// for every release
+#define CPU_WATTS     0.35
+#define WAKEUP_JOULES 50e-6
+
+// stretches shorter than this say nothing per hour, not reported
+#define REPORT_MIN_SECS 5
+
+static int enabled = 0;
+
+static struct ProfStat slots[PROF_MAX];
+static int nr_slots = 0;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// start of the stretch, and what the whole process had used by then
+static struct timeval since;
+static struct rusage self_since;
+
+// the calling thread's slot, and its usage when last accounted for
+static __thread struct ProfStat *mine;
+static __thread struct rusage seen;
+
+//-----------------------------------------------------------------------------
+
+static long long usecs(const struct timeval *tv)
+{
+    return tv->tv_sec * 1000000LL + tv->tv_usec;
+}
+
+//-----------------------------------------------------------------------------
+// what the thread used since the last call goes to its slot
+static void account(void)
+{
+    struct rusage now;
+
+    if (getrusage(RUSAGE_THREAD, &now) < 0)
+        return;
+
+    __atomic_fetch_add(&mine->vcsw, now.ru_nvcsw - seen.ru_nvcsw, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&mine->ivcsw, now.ru_nivcsw - seen.ru_nivcsw, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&mine->cpu_us, usecs(&now.ru_utime) - usecs(&seen.ru_utime) +
+                       usecs(&now.ru_stime) - usecs(&seen.ru_stime), __ATOMIC_RELAXED);
+    seen = now;
+}
+
+//-----------------------------------------------------------------------------
+
+void prof_enable(int on)
+{
+    enabled = on;
+    if (on)
+        prof_reset();
+}
+
+//-----------------------------------------------------------------------------
+
+void prof_thread(const char *name)
+{
+    int i;
+
+    if (!enabled)
+        return;
+
+    pthread_mutex_lock(&mutex);
+    for (i = 0; i < nr_slots && strcmp(slots[i].name, name) != 0; i++)
+        ;
+    if (i == nr_slots && nr_slots < PROF_MAX)
+        slots[nr_slots++].name = name;
+    mine = (i < nr_slots) ? &slots[i] : NULL;
+    pthread_mutex_unlock(&mutex);
+
+    if (mine == NULL)
+        return;
+
+    __atomic_fetch_add(&mine->threads, 1, __ATOMIC_RELAXED);
+    getrusage(RUSAGE_THREAD, &seen);
+}
+
+//-----------------------------------------------------------------------------
+
+void prof_exit(void)
+{
+    if (mine == NULL)
+        return;
+
+    account();
+    mine = NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+void prof_wakeup(void)
+{
+    if (mine == NULL)
+        return;
+
+    __atomic_fetch_add(&mine->wakeups, 1, __ATOMIC_RELAXED);
+    account();
+}
+
+//-----------------------------------------------------------------------------
+// the names stay, threads keep their slots across a reset
+void prof_reset(void)
+{
+    int i;
+
+    pthread_mutex_lock(&mutex);
+    for (i = 0; i < nr_slots; i++)
+    {
+        __atomic_store_n(&slots[i].threads, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&slots[i].wakeups, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&slots[i].vcsw, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&slots[i].ivcsw, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&slots[i].cpu_us, 0, __ATOMIC_RELAXED);
+    }
+    gettimeofday(&since, NULL);
+    getrusage(RUSAGE_SELF, &self_since);
+    pthread_mutex_unlock(&mutex);
+}
+
+//-----------------------------------------------------------------------------
+
+int prof_read(struct ProfStat *stats, int max, double *hours)
+{
+    struct timeval now;
+    int i, n;
+
+    pthread_mutex_lock(&mutex);
+    n = (nr_slots < max) ? nr_slots : max;
+    for (i = 0; i < n; i++)
+    {
+        stats[i].name = slots[i].name;
+        stats[i].threads = __atomic_load_n(&slots[i].threads, __ATOMIC_RELAXED);
+        stats[i].wakeups = __atomic_load_n(&slots[i].wakeups, __ATOMIC_RELAXED);
+        stats[i].vcsw = __atomic_load_n(&slots[i].vcsw, __ATOMIC_RELAXED);
+        stats[i].ivcsw = __atomic_load_n(&slots[i].ivcsw, __ATOMIC_RELAXED);
+        stats[i].cpu_us = __atomic_load_n(&slots[i].cpu_us, __ATOMIC_RELAXED);
+    }
+
+    gettimeofday(&now, NULL);
+    *hours = (usecs(&now) - usecs(&since)) / 3.6e9;
+    pthread_mutex_unlock(&mutex);
+
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+
+double prof_joules(long wakeups, long long cpu_us, double hours)
+{
+    if (hours <= 0)
+        return 0;
+
+    return (cpu_us / 1e6 * CPU_WATTS + wakeups * WAKEUP_JOULES) / hours;
+}
+
+//-----------------------------------------------------------------------------
+
+void prof_report(const char *what)
+{
+    struct ProfStat st[PROF_MAX];
+    struct rusage self;
+    long long cpu_us;
+    long switches;
+    double hours;
+    int i, n;
+
+    if (!enabled)
+        return;
+
+    n = prof_read(st, PROF_MAX, &hours);
+    if (hours * 3600 < REPORT_MIN_SECS)
+        return;
+
+    for (i = 0; i < n; i++)
+    {
+        if (st[i].threads == 0 && st[i].wakeups == 0)
+            continue;
+
+        tlog_info("Profile %s: %-9s %ld started, %.0f wakeups/h, %.0f+%.0f switches/h, "
+                  "%.2f cpu s/h, %.1f J/h\n", what, st[i].name, st[i].threads,
+                  st[i].wakeups / hours, st[i].vcsw / hours, st[i].ivcsw / hours,
+                  st[i].cpu_us / 1e6 / hours, prof_joules(st[i].wakeups, st[i].cpu_us, hours));
+    }
+
+    // the threads of pigpio and libgphoto2 too; every blocking switch is
+    // a wakeup later
+    if (getrusage(RUSAGE_SELF, &self) < 0)
+        return;
+
+    cpu_us = usecs(&self.ru_utime) - usecs(&self_since.ru_utime) +
+             usecs(&self.ru_stime) - usecs(&self_since.ru_stime);
+    switches = self.ru_nvcsw - self_since.ru_nvcsw;
+    tlog_info("Profile %s: process over %.2f h, %.0f wakeups/h, %.2f cpu s/h, %.1f J/h (%.1f mW)\n",
+              what, hours, switches / hours, cpu_us / 1e6 / hours,
+              prof_joules(switches, cpu_us, hours), prof_joules(switches, cpu_us, hours) / 3.6);
+}
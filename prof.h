@@ -0,0 +1,44 @@
+#ifndef __PROF_H__
+#define __PROF_H__
+
+// what the program costs while it waits: wakeups, context switches and
+// cpu time per thread, summed over the threads of one name ("capture",
+// "fadeout", "thumb", ...), to hold idle power to a number. Off unless
+// enabled, then every wakeup costs one getrusage()
+
+#define PROF_MAX 16
+
+struct ProfStat
+{
+    const char *name;
+    long threads;           // started since the reset
+    long wakeups;           // returns from a wait or a poll
+    long vcsw;              // context switches, blocking
+    long ivcsw;             // context switches, preempted
+    long long cpu_us;       // user + system
+};
+
+// before the threads to watch are started
+void prof_enable(int on);
+
+// 'name' is a literal, called first thing in a thread function and
+// before it returns
+void prof_thread(const char *name);
+void prof_exit(void);
+
+// after each wait or poll of the calling thread comes back
+void prof_wakeup(void);
+
+// counters to zero; up to 'max' of them since the reset and the hours
+// they cover, the number copied returned
+void prof_reset(void);
+int  prof_read(struct ProfStat *stats, int max, double *hours);
+
+// energy proxy in joules an hour above idle
+double prof_joules(long wakeups, long long cpu_us, double hours);
+
+// one line per thread name and the whole process, 'what' names the
+// stretch ("idle", "run")
+void prof_report(const char *what);
+
+#endif
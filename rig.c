@@ -0,0 +1,467 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <gphoto2/gphoto2-camera.h>
+#include <gphoto2/gphoto2-abilities-list.h>
+#include <gphoto2/gphoto2-port-info-list.h>
+
+#include "camcache.h"
+#include "download.h"
+#include "offload.h"
+#include "prof.h"
+#include "rig.h"
+#include "sync.h"
+#include "tlog.h"
+#include "watchdog.h"
+
+// a worker this late for a trigger skips it, a frame that far off isn't
+// part of the set anymore
+#define LATE_LIMIT_MS 250
+
+// seconds a camera call may take before the watchdog cancels it
+#define TIMEOUT_CAPTURE  60
+#define TIMEOUT_INIT     30
+#define TIMEOUT_EXIT     10
+
+struct Body
+{
+    int index;
+    Camera *camera;
+    CameraAbilities abilities;
+    char port[128];
+    pthread_t thread;
+
+    // trigger times against the deadline, in ms
+    long shots, missed, errors;
+    double skew_sum, skew_min, skew_max;
+};
+
+// body 0 is the primary camera, camera.c drives it
+static struct Body bodies[RIG_MAX];
+static int nr_bodies = 1;
+
+static GPContext *context;
+static char out_dir[PATH_MAX];
+static int previews;
+
+static volatile int thread_done = 1;
+static pthread_mutex_t mutex;
+static pthread_cond_t cond;
+
+// the shared schedule, and the last one-shot trigger
+static time_t sched_start;
+static long sched_interval = 0;
+static long sched_frames = 0;
+static long shot_frame;
+static struct timespec shot_at;
+static unsigned long shot_seq = 0;
+
+//-----------------------------------------------------------------------------
+
+static double ms_after(const struct timespec *t, const struct timespec *due)
+{
+    return (t->tv_sec - due->tv_sec) * 1e3 + (t->tv_nsec - due->tv_nsec) / 1e6;
+}
+
+//-----------------------------------------------------------------------------
+
+static void account(struct Body *b, long frame, double skew)
+{
+    if (b->shots == 0 || skew < b->skew_min) b->skew_min = skew;
+    if (b->shots == 0 || skew > b->skew_max) b->skew_max = skew;
+    b->skew_sum += skew;
+    b->shots++;
+
+    tlog_info("cam%d frame %ld skew %+.2f ms\n", b->index, frame, skew);
+}
+
+//-----------------------------------------------------------------------------
+// a session of its own, with the model and port autodetection found
+static int open_body(struct Body *b)
+{
+    int ret;
+
+    gp_camera_new(&b->camera);
+
+    ret = gp_camera_set_abilities(b->camera, b->abilities);
+    if (ret >= GP_OK)
+        ret = camcache_port(b->camera, b->port);
+
+    if (ret >= GP_OK)
+    {
+        watchdog_arm("gp_camera_init", TIMEOUT_INIT);
+        ret = gp_camera_init(b->camera, context);
+        watchdog_disarm(ret);
+    }
+
+    if (ret < GP_OK)
+    {
+        tlog_error("cam%d: %s on %s failed: %d\n", b->index, b->abilities.model, b->port, ret);
+        gp_camera_unref(b->camera);
+        b->camera = NULL;
+        return ret;
+    }
+
+    tlog_info("cam%d: %s on %s\n", b->index, b->abilities.model, b->port);
+    return GP_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+static void close_body(struct Body *b)
+{
+    watchdog_arm("gp_camera_exit", TIMEOUT_EXIT);
+    watchdog_disarm(gp_camera_exit(b->camera, context));
+    gp_camera_unref(b->camera);
+    b->camera = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// the card names of different bodies collide, the camera number keeps
+// them apart on the disk and the nas
+static int download(struct Body *b, long frame, CameraFilePath *path)
+{
+    char local[PATH_MAX], prefix[16];
+    CameraFileType type = previews ? GP_FILE_TYPE_PREVIEW : GP_FILE_TYPE_NORMAL;
+    struct Transfer t;
+    int ret;
+
+    snprintf(prefix, sizeof(prefix), "cam%d_", b->index);
+    if (download_path(local, sizeof(local), out_dir, prefix, path, type) < 0)
+        return GP_ERROR;
+
+    ret = download_file(b->camera, context, path, type, local, NULL, &t);
+
+    // a body without previews sends its full files
+    if (ret == GP_ERROR_NOT_SUPPORTED && type == GP_FILE_TYPE_PREVIEW &&
+        download_path(local, sizeof(local), out_dir, prefix, path, GP_FILE_TYPE_NORMAL) == 0)
+        ret = download_file(b->camera, context, path, GP_FILE_TYPE_NORMAL, local, NULL, &t);
+    if (ret < GP_OK)
+        return ret;
+
+    offload_submit(frame, local, &t.crc);
+    return GP_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+static void fire(struct Body *b, long frame, const struct timespec *due)
+{
+    CameraFilePath path;
+    struct timespec fired;
+    int ret;
+
+    // lost after an error, try again for the next trigger
+    if (b->camera == NULL)
+    {
+        b->missed++;
+        open_body(b);
+        return;
+    }
+
+    sync_clock(&fired);
+    watchdog_arm("gp_camera_capture", TIMEOUT_CAPTURE);
+    ret = gp_camera_capture(b->camera, GP_CAPTURE_IMAGE, &path, context);
+    watchdog_disarm(ret);
+
+    account(b, frame, ms_after(&fired, due));
+
+    if (ret == GP_OK && out_dir[0] != '\0')
+        ret = download(b, frame, &path);
+    if (ret == GP_OK)
+        return;
+
+    // a fresh session before the next trigger, nobody else waits for it
+    b->errors++;
+    tlog_error("cam%d: frame %ld failed: %d, reopening\n", b->index, frame, ret);
+    close_body(b);
+    open_body(b);
+}
+
+//-----------------------------------------------------------------------------
+// the next trigger of a worker that fired slot 'last' and has seen one-shot
+// 'seen': 1 for a slot, 2 for a one-shot, 0 if nothing is due; called with
+// 'mutex' held
+static int next_due(struct Body *b, long *last, unsigned long *seen, long *frame, struct timespec *due)
+{
+    struct timespec now;
+    long long behind;
+    long k, first;
+
+    if (shot_seq != *seen)
+    {
+        *seen = shot_seq;
+        *frame = shot_frame;
+        *due = shot_at;
+        return 2;
+    }
+
+    if (sched_interval == 0)
+        return 0;
+
+    // slots that went by while the camera was busy are skipped, at the
+    // start of a resumed run they are just history
+    sync_clock(&now);
+    k = *last + 1;
+    behind = ((long long) now.tv_sec - sched_start) * 1000 + now.tv_nsec / 1000000 - LATE_LIMIT_MS;
+    if (behind > 0)
+    {
+        first = (behind + sched_interval * 1000 - 1) / (sched_interval * 1000);
+        if (sched_frames > 0 && first > sched_frames)
+            first = sched_frames;
+        if (first > k)
+        {
+            if (*last >= 0)
+                b->missed += first - k;
+            *last = first - 1;
+            k = first;
+        }
+    }
+
+    if (sched_frames > 0 && k >= sched_frames)
+        return 0;
+
+    *frame = k;
+    due->tv_sec = sched_start + k * sched_interval;
+    due->tv_nsec = 0;
+    return 1;
+}
+
+//-----------------------------------------------------------------------------
+// each body sleeps to the deadline by itself, so a slow one only misses
+// its own triggers
+static void *rig_thread(void *arg)
+{
+    struct Body *b = (struct Body *) arg;
+    struct timespec due, now, wait;
+    unsigned long seen;
+    long frame, last = -1;
+    int kind;
+
+    prof_thread("rig");
+    open_body(b);
+
+    pthread_mutex_lock(&mutex);
+    seen = shot_seq;
+
+    while (!thread_done)
+    {
+        kind = next_due(b, &last, &seen, &frame, &due);
+        if (kind == 0)
+        {
+            pthread_cond_wait(&cond, &mutex);
+            prof_wakeup();
+            continue;
+        }
+
+        // a new schedule or stopping wakes it early
+        sync_clock(&now);
+        if (kind == 1 && ms_after(&now, &due) < 0)
+        {
+            wait = due;
+            sync_local(&wait);
+            pthread_cond_timedwait(&cond, &mutex, &wait);
+            prof_wakeup();
+            continue;
+        }
+
+        if (kind == 1)
+            last = frame;
+
+        if (ms_after(&now, &due) > LATE_LIMIT_MS)
+        {
+            b->missed++;
+            continue;
+        }
+
+        pthread_mutex_unlock(&mutex);
+        fire(b, frame, &due);
+        pthread_mutex_lock(&mutex);
+    }
+
+    pthread_mutex_unlock(&mutex);
+
+    if (b->camera != NULL)
+        close_body(b);
+
+    prof_exit();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+void rig_init(void)
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+}
+
+//-----------------------------------------------------------------------------
+
+void rig_destroy(void)
+{
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&cond);
+}
+
+//-----------------------------------------------------------------------------
+
+int rig_open(Camera *primary, GPContext *ctx, int count, const char *outdir, int preview)
+{
+    CameraAbilitiesList *abilities = NULL;
+    CameraList *list = NULL;
+    struct Body *b;
+    GPPortInfo info;
+    const char *model, *port;
+    char *own = "";
+    int i, n = 0, index;
+
+    memset(bodies, 0, sizeof(bodies));
+    nr_bodies = 1;
+    sched_interval = 0;
+    context = ctx;
+    snprintf(out_dir, sizeof(out_dir), "%s", (outdir != NULL) ? outdir : "");
+    previews = preview;
+
+    if (count > RIG_MAX)
+        count = RIG_MAX;
+    if (count < 2)
+        return 1;
+
+    // the primary camera is open already, any other one joins the rig
+    if (gp_camera_get_port_info(primary, &info) < GP_OK || gp_port_info_get_path(info, &own) < GP_OK)
+        own = "";
+
+    if (gp_list_new(&list) >= GP_OK && gp_abilities_list_new(&abilities) >= GP_OK &&
+        gp_abilities_list_load(abilities, context) >= GP_OK &&
+        gp_camera_autodetect(list, context) >= GP_OK)
+        n = gp_list_count(list);
+
+    for (i = 0; i < n && nr_bodies < count; i++)
+    {
+        if (gp_list_get_name(list, i, &model) < GP_OK || gp_list_get_value(list, i, &port) < GP_OK)
+            continue;
+        if (strcmp(port, own) == 0)
+            continue;
+
+        b = &bodies[nr_bodies];
+        index = gp_abilities_list_lookup_model(abilities, model);
+        if (index < GP_OK || gp_abilities_list_get_abilities(abilities, index, &b->abilities) < GP_OK)
+        {
+            tlog_error("rig: no driver for %s on %s\n", model, port);
+            continue;
+        }
+
+        b->index = nr_bodies;
+        snprintf(b->port, sizeof(b->port), "%s", port);
+        nr_bodies++;
+    }
+
+    if (abilities != NULL)
+        gp_abilities_list_free(abilities);
+    if (list != NULL)
+        gp_list_free(list);
+
+    if (nr_bodies < count)
+        tlog_error("rig: %d of %d cameras found\n", nr_bodies, count);
+
+    // the workers open their cameras in parallel, each init takes seconds
+    thread_done = 0;
+    for (i = 1; i < nr_bodies; i++)
+        pthread_create(&bodies[i].thread, NULL, rig_thread, &bodies[i]);
+
+    return nr_bodies;
+}
+
+//-----------------------------------------------------------------------------
+
+void rig_schedule(time_t start, long interval, long frames)
+{
+    if (nr_bodies < 2)
+        return;
+
+    pthread_mutex_lock(&mutex);
+    sched_start = start;
+    sched_interval = interval;
+    sched_frames = frames;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+}
+
+//-----------------------------------------------------------------------------
+
+void rig_trigger(long frame, const struct timeval *at)
+{
+    if (nr_bodies < 2)
+        return;
+
+    pthread_mutex_lock(&mutex);
+    shot_frame = frame;
+    shot_at.tv_sec = at->tv_sec;
+    shot_at.tv_nsec = at->tv_usec * 1000;
+    shot_seq++;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+}
+
+//-----------------------------------------------------------------------------
+
+void rig_taken(long frame, const struct timeval *due, const struct timeval *taken)
+{
+    struct timespec d, t;
+
+    if (nr_bodies < 2)
+        return;
+
+    d.tv_sec = due->tv_sec;
+    d.tv_nsec = due->tv_usec * 1000;
+    t.tv_sec = taken->tv_sec;
+    t.tv_nsec = taken->tv_usec * 1000;
+    account(&bodies[0], frame, ms_after(&t, &d));
+}
+
+//-----------------------------------------------------------------------------
+
+void rig_close(void)
+{
+    struct Body *b;
+    double lo = 0, hi = 0;
+    int i, any = 0;
+
+    if (nr_bodies < 2)
+        return;
+
+    pthread_mutex_lock(&mutex);
+    thread_done = 1;
+    sched_interval = 0;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+
+    // a worker in a camera call comes back once the watchdog cancels it
+    for (i = 1; i < nr_bodies; i++)
+        pthread_join(bodies[i].thread, NULL);
+
+    for (i = 0; i < nr_bodies; i++)
+    {
+        b = &bodies[i];
+        if (b->shots == 0)
+        {
+            tlog_info("Rig: cam%d no shots, %ld missed\n", i, b->missed);
+            continue;
+        }
+
+        tlog_info("Rig: cam%d %ld shots, skew avg %+.2f ms, %+.2f..%+.2f ms, %ld missed, %ld errors\n",
+               i, b->shots, b->skew_sum / b->shots, b->skew_min, b->skew_max, b->missed, b->errors);
+
+        if (!any || b->skew_min < lo) lo = b->skew_min;
+        if (!any || b->skew_max > hi) hi = b->skew_max;
+        any = 1;
+    }
+
+    if (any)
+        tlog_info("Rig: triggers within %.2f ms\n", hi - lo);
+    nr_bodies = 1;
+}
@@ -0,0 +1,34 @@
+#ifndef __RIG_H__
+#define __RIG_H__
+
+#include <sys/time.h>
+#include <time.h>
+#include <gphoto2/gphoto2-camera.h>
+
+// cameras fired together, the primary one included
+#define RIG_MAX 4
+
+void rig_init(void);
+void rig_destroy(void);
+
+// finds up to 'count' - 1 cameras besides 'primary' and starts a worker
+// with its own session for each; frames go to 'outdir' as camN_<name>,
+// only their previews if 'preview' is set. Returns the number of cameras
+// in the rig, 1 if there are no others
+int  rig_open(Camera *primary, GPContext *context, int count, const char *outdir, int preview);
+
+// interval runs: slot k is due at 'start' + k * 'interval' in the time
+// base of sync_clock(), the workers follow it on their own; 'frames'
+// slots, 0 for no limit
+void rig_schedule(time_t start, long interval, long frames);
+
+// motion runs: fires the workers once, right away
+void rig_trigger(long frame, const struct timeval *at);
+
+// the primary camera fired at 'taken' for 'frame' due at 'due'
+void rig_taken(long frame, const struct timeval *due, const struct timeval *taken);
+
+// stops the workers, closes their cameras and reports the skew
+void rig_close(void);
+
+#endif
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "status.h"
+
+// reads retried before giving up on a segment
+#define STATUS_TRIES 100000
+
+// writes go here until the segment is mapped, or if it can't be
+static struct Status scratch = { .magic = STATUS_MAGIC, .version = STATUS_VERSION };
+static struct Status *status = &scratch;
+
+//-----------------------------------------------------------------------------
+
+int status_open( void )
+{
+    struct Status *p;
+    int fd;
+
+    fd = shm_open(STATUS_SHM, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) 
+    {
+        perror("status shm_open");
+        return -1;
+    }
+
+    if (ftruncate(fd, sizeof(struct Status)) < 0) 
+    {
+        perror("status ftruncate");
+        close(fd);
+        return -1;
+    }
+
+    p = mmap(NULL, sizeof(struct Status), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) 
+    {
+        perror("status mmap");
+        return -1;
+    }
+
+    // a segment left by an older process: readers see it busy while
+    // it's reset
+    __atomic_store_n(&p->seq, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    scratch.magic = STATUS_MAGIC;
+    scratch.version = STATUS_VERSION;
+    scratch.seq = 1;
+    scratch.pid = getpid();
+    memcpy(p, &scratch, sizeof(*p));
+
+    __atomic_store_n(&p->seq, 2, __ATOMIC_RELEASE);
+
+    status = p;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+void status_close( void )
+{
+    if (status == &scratch)
+        return;
+
+    munmap(status, sizeof(struct Status));
+    shm_unlink(STATUS_SHM);
+    status = &scratch;
+}
+
+//-----------------------------------------------------------------------------
+// writers come from several threads, an odd 'seq' is also their lock
+struct Status *status_begin( void )
+{
+    uint32_t seq;
+
+    seq = __atomic_load_n(&status->seq, __ATOMIC_RELAXED);
+    for (;;) 
+    {
+        if ((seq & 1) == 0 && 
+            __atomic_compare_exchange_n(&status->seq, &seq, seq + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+        seq = __atomic_load_n(&status->seq, __ATOMIC_RELAXED);
+    }
+
+    // the fields mustn't be written before 'seq' turns odd
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    return status;
+}
+
+//-----------------------------------------------------------------------------
+
+void status_end( void )
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    status->updated_us = (int64_t) now.tv_sec * 1000000 + now.tv_usec;
+
+    __atomic_store_n(&status->seq, status->seq + 1, __ATOMIC_RELEASE);
+}
+
+//-----------------------------------------------------------------------------
+// copy of our own status, for the control socket
+int status_get(struct Status *copy)
+{
+    return status_read(status, copy);
+}
+
+//-----------------------------------------------------------------------------
+
+int status_read(const struct Status *shm, struct Status *copy)
+{
+    uint32_t seq;
+    int tries;
+
+    // a writer that died halfway leaves 'seq' odd for good
+    for (tries = 0; ; tries++) 
+    {
+        if (tries == STATUS_TRIES)
+            return -1;
+
+        seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) 
+            continue;
+
+        memcpy(copy, (const void *) shm, sizeof(*copy));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq)
+            break;
+    }
+
+    if (copy->magic != STATUS_MAGIC || copy->version != STATUS_VERSION)
+        return -1;
+
+    return 0;
+}
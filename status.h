@@ -0,0 +1,61 @@
+#ifndef __STATUS_H__
+#define __STATUS_H__
+
+#include <stdint.h>
+
+// live status of the process in posix shared memory, for monitors that
+// poll without talking to it (see lapsestat.c)
+#define STATUS_SHM     "/timelapse"
+#define STATUS_MAGIC   0x5350414cu   // "LAPS"
+#define STATUS_VERSION 3
+
+// readers copy the struct and retry while 'seq' is odd or changed
+struct Status
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;
+    int32_t  pid;
+
+    int32_t  state;        // S_* from event.h
+    int32_t  mode;         // MODE_* from camera.h
+    int32_t  capturing;    // a capture thread is running
+    int32_t  interval;
+
+    int64_t  updated_us;   // wall clock of the last update
+    int64_t  started;      // slot of the first frame
+    int64_t  next;         // deadline of the next frame
+    int64_t  frames;       // frames taken in this run
+    int64_t  total;        // frames asked for, 0 for no limit
+    int64_t  latency_us;   // capture and download of the last frame
+
+    int32_t  thumb_queue;
+    int32_t  composite_queue;
+
+    int64_t  errors;
+    int64_t  recoveries;
+    int64_t  lost;
+
+    int32_t  offload_queue;
+    int32_t  pad;
+    int64_t  offload_backlog;  // bytes
+    int64_t  offload_bytes;    // copied in this run
+
+    int64_t  card_free;        // bytes, -1 if unknown
+    int64_t  disk_free;
+    int64_t  frames_fit;       // on the fuller of both, -1 if unknown
+};
+
+int  status_open(void);
+void status_close(void);
+
+// bracket a write, never returns NULL
+struct Status *status_begin(void);
+void status_end(void);
+
+// consistent copy of a mapped segment, returns -1 if it's not ours or
+// stays busy
+int  status_read(const struct Status *shm, struct Status *copy);
+int  status_get(struct Status *copy);
+
+#endif
@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <time.h>
+#include <gphoto2/gphoto2-camera.h>
+
+#include "storage.h"
+#include "tlog.h"
+#include "watchdog.h"
+
+// frames between looks at the card, the first frame always gets one
+#define CHECK_FRAMES   10
+
+// seconds to the next frame below which the camera is left alone,
+// deletes per window
+#define IDLE_MIN        5
+#define DELETE_BATCH    8
+
+// below this many frames of room a policy kicks in, and works until
+// there's twice as much
+#define LOW_FRAMES    200
+
+// weight of a new frame in the running average of frame sizes
+#define SIZE_ALPHA    0.1
+
+// timeouts of the camera calls, as in camera.c
+#define TIMEOUT_INFO   15
+#define TIMEOUT_DELETE 15
+
+// downloaded frames still on the card, oldest first; longer paths
+// aren't tracked and stay on the card
+#define MAX_TRACKED 4096
+
+struct CardFile
+{
+    char folder[64];
+    char name[32];
+};
+
+static struct CardFile tracked[MAX_TRACKED];
+static unsigned head = 0, tail = 0;
+
+static const char *outdir = NULL;
+static int policy = STORAGE_WARN;
+
+static double frame_size = 0;     // bytes on the card, running average
+static double disk_size = 0;      // bytes on the disk, less for previews
+static long long card_free = -1;  // bytes
+static long long disk_free = -1;
+static int frames_since_check = CHECK_FRAMES;
+static int warned = 0, lowered = 0, deleting = 0;
+
+static long nr_deleted = 0, nr_checks = 0;
+
+//-----------------------------------------------------------------------------
+
+void storage_reset(const char *dir, int p)
+{
+    outdir = dir;
+    policy = p;
+    head = tail = 0;
+    frame_size = disk_size = 0;
+    card_free = disk_free = -1;
+    frames_since_check = CHECK_FRAMES;
+    warned = lowered = deleting = 0;
+    nr_deleted = nr_checks = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+void storage_frame(const CameraFilePath *path, const char *local, long long card_bytes, int full)
+{
+    struct stat st;
+
+    frames_since_check++;
+
+    if (local[0] == '\0' || stat(local, &st) < 0)
+        return;
+
+    if (card_bytes <= 0)
+        card_bytes = st.st_size;
+
+    frame_size = (frame_size == 0) ? card_bytes : frame_size + SIZE_ALPHA * (card_bytes - frame_size);
+    disk_size = (disk_size == 0) ? st.st_size : disk_size + SIZE_ALPHA * (st.st_size - disk_size);
+
+    // a preview leaves the card copy the only full one
+    if (!full)
+        return;
+
+    // on the disk now, so the card copy may go when room is needed
+    if (strlen(path->folder) < sizeof(tracked[0].folder) && strlen(path->name) < sizeof(tracked[0].name)) 
+    {
+        if (tail - head == MAX_TRACKED)
+            head++;
+        strcpy(tracked[tail % MAX_TRACKED].folder, path->folder);
+        strcpy(tracked[tail % MAX_TRACKED].name, path->name);
+        tail++;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// free space of the writable storages of the camera
+static void check_card(Camera *camera, GPContext *context)
+{
+    CameraStorageInformation *sifs = NULL;
+    long long total = 0;
+    int i, n = 0, ret, known = 0;
+
+    watchdog_arm("gp_camera_get_storageinfo", TIMEOUT_INFO);
+    ret = gp_camera_get_storageinfo(camera, &sifs, &n, context);
+    watchdog_disarm(ret);
+
+    if (ret < GP_OK) 
+    {
+        tlog_error("storage: gp_camera_get_storageinfo() failed: %d\n", ret);
+        return;
+    }
+
+    for (i = 0; i < n; i++) 
+    {
+        if (!(sifs[i].fields & GP_STORAGEINFO_FREESPACEKBYTES))
+            continue;
+        if ((sifs[i].fields & GP_STORAGEINFO_ACCESS) && sifs[i].access != GP_STORAGEINFO_AC_READWRITE)
+            continue;
+        total += (long long) sifs[i].freekbytes * 1024;
+        known = 1;
+    }
+    free(sifs);
+
+    card_free = known ? total : -1;
+}
+
+//-----------------------------------------------------------------------------
+
+static void check_disk(void)
+{
+    struct statvfs vfs;
+
+    if (outdir == NULL || statvfs(outdir, &vfs) < 0) 
+    {
+        disk_free = -1;
+        return;
+    }
+
+    disk_free = (long long) vfs.f_bavail * vfs.f_frsize;
+}
+
+//-----------------------------------------------------------------------------
+
+long storage_budget(long long *card, long long *disk)
+{
+    long fit = -1, n;
+
+    if (card != NULL) *card = card_free;
+    if (disk != NULL) *disk = disk_free;
+
+    if (frame_size <= 0 || disk_size <= 0)
+        return -1;
+
+    if (card_free >= 0) 
+        fit = (long) (card_free / frame_size);
+    n = (long) (disk_free / disk_size);
+    if (disk_free >= 0 && (fit < 0 || n < fit)) 
+        fit = n;
+
+    return fit;
+}
+
+//-----------------------------------------------------------------------------
+// steps 'imageformat' (or 'imagequality') down: raw to jpeg first, then
+// to the next choice, bodies list them large to small
+static void lower_quality(Camera *camera, GPContext *context)
+{
+    static const char *keys[] = { "imageformat", "imagequality" };
+    CameraWidget *config = NULL, *widget = NULL;
+    const char *current, *choice, *pick = NULL;
+    int i, k, n, cur = -1, ret;
+
+    watchdog_arm("lower quality", TIMEOUT_INFO);
+    ret = gp_camera_get_config(camera, &config, context);
+    if (ret < GP_OK) 
+        goto out;
+
+    for (k = 0; k < 2 && widget == NULL; k++)
+        if (gp_widget_get_child_by_name(config, keys[k], &widget) < GP_OK)
+            widget = NULL;
+
+    if (widget == NULL || gp_widget_get_value(widget, &current) < GP_OK) 
+    {
+        ret = GP_ERROR_NOT_SUPPORTED;
+        goto out;
+    }
+
+    n = gp_widget_count_choices(widget);
+    for (i = 0; i < n; i++) 
+    {
+        if (gp_widget_get_choice(widget, i, &choice) < GP_OK) 
+            continue;
+        if (strcmp(choice, current) == 0) 
+            cur = i;
+    }
+
+    for (i = 0; i < n && pick == NULL; i++) 
+    {
+        if (gp_widget_get_choice(widget, i, &choice) < GP_OK) 
+            continue;
+
+        if (strstr(current, "RAW") != NULL || strchr(current, '+') != NULL) 
+        {
+            if (strstr(choice, "RAW") == NULL && strchr(choice, '+') == NULL)
+                pick = choice;
+        }
+        else if (i == cur + 1 && cur >= 0) 
+        {
+            pick = choice;
+        }
+    }
+
+    if (pick == NULL) 
+    {
+        ret = GP_ERROR_NOT_SUPPORTED;
+        goto out;
+    }
+
+    tlog_info("Storage: image format %s -> %s\n", current, pick);
+    ret = gp_widget_set_value(widget, pick);
+    if (ret == GP_OK)
+        ret = gp_camera_set_config(camera, config, context);
+out:
+    watchdog_disarm(ret);
+    if (config != NULL)
+        gp_widget_free(config);
+    if (ret < GP_OK)
+        tlog_error("storage: cannot lower image quality: %d\n", ret);
+}
+
+//-----------------------------------------------------------------------------
+
+static void delete_batch(Camera *camera, GPContext *context, time_t next)
+{
+    struct CardFile *f;
+    int i, ret;
+
+    for (i = 0; i < DELETE_BATCH && head != tail && time(NULL) + IDLE_MIN <= next; i++) 
+    {
+        f = &tracked[head % MAX_TRACKED];
+        head++;
+
+        watchdog_arm("gp_camera_file_delete", TIMEOUT_DELETE);
+        ret = gp_camera_file_delete(camera, f->folder, f->name, context);
+        watchdog_disarm(ret);
+
+        // gone already if it was a dropped duplicate
+        if (ret == GP_OK) 
+        {
+            nr_deleted++;
+            if (card_free >= 0 && frame_size > 0)
+                card_free += frame_size;
+        }
+        else if (ret != GP_ERROR_FILE_NOT_FOUND) 
+        {
+            tlog_error("storage: deleting %s/%s failed: %d\n", f->folder, f->name, ret);
+            break;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void storage_idle(Camera *camera, GPContext *context, time_t next, long remaining)
+{
+    long fit, need;
+
+    if (time(NULL) + IDLE_MIN > next || frame_size <= 0)
+        return;
+
+    if (frames_since_check >= CHECK_FRAMES) 
+    {
+        frames_since_check = 0;
+        nr_checks++;
+        check_card(camera, context);
+        check_disk();
+
+        fit = storage_budget(NULL, NULL);
+        need = (remaining >= 0 && remaining < LOW_FRAMES) ? remaining : LOW_FRAMES;
+
+        if (fit >= 0 && fit < need) 
+        {
+            if (!warned)
+                tlog_error("storage: room for %ld frames (card %.0f MB, disk %.0f MB, %.1f MB per frame)\n", 
+                           fit, card_free / 1048576.0, disk_free / 1048576.0, frame_size / 1048576.0);
+            warned = 1;
+
+            // a smaller format helps the card and the disk alike
+            if (policy == STORAGE_QUALITY && !lowered) 
+            {
+                lower_quality(camera, context);
+                lowered = 1;
+            }
+        }
+        else if (fit >= 2 * need) 
+        {
+            warned = lowered = 0;
+        }
+
+        // only the card gains from deleting
+        if (policy == STORAGE_DELETE && card_free >= 0 && card_free < need * frame_size)
+            deleting = 1;
+    }
+
+    // make room on the card up to twice the low mark, from the frames
+    // already downloaded
+    if (deleting) 
+    {
+        delete_batch(camera, context, next);
+        if (head == tail || card_free >= 2 * LOW_FRAMES * frame_size)
+            deleting = 0;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void storage_report( void )
+{
+    if (nr_checks == 0)
+        return;
+
+    tlog_info("Storage: card %.0f MB free, disk %.0f MB free, %.1f MB per frame, "
+              "room for %ld frames, %ld deleted from the card\n", 
+              card_free / 1048576.0, disk_free / 1048576.0, frame_size / 1048576.0, 
+              storage_budget(NULL, NULL), nr_deleted);
+}
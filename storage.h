@@ -0,0 +1,30 @@
+#ifndef __STORAGE_H__
+#define __STORAGE_H__
+
+#include <time.h>
+#include <gphoto2/gphoto2-camera.h>
+
+// what to do when space runs short, every policy warns
+#define STORAGE_WARN     0  // only warn
+#define STORAGE_QUALITY  1  // step the camera down to smaller files
+#define STORAGE_DELETE   2  // delete downloaded frames from the card
+
+void storage_reset(const char *outdir, int policy);
+
+// a frame was taken, 'local' is its download or empty; 'card_bytes' is
+// the size of the file on the card, -1 if unknown, and 'full' says
+// 'local' is all of it rather than a preview
+void storage_frame(const CameraFilePath *path, const char *local, long long card_bytes, int full);
+
+// the camera is free until 'next': refresh free space now and then and
+// delete a batch of frames when the policy asks for it, as long as the
+// window lasts; 'remaining' frames are still to come, -1 for no limit
+void storage_idle(Camera *camera, GPContext *context, time_t next, long remaining);
+
+// free bytes on the card and the disk, -1 if unknown, and frames that
+// fit on the fuller of both
+long storage_budget(long long *card, long long *disk);
+
+void storage_report(void);
+
+#endif
@@ -0,0 +1,515 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sync.h"
+#include "prof.h"
+#include "tlog.h"
+
+#define SYNC_MAGIC 0x544c5359   // "TLSY"
+
+// message types, with what 'a', 'b' and 'c' carry; times are ns since
+// the epoch
+#define MSG_ANNOUNCE  1  // start, interval, frames
+#define MSG_REQUEST   2  // t1: request sent
+#define MSG_REPLY     3  // t1, t2: request received, t3: reply sent
+#define MSG_FIRED     4  // frame, trigger time
+
+struct SyncMsg
+{
+    uint32_t magic;
+    uint16_t type;
+    uint16_t node;     // sender
+    uint16_t to;       // MSG_REPLY: the requesting node
+    uint16_t pad[3];
+    int64_t  a, b, c;
+};
+
+// the leader repeats the schedule for late joiners; followers measure the
+// offset in a quick burst, then now and then
+#define ANNOUNCE_PERIOD_MS 1000
+#define REQUEST_PERIOD_MS  2000
+#define BURST_PERIOD_MS     250
+#define BURST              8
+
+// the offset comes from the exchange with the shortest round trip of the
+// last few, queueing on the network only ever adds delay
+#define SAMPLES 8
+
+struct Sample
+{
+    int64_t offset, delay;
+};
+
+static int role = SYNC_OFF;
+static int sock = -1;
+static struct sockaddr_in group_addr;
+static uint16_t node;
+
+// a pipe wakes the thread to stop it
+static int wake[2] = { -1, -1 };
+static pthread_t thread;
+static pthread_mutex_t mutex;
+static pthread_cond_t cond;
+
+// local clock + offset = leader's clock
+static int64_t offset_ns = 0, delay_ns = 0;
+static struct Sample samples[SAMPLES];
+static int nr_samples = 0, locked = 0;
+
+// the leader's schedule
+static time_t sched_start;
+static long sched_interval = 0, sched_frames = 0;
+
+// trigger times of the frame being reported, logged once the next frame
+// starts coming in
+static long cur_frame = -1;
+static int cur_nodes;
+static int64_t cur_min, cur_max;
+static long skew_frames = 0;
+static double skew_sum = 0, skew_max = 0;
+
+//-----------------------------------------------------------------------------
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+
+static long long mono_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//-----------------------------------------------------------------------------
+
+static void send_msg(int type, int to, int64_t a, int64_t b, int64_t c)
+{
+    struct SyncMsg msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.magic = SYNC_MAGIC;
+    msg.type = type;
+    msg.node = node;
+    msg.to = to;
+    msg.a = a;
+    msg.b = b;
+    msg.c = c;
+
+    if (sendto(sock, &msg, sizeof(msg), 0, (struct sockaddr *) &group_addr, sizeof(group_addr)) < 0)
+        tlog_error("sync: send: %s\n", strerror(errno));
+}
+
+//-----------------------------------------------------------------------------
+// called with 'mutex' held
+static void flush_frame(void)
+{
+    double skew;
+
+    if (cur_nodes < 2)
+        return;
+
+    skew = (cur_max - cur_min) / 1e6;
+    tlog_info("sync frame %ld: %d nodes, skew %.2f ms\n", cur_frame, cur_nodes, skew);
+
+    skew_frames++;
+    skew_sum += skew;
+    if (skew > skew_max)
+        skew_max = skew;
+}
+
+//-----------------------------------------------------------------------------
+// called with 'mutex' held
+static void account(long frame, int64_t taken)
+{
+    // a report that comes after the next frame started is dropped
+    if (frame < cur_frame)
+        return;
+
+    if (frame > cur_frame)
+    {
+        flush_frame();
+        cur_frame = frame;
+        cur_nodes = 0;
+    }
+
+    if (cur_nodes == 0 || taken < cur_min) cur_min = taken;
+    if (cur_nodes == 0 || taken > cur_max) cur_max = taken;
+    cur_nodes++;
+}
+
+//-----------------------------------------------------------------------------
+// a new run numbers its frames from the start again; called with 'mutex'
+// held
+static void set_schedule(time_t start, long interval, long frames)
+{
+    if (start != sched_start)
+    {
+        flush_frame();
+        cur_frame = -1;
+        cur_nodes = 0;
+    }
+
+    sched_start = start;
+    sched_interval = interval;
+    sched_frames = frames;
+}
+
+//-----------------------------------------------------------------------------
+// a reply to one of our requests: t4 is now
+static void add_sample(const struct SyncMsg *msg, int64_t t4)
+{
+    struct Sample *s;
+    int i, best = 0;
+
+    s = &samples[nr_samples++ % SAMPLES];
+    s->offset = ((msg->b - msg->a) + (msg->c - t4)) / 2;
+    s->delay = (t4 - msg->a) - (msg->c - msg->b);
+
+    for (i = 1; i < SAMPLES && i < nr_samples; i++)
+    {
+        if (samples[i].delay < samples[best].delay)
+            best = i;
+    }
+
+    pthread_mutex_lock(&mutex);
+    offset_ns = samples[best].offset;
+    delay_ns = samples[best].delay;
+    if (!locked)
+        tlog_info("Sync: offset to the leader %+.3f ms, round trip %.3f ms\n", offset_ns / 1e6, delay_ns / 1e6);
+    locked = 1;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+}
+
+//-----------------------------------------------------------------------------
+
+static void receive(void)
+{
+    struct SyncMsg msg;
+    int64_t t;
+    ssize_t n;
+
+    n = recv(sock, &msg, sizeof(msg), MSG_DONTWAIT);
+    t = now_ns();
+    if (n != sizeof(msg) || msg.magic != SYNC_MAGIC || msg.node == node)
+        return;
+
+    switch (msg.type)
+    {
+    case MSG_ANNOUNCE:
+        if (role != SYNC_FOLLOW)
+            break;
+        pthread_mutex_lock(&mutex);
+        set_schedule(msg.a, msg.b, msg.c);
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&mutex);
+        break;
+
+    case MSG_REQUEST:
+        if (role == SYNC_LEADER)
+            send_msg(MSG_REPLY, msg.node, msg.a, t, now_ns());
+        break;
+
+    case MSG_REPLY:
+        if (role == SYNC_FOLLOW && msg.to == node)
+            add_sample(&msg, t);
+        break;
+
+    case MSG_FIRED:
+        pthread_mutex_lock(&mutex);
+        account(msg.a, msg.b);
+        pthread_mutex_unlock(&mutex);
+        break;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+static void *sync_thread(void *arg)
+{
+    struct pollfd fds[2];
+    long long now, due = 0;
+    long interval, frames;
+    time_t start;
+    int burst = BURST;
+
+    prof_thread("sync");
+
+    for (;;)
+    {
+        now = mono_ms();
+        if (now >= due)
+        {
+            if (role == SYNC_FOLLOW)
+            {
+                send_msg(MSG_REQUEST, 0, now_ns(), 0, 0);
+                due = now + ((burst > 0) ? BURST_PERIOD_MS : REQUEST_PERIOD_MS);
+                if (burst > 0) burst--;
+            }
+            else
+            {
+                pthread_mutex_lock(&mutex);
+                start = sched_start;
+                interval = sched_interval;
+                frames = sched_frames;
+                pthread_mutex_unlock(&mutex);
+                if (interval > 0)
+                    send_msg(MSG_ANNOUNCE, 0, start, interval, frames);
+                due = now + ANNOUNCE_PERIOD_MS;
+            }
+        }
+
+        fds[0].fd = wake[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = sock;
+        fds[1].events = POLLIN;
+
+        if (poll(fds, 2, (int) (due - now)) < 0)
+        {
+            if (errno == EINTR) continue;
+            tlog_error("sync: poll: %s\n", strerror(errno));
+            break;
+        }
+        prof_wakeup();
+
+        if (fds[0].revents)
+            break;
+
+        if (fds[1].revents & POLLIN)
+            receive();
+    }
+
+    prof_exit();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+int sync_init(int r, const char *group, const char *ifaddr)
+{
+    struct sockaddr_in addr;
+    struct ip_mreq mreq;
+    char host[64], *colon;
+    unsigned char ttl = 1, loop = 1;
+    int one = 1;
+
+    if (r == SYNC_OFF)
+        return 0;
+
+    snprintf(host, sizeof(host), "%s", group);
+    colon = strrchr(host, ':');
+    if (colon == NULL)
+    {
+        tlog_error("sync: group needs address:port, not %s\n", group);
+        return -1;
+    }
+    *colon = '\0';
+
+    memset(&group_addr, 0, sizeof(group_addr));
+    group_addr.sin_family = AF_INET;
+    group_addr.sin_port = htons(atoi(colon + 1));
+    if (inet_pton(AF_INET, host, &group_addr.sin_addr) != 1)
+    {
+        tlog_error("sync: bad group address %s\n", host);
+        return -1;
+    }
+
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.imr_multiaddr = group_addr.sin_addr;
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (ifaddr != NULL && inet_pton(AF_INET, ifaddr, &mreq.imr_interface) != 1)
+    {
+        tlog_error("sync: bad interface address %s\n", ifaddr);
+        return -1;
+    }
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0)
+    {
+        perror("sync socket");
+        return -1;
+    }
+
+    // several nodes on one host share the port
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = group_addr.sin_port;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+        bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0 ||
+        setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, &mreq.imr_interface, sizeof(mreq.imr_interface)) < 0 ||
+        setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0 ||
+        setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0)
+    {
+        perror(group);
+        close(sock);
+        sock = -1;
+        return -1;
+    }
+
+    if (pipe(wake) < 0)
+    {
+        perror("sync pipe");
+        close(sock);
+        sock = -1;
+        return -1;
+    }
+
+    // our own messages come back, the id tells them apart
+    node = (uint16_t) ((getpid() * 2654435761u) ^ now_ns());
+    role = r;
+
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+    pthread_create(&thread, NULL, sync_thread, NULL);
+
+    tlog_info("Sync: %s on %s, node %04x\n", (role == SYNC_LEADER) ? "leading" : "following", group, node);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+void sync_destroy(void)
+{
+    if (sock < 0)
+        return;
+
+    if (write(wake[1], "", 1) < 0)
+        perror("sync wake");
+    pthread_join(thread, NULL);
+
+    flush_frame();
+    if (skew_frames > 0)
+        printf("Sync: %ld frames across nodes, skew avg %.2f ms, max %.2f ms\n",
+               skew_frames, skew_sum / skew_frames, skew_max);
+
+    close(wake[0]);
+    close(wake[1]);
+    close(sock);
+    sock = -1;
+    role = SYNC_OFF;
+
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&cond);
+}
+
+//-----------------------------------------------------------------------------
+
+void sync_clock(struct timespec *ts)
+{
+    int64_t t;
+
+    if (role != SYNC_FOLLOW)
+    {
+        clock_gettime(CLOCK_REALTIME, ts);
+        return;
+    }
+
+    pthread_mutex_lock(&mutex);
+    t = now_ns() + offset_ns;
+    pthread_mutex_unlock(&mutex);
+
+    ts->tv_sec = t / 1000000000;
+    ts->tv_nsec = t % 1000000000;
+}
+
+//-----------------------------------------------------------------------------
+
+void sync_local(struct timespec *ts)
+{
+    int64_t t;
+
+    t = (int64_t) ts->tv_sec * 1000000000 + ts->tv_nsec;
+    if (role == SYNC_FOLLOW)
+    {
+        pthread_mutex_lock(&mutex);
+        t -= offset_ns;
+        pthread_mutex_unlock(&mutex);
+    }
+
+    ts->tv_sec = t / 1000000000;
+    ts->tv_nsec = t % 1000000000;
+}
+
+//-----------------------------------------------------------------------------
+
+void sync_announce(time_t start, long interval, long frames)
+{
+    if (role != SYNC_LEADER)
+        return;
+
+    pthread_mutex_lock(&mutex);
+    set_schedule(start, interval, frames);
+    pthread_mutex_unlock(&mutex);
+
+    // followers waiting for it needn't wait for the next repeat
+    send_msg(MSG_ANNOUNCE, 0, start, interval, frames);
+}
+
+//-----------------------------------------------------------------------------
+
+int sync_schedule(time_t *start, long *interval, long *frames, int timeout)
+{
+    struct timespec ts;
+    int ret = 0;
+
+    if (role != SYNC_FOLLOW)
+        return -1;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout;
+
+    pthread_mutex_lock(&mutex);
+    while ((sched_interval == 0 || !locked) && ret != ETIMEDOUT)
+        ret = pthread_cond_timedwait(&cond, &mutex, &ts);
+
+    if (sched_interval == 0 || !locked)
+    {
+        pthread_mutex_unlock(&mutex);
+        return -1;
+    }
+
+    *start = sched_start;
+    *interval = sched_interval;
+    *frames = sched_frames;
+    pthread_mutex_unlock(&mutex);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+void sync_fired(long frame, const struct timeval *taken)
+{
+    int64_t t;
+
+    if (sock < 0)
+        return;
+
+    t = (int64_t) taken->tv_sec * 1000000000 + (int64_t) taken->tv_usec * 1000;
+    send_msg(MSG_FIRED, 0, frame, t, 0);
+
+    pthread_mutex_lock(&mutex);
+    account(frame, t);
+    pthread_mutex_unlock(&mutex);
+}
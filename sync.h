@@ -0,0 +1,37 @@
+#ifndef __SYNC_H__
+#define __SYNC_H__
+
+#include <sys/time.h>
+#include <time.h>
+
+// several controllers firing together: the leader multicasts the schedule
+// of its run, followers take it over and keep their clock offset to the
+// leader from ntp-style exchanges on the same group
+#define SYNC_OFF     0
+#define SYNC_LEADER  1
+#define SYNC_FOLLOW  2
+
+// 'group' is "address:port", 'ifaddr' the local interface to use, NULL
+// for the default one ("127.0.0.1" to try it on one host)
+int  sync_init(int role, const char *group, const char *ifaddr);
+void sync_destroy(void);
+
+// now in the time base of the schedule: the leader's clock on followers,
+// the local clock otherwise
+void sync_clock(struct timespec *ts);
+
+// converts a time in that base to the local clock, for timed waits
+void sync_local(struct timespec *ts);
+
+// leader: the schedule of the current run, 0 'interval' once it's over
+void sync_announce(time_t start, long interval, long frames);
+
+// follower: waits up to 'timeout' seconds for the leader's schedule and a
+// clock offset; -1 if neither came
+int  sync_schedule(time_t *start, long *interval, long *frames, int timeout);
+
+// 'frame' was triggered at 'taken' (schedule time base); every node logs
+// the spread of the trigger times per frame
+void sync_fired(long frame, const struct timeval *taken);
+
+#endif
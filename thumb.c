@@ -0,0 +1,502 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "image.h"
+#include "thumb.h"
+#include "prof.h"
+#include "tlog.h"
+
+// libjpeg scaled idct: 1/8 means one pixel per dct block
+#define THUMB_SCALE    8
+#define THUMB_QUALITY 85
+
+#define MAX_WORKERS    8
+#define QUEUE_SIZE    32  // jobs per worker
+
+// contact sheet layout, cells are 3:2 like most sensors
+#define SHEET_COLS     8
+#define SHEET_ROWS     6
+#define CELL_W       192
+#define CELL_H       128
+#define SHEET_CELLS  (SHEET_COLS*SHEET_ROWS)
+
+struct Job
+{
+    long frame;
+    char path[PATH_MAX];
+};
+
+// every worker owns a queue: it takes the oldest job from the head,
+// idle workers steal the newest one from the tail of the others
+struct Deque
+{
+    pthread_mutex_t lock;
+    struct Job jobs[QUEUE_SIZE];
+    unsigned head, tail;
+};
+
+struct Sheet
+{
+    long number;
+    int filled;
+    int fresh;          // numbered, not yet looked for on disk
+    char dir[PATH_MAX];
+    struct Image img;
+};
+
+static struct Deque queues[MAX_WORKERS];
+static pthread_t workers[MAX_WORKERS];
+static int nworkers = 0;
+static unsigned next_queue = 0;
+
+// 'pending' jobs in queues, 'outstanding' jobs not yet finished
+static volatile int thread_done = 1;
+static int pending = 0;
+static int outstanding = 0;
+static pthread_mutex_t mutex;
+static pthread_cond_t condw; // worker
+static pthread_cond_t condm; // master
+
+// two sheets so the next one can start while the last cells of the
+// previous are still being decoded
+static struct Sheet sheets[2];
+static pthread_mutex_t sheet_mutex;
+
+// sheets are named after the run, a new one doesn't overwrite the last
+static time_t run_start = 0;
+
+// throughput counters, protected by 'mutex'
+static long nr_thumbs = 0;
+static long nr_stolen = 0;
+static long nr_dropped = 0;
+static struct timeval first_submit, last_done;
+
+//-----------------------------------------------------------------------------
+
+static int deque_push(struct Deque *q, long frame, const char *path)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->tail - q->head < QUEUE_SIZE) 
+    {
+        struct Job *job = &q->jobs[q->tail % QUEUE_SIZE];
+        job->frame = frame;
+        snprintf(job->path, sizeof(job->path), "%s", path);
+        q->tail++;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+
+static int deque_pop(struct Deque *q, struct Job *job, int steal)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->tail != q->head) 
+    {
+        if (steal)
+            *job = q->jobs[--q->tail % QUEUE_SIZE];
+        else
+            *job = q->jobs[q->head++ % QUEUE_SIZE];
+        ret = 0;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+
+static void make_dir(const char *dir) 
+{
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+        perror(dir);
+}
+
+//-----------------------------------------------------------------------------
+
+static int sheet_path(char *path, size_t len, const struct Sheet *sheet) 
+{
+    return snprintf(path, len, "%s/sheet_%ld_%04ld.jpg", sheet->dir, (long) run_start, sheet->number) < (int) len ? 0 : -1;
+}
+
+//-----------------------------------------------------------------------------
+
+static void sheet_write(struct Sheet *sheet) 
+{
+    char path[PATH_MAX];
+
+    if (sheet->filled == 0) return;
+
+    if (sheet_path(path, sizeof(path), sheet) == 0 && image_save(path, &sheet->img, THUMB_QUALITY) == 0)
+        printf("Contact sheet: %s\n", path);
+
+    memset(sheet->img.pix, 0, (size_t) sheet->img.width * sheet->img.height * 3);
+    sheet->filled = 0;
+}
+
+//-----------------------------------------------------------------------------
+// a resumed run adds its cells to the sheet written before it stopped,
+// instead of replacing it with one that only has the frames since
+static void sheet_resume(struct Sheet *sheet) 
+{
+    struct Image old = { 0 };
+    char path[PATH_MAX];
+
+    sheet->fresh = 0;
+    if (sheet_path(path, sizeof(path), sheet) < 0 || access(path, F_OK) < 0)
+        return;
+
+    if (image_load(path, 1, 3, &old) == 0 && old.width == sheet->img.width && old.height == sheet->img.height)
+        memcpy(sheet->img.pix, old.pix, (size_t) old.width * old.height * 3);
+    image_free(&old);
+}
+
+//-----------------------------------------------------------------------------
+// scales a thumbnail into its contact sheet cell (nearest neighbour,
+// keeping the aspect ratio) and writes the sheet when it's complete
+static void sheet_add(long frame, const char *dir, const struct Image *thumb)
+{
+    long number = frame / SHEET_CELLS;
+    int cell = frame % SHEET_CELLS;
+    struct Sheet *sheet = &sheets[number % 2];
+    int i, w, h, x0, y0, x, y;
+    uint8_t *dst;
+    const uint8_t *src;
+
+    pthread_mutex_lock(&sheet_mutex);
+
+    // both sheets at the first frame, none later in the run
+    for (i = 0; i < 2; i++)
+    {
+        if (sheets[i].img.pix != NULL)
+            continue;
+
+        sheets[i].img.width = SHEET_COLS * CELL_W;
+        sheets[i].img.height = SHEET_ROWS * CELL_H;
+        sheets[i].img.comps = 3;
+        sheets[i].img.pix = calloc((size_t) sheets[i].img.width * sheets[i].img.height, 3);
+        if (sheets[i].img.pix == NULL) 
+        {
+            pthread_mutex_unlock(&sheet_mutex);
+            return;
+        }
+        sheets[i].number = (i == number % 2) ? number : -1;
+        sheets[i].fresh = 1;
+    }
+
+    // a late cell from an older sheet, or a sheet left incomplete
+    if (sheet->number != number)
+    {
+        if (number < sheet->number) 
+        {
+            pthread_mutex_unlock(&sheet_mutex);
+            return;
+        }
+        sheet_write(sheet);
+        sheet->number = number;
+        sheet->fresh = 1;
+    }
+    snprintf(sheet->dir, sizeof(sheet->dir), "%s", dir);
+    if (sheet->fresh)
+        sheet_resume(sheet);
+
+    if (thumb->width * CELL_H > thumb->height * CELL_W) 
+    {
+        w = CELL_W;
+        h = thumb->height * CELL_W / thumb->width;
+    }
+    else 
+    {
+        h = CELL_H;
+        w = thumb->width * CELL_H / thumb->height;
+    }
+    x0 = (cell % SHEET_COLS) * CELL_W + (CELL_W - w) / 2;
+    y0 = (cell / SHEET_COLS) * CELL_H + (CELL_H - h) / 2;
+
+    for (y = 0; y < h; y++) 
+    {
+        src = thumb->pix + (size_t) (y * thumb->height / h) * thumb->width * 3;
+        dst = sheet->img.pix + ((size_t) (y0 + y) * sheet->img.width + x0) * 3;
+        for (x = 0; x < w; x++) 
+        {
+            const uint8_t *p = src + (x * thumb->width / w) * 3;
+            *dst++ = p[0];
+            *dst++ = p[1];
+            *dst++ = p[2];
+        }
+    }
+
+    if (++sheet->filled == SHEET_CELLS) 
+    {
+        sheet_write(sheet);
+        sheet->number = number + 2;
+        sheet->fresh = 1;
+    }
+
+    pthread_mutex_unlock(&sheet_mutex);
+}
+
+//-----------------------------------------------------------------------------
+
+// 'img' is the worker's own buffer, it's reused from frame to frame
+static void make_thumb(const struct Job *job, struct Image *img)
+{
+    char dir[PATH_MAX], path[PATH_MAX];
+    const char *name;
+
+    if (image_reload(job->path, THUMB_SCALE, 3, img) < 0) 
+    {
+        fprintf(stderr, "thumbnail: cannot decode %s\n", job->path);
+        return;
+    }
+
+    // thumbnails go in a 'thumbs' folder next to the frame
+    name = strrchr(job->path, '/');
+    if (name != NULL) 
+    {
+        snprintf(dir, sizeof(dir), "%.*s/thumbs", (int) (name - job->path), job->path);
+        name++;
+    }
+    else 
+    {
+        snprintf(dir, sizeof(dir), "thumbs");
+        name = job->path;
+    }
+    make_dir(dir);
+
+    if (snprintf(path, sizeof(path), "%s/%s", dir, name) < (int) sizeof(path))
+        image_save(path, img, THUMB_QUALITY);
+
+    sheet_add(job->frame, dir, img);
+}
+
+//-----------------------------------------------------------------------------
+
+static int next_job(int self, struct Job *job)
+{
+    int i;
+
+    if (deque_pop(&queues[self], job, 0) == 0)
+        return 0;
+
+    for (i = 1; i < nworkers; i++) 
+    {
+        if (deque_pop(&queues[(self + i) % nworkers], job, 1) == 0) 
+        {
+            pthread_mutex_lock(&mutex);
+            nr_stolen++;
+            pthread_mutex_unlock(&mutex);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+
+static void *thumb_thread(void *arg) 
+{
+    int self = (int) (long) arg;
+    struct Image img = { 0 };
+    struct Job job;
+
+    prof_thread("thumb");
+
+    while (1) 
+    {
+        pthread_mutex_lock(&mutex);
+        while (!thread_done && pending == 0) 
+        {
+            pthread_cond_wait(&condw, &mutex);
+            prof_wakeup();
+        }
+        
+        if (thread_done) 
+        {
+            pthread_mutex_unlock(&mutex);
+            break;
+        }
+        pthread_mutex_unlock(&mutex);
+
+        if (next_job(self, &job) < 0) 
+        {
+            // someone else took it, 'pending' drops in a moment
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&mutex);
+        pending--;
+        pthread_mutex_unlock(&mutex);
+
+        make_thumb(&job, &img);
+
+        pthread_mutex_lock(&mutex);
+        nr_thumbs++;
+        gettimeofday(&last_done, NULL);
+        if (--outstanding == 0)
+            pthread_cond_broadcast(&condm);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    image_free(&img);
+    prof_exit();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+void thumb_init( void ) 
+{
+    long i, n;
+
+    pthread_mutex_init(&mutex, NULL);
+    pthread_mutex_init(&sheet_mutex, NULL);
+    pthread_cond_init(&condw, NULL);
+    pthread_cond_init(&condm, NULL);
+
+    // one worker per core
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) n = 1;
+    if (n > MAX_WORKERS) n = MAX_WORKERS;
+
+    thread_done = 0;
+    for (i = 0; i < n; i++) 
+    {
+        pthread_mutex_init(&queues[i].lock, NULL);
+        queues[i].head = queues[i].tail = 0;
+        if (pthread_create(&workers[i], NULL, thumb_thread, (void *) i) != 0)
+            break;
+    }
+    nworkers = i;
+}
+
+//-----------------------------------------------------------------------------
+
+int thumb_submit(long frame, const char *path) 
+{
+    unsigned i, q;
+
+    if (nworkers == 0) return -1;
+
+    pthread_mutex_lock(&mutex);
+    if (outstanding == 0 && nr_thumbs == 0)
+        gettimeofday(&first_submit, NULL);
+    q = next_queue++;
+    pthread_mutex_unlock(&mutex);
+
+    // round robin, fall over to the next queue when one is full
+    for (i = 0; i < (unsigned) nworkers; i++) 
+    {
+        if (deque_push(&queues[(q + i) % nworkers], frame, path) == 0) 
+        {
+            pthread_mutex_lock(&mutex);
+            pending++;
+            outstanding++;
+            pthread_cond_signal(&condw);
+            pthread_mutex_unlock(&mutex);
+            return 0;
+        }
+    }
+
+    pthread_mutex_lock(&mutex);
+    nr_dropped++;
+    pthread_mutex_unlock(&mutex);
+
+    tlog_error("thumbnail: queues full, dropping %s\n", path);
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// read without the lock, for monitoring only
+int thumb_pending( void ) 
+{
+    return __atomic_load_n(&outstanding, __ATOMIC_RELAXED);
+}
+
+//-----------------------------------------------------------------------------
+
+void thumb_flush( void ) 
+{
+    double secs;
+    int i;
+
+    pthread_mutex_lock(&mutex);
+    while (outstanding > 0)
+        pthread_cond_wait(&condm, &mutex);
+
+    if (nr_thumbs > 0) 
+    {
+        secs = (last_done.tv_sec - first_submit.tv_sec) + 
+            (last_done.tv_usec - first_submit.tv_usec) / 1e6;
+        printf("Thumbnails: %ld frames in %.2f s, %.2f frames/s, "
+               "%d workers, %ld stolen, %ld dropped\n", 
+               nr_thumbs, secs, secs > 0 ? nr_thumbs / secs : 0.0, 
+               nworkers, nr_stolen, nr_dropped);
+    }
+    nr_thumbs = 0;
+    nr_stolen = 0;
+    nr_dropped = 0;
+    pthread_mutex_unlock(&mutex);
+
+    pthread_mutex_lock(&sheet_mutex);
+    for (i = 0; i < 2; i++) 
+    {
+        if (sheets[i].img.pix != NULL)
+            sheet_write(&sheets[i]);
+        image_free(&sheets[i].img);
+    }
+    pthread_mutex_unlock(&sheet_mutex);
+}
+
+//-----------------------------------------------------------------------------
+
+void thumb_destroy( void ) 
+{
+    int i;
+
+    thumb_flush();
+
+    pthread_mutex_lock(&mutex);
+    thread_done = 1;
+    pthread_cond_broadcast(&condw);
+    pthread_mutex_unlock(&mutex);
+
+    for (i = 0; i < nworkers; i++) 
+    {
+        pthread_join(workers[i], NULL);
+        pthread_mutex_destroy(&queues[i].lock);
+    }
+    nworkers = 0;
+
+    pthread_mutex_destroy(&mutex);
+    pthread_mutex_destroy(&sheet_mutex);
+    pthread_cond_destroy(&condw);
+    pthread_cond_destroy(&condm);
+}
+
+//-----------------------------------------------------------------------------
+
+void thumb_run(time_t start) 
+{
+    pthread_mutex_lock(&sheet_mutex);
+    run_start = start;
+    sheets[0].fresh = sheets[1].fresh = 1;
+    pthread_mutex_unlock(&sheet_mutex);
+}
@@ -0,0 +1,23 @@
+#ifndef __THUMB_H__
+#define __THUMB_H__
+
+#include <time.h>
+
+void thumb_init(void);
+void thumb_destroy(void);
+
+// the contact sheets of the run started at 'start' are named after it;
+// a resumed run passes the same start and adds to its sheets on disk
+void thumb_run(time_t start);
+
+// queue a downloaded jpeg, returns -1 if all worker queues are full
+int  thumb_submit(long frame, const char *path);
+
+// frames queued or in the works
+int  thumb_pending(void);
+
+// wait for queued thumbnails, write the partial contact sheet and
+// print throughput
+void thumb_flush(void);
+
+#endif
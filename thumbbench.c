@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "image.h"
+#include "thumb.h"
+
+// decodes every file given on the command line at full size and at
+// 1/8 scale, then runs them through the thumbnail workers
+
+//-----------------------------------------------------------------------------
+
+static double elapsed(struct timeval *start) 
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+//-----------------------------------------------------------------------------
+
+static void bench_decode(int argc, char *argv[], int denom) 
+{
+    struct timeval start;
+    struct Image img;
+    double secs;
+    int i, n = 0;
+
+    gettimeofday(&start, NULL);
+    for (i = 1; i < argc; i++) 
+    {
+        if (image_load(argv[i], denom, 3, &img) == 0) 
+        {
+            image_free(&img);
+            n++;
+        }
+    }
+    secs = elapsed(&start);
+
+    printf("decode 1/%d: %d frames in %.3f s, %.2f frames/s\n", 
+           denom, n, secs, secs > 0 ? n / secs : 0.0);
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    int i;
+
+    if (argc < 2) 
+    {
+        fprintf(stderr, "usage: %s frame.jpg [frame.jpg ...]\n", argv[0]);
+        return 1;
+    }
+
+    bench_decode(argc, argv, 1);
+    bench_decode(argc, argv, 8);
+
+    thumb_init();
+    for (i = 1; i < argc; i++) 
+        thumb_submit(i - 1, argv[i]);
+    thumb_destroy();
+
+    return 0;
+}
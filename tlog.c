@@ -0,0 +1,405 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "prof.h"
+#include "tlog.h"
+
+// records in the ring, a power of two
+#define RING_SIZE 1024
+
+// arguments of a record and room for its strings, a record is 256 bytes
+#define MAX_ARGS  8
+#define TEXT_SIZE 152
+
+// longest formatted line
+#define LINE_SIZE 512
+
+union Arg
+{
+    long long i;
+    double d;
+};
+
+// 'seq' tells whose turn the slot is: the producer of position 'pos'
+// finds it at 'pos', the consumer at 'pos + 1'
+struct Record
+{
+    unsigned long seq;
+    struct timespec time;
+    const char *fmt;
+    int err;
+    int nargs;
+    union Arg args[MAX_ARGS];   // strings are offsets into 'text'
+    char text[TEXT_SIZE];
+};
+
+static struct Record ring[RING_SIZE] __attribute__((aligned(64)));
+static unsigned long tail __attribute__((aligned(64)));  // next free position
+static unsigned long head;                               // next to format
+static unsigned long dropped;
+
+// the consumer sleeps on 'cond' when the ring is empty, producers only
+// touch the lock if it says so
+static int sleeping;
+static int running = 0;
+static volatile int thread_done = 1;
+static pthread_t thread;
+static pthread_mutex_t mutex;
+static pthread_cond_t cond;
+
+//-----------------------------------------------------------------------------
+// walks a conversion spec, returns the conversion character and the
+// length modifier in 'len' ('h', 'l', 'L', 'z', ...; 'q' for ll)
+static const char *parse_spec(const char *p, char *conv, char *len)
+{
+    while (strchr("-+ #0", *p) && *p) p++;
+    while (*p >= '0' && *p <= '9') p++;
+    if (*p == '.') 
+        for (p++; *p >= '0' && *p <= '9'; p++);
+
+    *len = 0;
+    while (*p && strchr("hlLqjzt", *p)) 
+    {
+        *len = (*len == 'l' && *p == 'l') ? 'q' : *p;
+        p++;
+    }
+
+    *conv = *p;
+    return *p ? p + 1 : p;
+}
+
+//-----------------------------------------------------------------------------
+// copies the arguments the way 'fmt' reads them
+static void capture_args(struct Record *r, const char *fmt, va_list ap)
+{
+    const char *p = fmt, *s;
+    char conv, len;
+    int used = 0, n;
+
+    r->nargs = 0;
+
+    while ((p = strchr(p, '%')) != NULL) 
+    {
+        if (p[1] == '%') 
+        {
+            p += 2;
+            continue;
+        }
+        p = parse_spec(p + 1, &conv, &len);
+        if (r->nargs == MAX_ARGS) 
+            break;
+
+        union Arg *a = &r->args[r->nargs++];
+
+        switch (conv) 
+        {
+        case 'd': case 'i': case 'c':
+            if (len == 'l')      a->i = va_arg(ap, long);
+            else if (len == 'q') a->i = va_arg(ap, long long);
+            else if (len == 'z') a->i = va_arg(ap, size_t);
+            else                 a->i = va_arg(ap, int);
+            break;
+        case 'u': case 'x': case 'X': case 'o':
+            if (len == 'l')      a->i = va_arg(ap, unsigned long);
+            else if (len == 'q') a->i = va_arg(ap, unsigned long long);
+            else if (len == 'z') a->i = va_arg(ap, size_t);
+            else                 a->i = va_arg(ap, unsigned int);
+            break;
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            a->d = va_arg(ap, double);
+            break;
+        case 'p':
+            a->i = (uintptr_t) va_arg(ap, void *);
+            break;
+        case 's':
+            // truncated to what's left, at worst an empty string
+            s = va_arg(ap, const char *);
+            if (s == NULL) s = "(null)";
+            n = strlen(s);
+            if (n > TEXT_SIZE - 1 - used) 
+                n = TEXT_SIZE - 1 - used;
+            if (n < 0) n = 0;
+            if (used < TEXT_SIZE) 
+            {
+                memcpy(r->text + used, s, n);
+                r->text[used + n] = '\0';
+                a->i = used;
+                used += n + 1;
+            }
+            else
+            {
+                a->i = TEXT_SIZE - 1;
+            }
+            break;
+        default:
+            r->nargs--;
+            break;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// formats a record the way printf would have
+static int format_record(const struct Record *r, char *line, int size)
+{
+    const char *p = r->fmt, *q;
+    char spec[32], conv, len;
+    int n = 0, k, arg = 0;
+    struct tm tm;
+
+    localtime_r(&r->time.tv_sec, &tm);
+    n = strftime(line, size, "%H:%M:%S", &tm);
+    n += snprintf(line + n, size - n, ".%03ld ", r->time.tv_nsec / 1000000);
+
+    while (*p && n < size - 1) 
+    {
+        if (*p != '%' || p[1] == '%') 
+        {
+            line[n++] = *p;
+            p += (*p == '%') ? 2 : 1;
+            continue;
+        }
+
+        q = parse_spec(p + 1, &conv, &len);
+        if (arg == r->nargs || conv == 0) 
+            break;
+
+        // the spec without its length modifier
+        k = 0;
+        for (; p < q - 1 && k < (int) sizeof(spec) - 4; p++)
+            if (!strchr("hlLqjzt", *p))
+                spec[k++] = *p;
+        p = q;
+
+        const union Arg *a = &r->args[arg++];
+
+        switch (conv) 
+        {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+            spec[k++] = 'l';
+            spec[k++] = 'l';
+            spec[k++] = conv;
+            spec[k] = '\0';
+            k = snprintf(line + n, size - n, spec, a->i);
+            break;
+        case 'c':
+            spec[k++] = conv;
+            spec[k] = '\0';
+            k = snprintf(line + n, size - n, spec, (int) a->i);
+            break;
+        case 'p':
+            spec[k++] = conv;
+            spec[k] = '\0';
+            k = snprintf(line + n, size - n, spec, (void *) (uintptr_t) a->i);
+            break;
+        case 's':
+            spec[k++] = conv;
+            spec[k] = '\0';
+            k = snprintf(line + n, size - n, spec, r->text + a->i);
+            break;
+        default:
+            spec[k++] = conv;
+            spec[k] = '\0';
+            k = snprintf(line + n, size - n, spec, a->d);
+            break;
+        }
+
+        n += k;
+        if (n > size - 1) n = size - 1;
+    }
+
+    line[n] = '\0';
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+
+static void put(int err, const char *fmt, va_list ap)
+{
+    struct Record *r;
+    unsigned long pos, seq;
+    long dif;
+
+    // not running yet, or anymore: print straight away
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) 
+    {
+        vfprintf(err ? stderr : stdout, fmt, ap);
+        return;
+    }
+
+    // claim a slot
+    pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+    for (;;) 
+    {
+        r = &ring[pos & (RING_SIZE - 1)];
+        seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+        dif = (long) (seq - pos);
+
+        if (dif == 0) 
+        {
+            if (__atomic_compare_exchange_n(&tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (dif < 0) 
+        {
+            // full, the console is that far behind
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else 
+        {
+            pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    clock_gettime(CLOCK_REALTIME, &r->time);
+    r->fmt = fmt;
+    r->err = err;
+    capture_args(r, fmt, ap);
+
+    __atomic_store_n(&r->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+    // wake the consumer if it went to sleep
+    if (__atomic_load_n(&sleeping, __ATOMIC_SEQ_CST) && __atomic_exchange_n(&sleeping, 0, __ATOMIC_SEQ_CST)) 
+    {
+        pthread_mutex_lock(&mutex);
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&mutex);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void tlog_info(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    put(0, fmt, ap);
+    va_end(ap);
+}
+
+//-----------------------------------------------------------------------------
+
+void tlog_error(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    put(1, fmt, ap);
+    va_end(ap);
+}
+
+//-----------------------------------------------------------------------------
+// formats what's in the ring, returns the number of records
+static int drain(void)
+{
+    static char line[LINE_SIZE];
+    struct Record *r;
+    unsigned long n;
+    int count = 0;
+
+    for (;;) 
+    {
+        r = &ring[head & (RING_SIZE - 1)];
+        if (__atomic_load_n(&r->seq, __ATOMIC_SEQ_CST) != head + 1)
+            break;
+
+        format_record(r, line, sizeof(line));
+        fputs(line, r->err ? stderr : stdout);
+
+        // hand the slot back to the producers, one lap ahead
+        __atomic_store_n(&r->seq, head + RING_SIZE, __ATOMIC_RELEASE);
+        head++;
+        count++;
+    }
+
+    n = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+    if (n > 0)
+        fprintf(stderr, "tlog: %lu records dropped\n", n);
+
+    if (count > 0) 
+    {
+        fflush(stdout);
+        fflush(stderr);
+    }
+
+    return count;
+}
+
+//-----------------------------------------------------------------------------
+
+static void *tlog_thread(void *arg) 
+{
+    struct timespec ts;
+
+    prof_thread("tlog");
+    pthread_mutex_lock(&mutex);
+
+    while (!thread_done) 
+    {
+        pthread_mutex_unlock(&mutex);
+        drain();
+        pthread_mutex_lock(&mutex);
+
+        // nothing came in meanwhile: sleep until a producer wakes us,
+        // the timeout covers a producer that saw 'sleeping' too late
+        __atomic_store_n(&sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring[head & (RING_SIZE - 1)].seq, __ATOMIC_SEQ_CST) != head + 1 && !thread_done) 
+        {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += 1;
+            pthread_cond_timedwait(&cond, &mutex, &ts);
+            prof_wakeup();
+        }
+        __atomic_store_n(&sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+
+    pthread_mutex_unlock(&mutex);
+
+    prof_exit();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+void tlog_init( void )
+{
+    unsigned long i;
+
+    for (i = 0; i < RING_SIZE; i++)
+        ring[i].seq = i;
+    head = tail = dropped = 0;
+
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+
+    thread_done = 0;
+    pthread_create(&thread, NULL, tlog_thread, NULL);
+
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+}
+
+//-----------------------------------------------------------------------------
+
+void tlog_destroy( void )
+{
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&mutex);
+    thread_done = 1;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+
+    pthread_join(thread, NULL);
+
+    // whatever was written while stopping
+    drain();
+
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&cond);
+}
@@ -0,0 +1,13 @@
+#ifndef __TLOG_H__
+#define __TLOG_H__
+
+// printf-style logging that never waits for the console: the arguments
+// are copied into a preallocated ring and a background thread formats
+// them. 'fmt' must be a string literal, it's kept by reference
+void tlog_init(void);
+void tlog_destroy(void);
+
+void tlog_info(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void tlog_error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#endif
@@ -3,15 +3,25 @@
 #include "lcd.h"
 #include "ui.h"
 
+// top row of the screens below
+static const char *title = "";
+
+//-----------------------------------------------------------------------------
+
+void user_title(const char *s) 
+{
+    title = s;
+}
+
 //-----------------------------------------------------------------------------
 
 void user_menu(struct Event ev) 
 {
     const static int states[] = { 
-        S_INTERVAL, S_DELAY, S_FRAMES, S_RUNNING };
+        S_INTERVAL, S_DELAY, S_FRAMES, S_MODE, S_RUNNING };
 
     const static char *choises[] = { 
-        "Interval", "Delay   ", "Frames  ", "Start   " };
+        "Interval", "Delay   ", "Frames  ", "Mode    ", "Start   " };
 
     const static int n_choises = sizeof(states)/sizeof(int);
     static int index = 0;
@@ -37,8 +47,7 @@ void user_menu(struct Event ev)
     
     // print menu choise
     snprintf(buf, LCD_COLS, "%d. %s", index+1, choises[index]);
-    lcd_set_cursor(1, 0); 
-    lcd_puts(buf);
+    lcd_screen(title, buf);
 }
 
 //-----------------------------------------------------------------------------
@@ -97,8 +106,7 @@ void user_number(long *target, struct Event ev)
             sprintf(buf, " %05ld      [OK]", *target);       
     }
 
-    lcd_set_cursor(1, 0);
-    lcd_puts(buf);
+    lcd_screen(title, buf);
 }
 
 //-----------------------------------------------------------------------------
@@ -173,7 +181,64 @@ void user_timer(long *target, struct Event ev)
         }
     }
 
-    lcd_set_cursor(1, 0);
-    lcd_puts(buf);
+    lcd_screen(title, buf);
 }
 
+
+//-----------------------------------------------------------------------------
+
+void user_choice(long *target, const char **labels, int n, struct Event ev)
+{
+    // two items: choice(0), ok(1) 
+    const int items = 2;
+    static int selected = 1;
+    
+    static char buf[64];
+
+    // if edit == 1 then choice is in edit mode
+    static int edit = 0;
+
+    long nextval;   
+    int dir = ev.value;
+
+    switch (ev.type) 
+    {
+    case EV_PULSE:
+        if (edit) 
+        {
+            nextval = *target + dir; 
+            if (nextval >= 0 && nextval < n)
+                *target = nextval;
+        }
+        else 
+        { 
+            if ( (selected + dir) >= 0 && (selected + dir) < items )   
+                selected += dir;
+        }
+        break;
+
+    case EV_BUTTON:
+        if (!edit && selected == 1)
+        {
+            change_state(S_MENU);
+            return;
+        }
+        
+        edit = !edit;
+        break;
+    }
+   
+    if (edit) 
+    {
+        sprintf(buf, ">%-8s<     OK ", labels[*target]);
+    } 
+    else 
+    {
+        if (selected == 0) 
+            sprintf(buf, "[%-8s]     OK ", labels[*target]);
+        else 
+            sprintf(buf, " %-8s     [OK]", labels[*target]);       
+    }
+
+    lcd_screen(title, buf);
+}
@@ -4,8 +4,13 @@
 #include "event.h"
 
 void encoder_init(void);
+
+// the screens below draw this row above their own, in one go
+void user_title(const char *title);
+
 void user_menu(struct Event ev);
 void user_number(long *target, struct Event ev);
 void user_timer(long *target, struct Event ev);
+void user_choice(long *target, const char **labels, int n, struct Event ev);
 
 #endif
@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <gphoto2/gphoto2-context.h>
+
+#include "prof.h"
+#include "tlog.h"
+#include "watchdog.h"
+
+// stall events are appended here as csv:
+// time, call, timeout, seconds stalled, result
+#define STALL_LOG "stalls.log"
+
+// seconds between kicks of a call stuck past its deadline
+#define KICK_PERIOD 1
+
+static volatile int thread_done = 1;
+static pthread_t thread;
+static pthread_mutex_t mutex;
+static pthread_cond_t cond;
+
+// calls being watched, one per thread talking to a camera
+#define MAX_WATCH 8
+
+struct Watch
+{
+    const char *op;
+    int timeout;
+    struct timespec start;
+    pthread_t thread;
+    int armed;
+    volatile int expired;
+};
+
+static struct Watch watches[MAX_WATCH];
+
+// slot of the calling thread's current call, and whether one of its
+// calls overran since watchdog_expired() was last asked
+static __thread struct Watch *mine;
+static __thread int last_expired;
+
+static long nr_stalls = 0;
+
+//-----------------------------------------------------------------------------
+
+static double since(const struct timespec *t) 
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - t->tv_sec) + (now.tv_nsec - t->tv_nsec) / 1e9;
+}
+
+//-----------------------------------------------------------------------------
+
+static void log_stall(const char *op, int timeout, double secs, const char *result)
+{
+    FILE *f;
+
+    tlog_error("watchdog: %s stalled %.1f s (deadline %d s), %s\n", op, secs, timeout, result);
+
+    f = fopen(STALL_LOG, "a");
+    if (f == NULL) return;
+    fprintf(f, "%ld,%s,%d,%.3f,%s\n", (long) time(NULL), op, timeout, secs, result);
+    fclose(f);
+}
+
+//-----------------------------------------------------------------------------
+// libgphoto2 polls this in its transfer and wait loops
+static GPContextFeedback cancel_fn(GPContext *context, void *data)
+{
+    // the context is shared, only the thread of the overrun call stops
+    return (mine != NULL && mine->expired) ? GP_CONTEXT_FEEDBACK_CANCEL : GP_CONTEXT_FEEDBACK_OK;
+}
+
+//-----------------------------------------------------------------------------
+// only there to interrupt blocking system calls with EINTR
+static void kick_handler(int sig)
+{
+}
+
+//-----------------------------------------------------------------------------
+
+static void *watchdog_thread(void *arg) 
+{
+    struct Watch *w;
+    struct timespec ts, due;
+    int i, any;
+
+    prof_thread("watchdog");
+    pthread_mutex_lock(&mutex);
+
+    while (!thread_done) 
+    {
+        // the earliest deadline or kick of the calls in flight
+        any = 0;
+        for (i = 0; i < MAX_WATCH; i++) 
+        {
+            w = &watches[i];
+            if (!w->armed) continue;
+
+            due = w->start;
+            due.tv_sec += w->expired ? (long) since(&w->start) + KICK_PERIOD : w->timeout;
+            if (!any || due.tv_sec < ts.tv_sec || (due.tv_sec == ts.tv_sec && due.tv_nsec < ts.tv_nsec))
+                ts = due;
+            any = 1;
+        }
+
+        if (!any) 
+            pthread_cond_wait(&cond, &mutex);
+        else
+            pthread_cond_timedwait(&cond, &mutex, &ts);
+        prof_wakeup();
+
+        for (i = 0; i < MAX_WATCH; i++) 
+        {
+            w = &watches[i];
+            if (!w->armed || since(&w->start) < w->timeout)
+                continue;
+
+            if (!w->expired) 
+            {
+                w->expired = 1;
+                nr_stalls++;
+                tlog_error("watchdog: %s past its %d s deadline, cancelling\n", w->op, w->timeout);
+            }
+
+            // break the caller out of a blocking read or poll
+            pthread_kill(w->thread, SIGUSR2);
+        }
+    }
+
+    pthread_mutex_unlock(&mutex);
+
+    prof_exit();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+void watchdog_init(GPContext *context)
+{
+    pthread_condattr_t attr;
+    struct sigaction sa;
+
+    // no SA_RESTART, the interrupted call has to return
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = kick_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR2, &sa, NULL);
+
+    gp_context_set_cancel_func(context, cancel_fn, NULL);
+
+    pthread_mutex_init(&mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    thread_done = 0;
+    pthread_create(&thread, NULL, watchdog_thread, NULL);
+}
+
+//-----------------------------------------------------------------------------
+
+void watchdog_destroy( void )
+{
+    pthread_mutex_lock(&mutex);
+    thread_done = 1;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+
+    pthread_join(thread, NULL);
+
+    if (nr_stalls > 0)
+        printf("Watchdog: %ld stalled camera calls, see %s\n", nr_stalls, STALL_LOG);
+
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&cond);
+}
+
+//-----------------------------------------------------------------------------
+
+void watchdog_arm(const char *op, int timeout)
+{
+    struct Watch *w;
+    int i;
+
+    pthread_mutex_lock(&mutex);
+
+    // more camera threads than slots go unwatched
+    mine = NULL;
+    for (i = 0; i < MAX_WATCH && mine == NULL; i++) 
+    {
+        if (!watches[i].armed)
+            mine = &watches[i];
+    }
+
+    w = mine;
+    if (w != NULL) 
+    {
+        w->op = op;
+        w->timeout = timeout;
+        w->thread = pthread_self();
+        clock_gettime(CLOCK_MONOTONIC, &w->start);
+        w->expired = 0;
+        w->armed = 1;
+        pthread_cond_signal(&cond);
+    }
+
+    pthread_mutex_unlock(&mutex);
+}
+
+//-----------------------------------------------------------------------------
+
+void watchdog_disarm(int result)
+{
+    struct Watch *w = mine;
+    char buf[32];
+
+    if (w == NULL) 
+        return;
+
+    pthread_mutex_lock(&mutex);
+    if (w->armed && w->expired) 
+    {
+        snprintf(buf, sizeof(buf), "returned %d", result);
+        log_stall(w->op, w->timeout, since(&w->start), buf);
+        last_expired = 1;
+    }
+    w->armed = 0;
+    mine = NULL;
+    pthread_mutex_unlock(&mutex);
+}
+
+//-----------------------------------------------------------------------------
+
+int watchdog_expired( void )
+{
+    int ret = last_expired;
+
+    last_expired = 0;
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+
+void watchdog_abandon( void )
+{
+    int i;
+
+    pthread_mutex_lock(&mutex);
+    for (i = 0; i < MAX_WATCH; i++) 
+    {
+        if (watches[i].armed && watches[i].expired)
+            log_stall(watches[i].op, watches[i].timeout, since(&watches[i].start), "abandoned");
+    }
+    pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,23 @@
+#ifndef __WATCHDOG_H__
+#define __WATCHDOG_H__
+
+#include <gphoto2/gphoto2-context.h>
+
+// starts the watchdog thread, camera calls on 'context' are cancelled
+// once they run past their deadline
+void watchdog_init(GPContext *context);
+void watchdog_destroy(void);
+
+// brackets a camera call made by the calling thread, several threads
+// may each have one in flight
+void watchdog_arm(const char *op, int timeout);
+void watchdog_disarm(int result);
+
+// 1 if a call of the calling thread overran its deadline since the last
+// time it asked; asking clears it
+int  watchdog_expired(void);
+
+// logs a call that never came back
+void watchdog_abandon(void);
+
+#endif